@@ -94,8 +94,23 @@ C_SOURCES += $(wildcard $(SOURCE_DIR)/src/*/*/*/*/*.c)
 C_SOURCES += $(wildcard $(SOURCE_DIR)/src/*/*/*/*/*/*.c)
 SOURCES := $(CPP_SOURCES) $(C_SOURCES)
 OBJECTS := $(CPP_SOURCES:$(SOURCE_DIR)/%.cpp=$(BUILD_DIR)/%.o) $(C_SOURCES:$(SOURCE_DIR)/%.c=$(BUILD_DIR)/%.o)
+HOST_CXX ?= g++
+ASSET_PACKER := $(BUILD_DIR)/pack-assets
+ASSET_PACKER_SOURCES := $(SOURCE_DIR)/src/platform/asset_archive.cpp $(SOURCE_DIR)/src/stream/fast_lz.cpp $(SOURCE_DIR)/src/stream/stream.cpp
+ASSET_PACKER_HEADERS := $(wildcard $(SOURCE_DIR)/include/stream/*.h) $(wildcard $(SOURCE_DIR)/include/util/*.h) $(SOURCE_DIR)/include/platform/asset_archive.h
+RESOURCES := $(filter-out %.gpak,$(wildcard $(SOURCE_DIR)/res/*))
+ASSET_ARCHIVE := $(BUILD_DIR)/res/assets.gpak
+# only targets whose getResourceReader reads the archive set USE_ASSET_ARCHIVE
+ifeq '$(USE_ASSET_ARCHIVE)' '1'
+BUNDLED_ASSET_ARCHIVE := $(ASSET_ARCHIVE)
+# the archive has every resource in it, so the loose files aren't shipped too
+BUNDLED_RESOURCES := $(ASSET_ARCHIVE)
+else
+BUNDLED_ASSET_ARCHIVE :=
+BUNDLED_RESOURCES := $(RESOURCES)
+endif
 
-all: $(PROGRAM)
+all: $(PROGRAM) $(BUNDLED_ASSET_ARCHIVE)
 
 $(LIBPNG_BUILD_AUTOGEN): ;
 	mkdir -p $(BUILD_DIR) \
@@ -216,10 +231,16 @@ LDFLAGS += -static-libgcc -static-libstdc++
 $(PROGRAM) : $(OBJECTS) $(LIBSDL2) $(LIBSDL2MAIN) $(LIBPNG) $(LIBOGG) $(LIBVORBISFILE) $(LIBVORBIS) $(LIBZ)
 	$(CXX) -o $(PROGRAM) $(OBJECTS) $(LDFLAGS) $(LIBS) $(DEFERRED_LDFLAGS)
 
+$(ASSET_PACKER) : $(ASSET_PACKER_SOURCES) $(ASSET_PACKER_HEADERS)
+	mkdir -p $(dir $@) && $(HOST_CXX) -std=c++11 -O2 -DCOMPILE_PACK_ASSETS -I$(SOURCE_DIR)/include -o $@ $(ASSET_PACKER_SOURCES) -pthread
+
+$(ASSET_ARCHIVE) : $(ASSET_PACKER) $(RESOURCES)
+	mkdir -p $(dir $@) && $(ASSET_PACKER) $@ $(RESOURCES)
+
 install: all
 
 clean:
-	-rm -rf $(OBJECTS) $(PROGRAM)
+	-rm -rf $(OBJECTS) $(PROGRAM) $(ASSET_PACKER) $(ASSET_ARCHIVE)
 
 distclean: clean
 	-rm -rf $(BUILD_DIR)
@@ -227,8 +248,10 @@ distclean: clean
 ARCHIVE_NAME := game_puzzle$(ARCHIVE_EXTENSION)
 
 bin-archive: all
-	mkdir -p $(BUILD_DIR)/game_puzzle-0.1 \
-	&& cp -rt $(BUILD_DIR)/game_puzzle-0.1 $(PROGRAM) $(SOURCE_DIR)/res $(SOURCE_DIR)/LICENSE $(SOURCE_DIR)/README.md \
+	rm -rf $(BUILD_DIR)/game_puzzle-0.1 \
+	&& mkdir -p $(BUILD_DIR)/game_puzzle-0.1/res \
+	&& cp -rt $(BUILD_DIR)/game_puzzle-0.1 $(PROGRAM) $(SOURCE_DIR)/LICENSE $(SOURCE_DIR)/README.md \
+	&& cp -rt $(BUILD_DIR)/game_puzzle-0.1/res $(BUNDLED_RESOURCES) \
 	&& cd $(BUILD_DIR) \
 	&& { rm -f $(ARCHIVE_NAME) || true; } \
 	&& $(ARCHIVE_COMMAND) $(ARCHIVE_NAME) game_puzzle-0.1
@@ -22,6 +22,7 @@
 #define OGG_VORBIS_DECODER_H_INCLUDED
 
 #include "stream/stream.h"
+#include "stream/prefetch_reader.h"
 #include "platform/audio.h"
 #define OV_EXCLUDE_STATIC_CALLBACKS
 #include <vorbis/vorbisfile.h>
@@ -56,23 +57,20 @@ private:
             errno = EIO;
             return 0;
         }
-        std::size_t readCount = 0;
+        if(blockSize == 0)
+            return 0;
+        // vorbisfile asks for single-byte blocks, so read all of them at once
+        std::size_t totalSize = blockSize * numBlocks, readSize = 0;
         try
         {
             std::uint8_t *dataPtr = (std::uint8_t *)dataPtr_in;
-            for(std::size_t i = 0; i < numBlocks; i++, readCount++)
+            while(readSize < totalSize)
             {
-                std::size_t currentBlockSize = decoder.reader->readBytes(dataPtr, blockSize);
-                if(currentBlockSize == 0)
-                {
-                    return readCount;
-                }
-                if(currentBlockSize != blockSize)
-                {
-                    errno = EIO;
-                    return 0;
-                }
-                dataPtr += blockSize;
+                std::size_t currentSize =
+                    decoder.reader->readBytes(dataPtr + readSize, totalSize - readSize);
+                if(currentSize == 0)
+                    break;
+                readSize += currentSize;
             }
         }
         catch(stream::IOException &)
@@ -80,7 +78,12 @@ private:
             errno = EIO;
             return 0;
         }
-        return readCount;
+        if(readSize % blockSize != 0)
+        {
+            errno = EIO;
+            return 0;
+        }
+        return readSize / blockSize;
     }
     static long tell_fn(void *dataSource)
     {
@@ -149,8 +152,14 @@ private:
     }
 
 public:
+    /// @param reader the Reader to decode from. It's read ahead on an I/O worker thread.
     OggVorbisDecoder(std::shared_ptr<stream::Reader> reader)
-        : ovf(), reader(reader), samples(), channels(), sampleRate(), buffer()
+        : ovf(),
+          reader(stream::PrefetchReader::wrap(reader)),
+          samples(),
+          channels(),
+          sampleRate(),
+          buffer()
     {
         ov_callbacks callbacks;
         callbacks.read_func = &read_fn;
@@ -159,7 +168,7 @@ public:
         callbacks.tell_func = &tell_fn;
         try
         {
-            reader->tell();
+            this->reader->tell();
         }
         catch(stream::NonSeekableException &)
         {
@@ -231,6 +240,19 @@ public:
     {
         return true;
     }
+    virtual bool seek(std::uint64_t sample) override
+    {
+        if(!ov_seekable(&ovf))
+            return false;
+        if(samples != Unknown && sample > samples)
+            sample = samples;
+        if(ov_pcm_seek(&ovf, static_cast<ogg_int64_t>(sample)) != 0)
+            return false;
+        buffer.clear();
+        currentBufferPos = 0;
+        curPos = sample;
+        return true;
+    }
 };
 }
 }
@@ -38,11 +38,64 @@ public:
     }
 };
 
+/** thrown when decoding a png is canceled
+ * @see PngDecoder::Destination::isCanceled
+ */
+class PngDecodeCanceled final : public stream::IOException
+{
+public:
+    PngDecodeCanceled() : IOException("png decoding canceled")
+    {
+    }
+};
+
 /** read and decode png files<br/>
     bytes in RGBA format
  */
 class PngDecoder final
 {
+public:
+    /** receives the rows of a png while it is being decoded
+     *
+     * Decoded rows are written straight into the storage returned by getRow, so a Destination
+     * can decode directly into the final storage of an image.
+     */
+    class Destination
+    {
+    public:
+        virtual ~Destination()
+        {
+        }
+        /** called once before any rows are decoded
+         * @param w the width of the png
+         * @param h the height of the png
+         */
+        virtual void setSize(unsigned w, unsigned h) = 0;
+        /** get the storage for a row
+         * @param y the zero-based number of pixels from the top of the row
+         * @return the 4 * w bytes to store the row in, in the order: red green blue alpha
+         */
+        virtual std::uint8_t *getRow(unsigned y) = 0;
+        /** called after each pass over the rows
+         *
+         * Interlaced pngs have 7 passes. After each pass every row has been written, with the
+         * pixels that haven't been decoded yet filled in from the nearest decoded pixel, so the
+         * whole image can be shown while it is still being decoded. Other pngs have 1 pass.
+         * @param pass the one-based number of the finished pass
+         * @param passCount the number of passes
+         */
+        virtual void passFinished(unsigned pass, unsigned passCount)
+        {
+        }
+        /** checked before each row is decoded
+         * @return true to stop decoding and throw PngDecodeCanceled
+         */
+        virtual bool isCanceled()
+        {
+            return false;
+        }
+    };
+
 private:
     unsigned w, h;
     std::uint8_t *data;
@@ -51,6 +104,14 @@ private:
 
 public:
     explicit PngDecoder(stream::Reader &reader);
+    /** decode a png into a Destination
+     * @param reader the Reader to read the png from. It is read in large blocks, so it may be
+     * read past the end of the png.
+     * @param destination the Destination to decode into
+     * @throw PngLoadError if the png can't be read or decoded
+     * @throw PngDecodeCanceled if destination canceled decoding
+     */
+    static void decode(stream::Reader &reader, Destination &destination);
     PngDecoder(PngDecoder &&rt) : w(rt.w), h(rt.h), data(rt.data)
     {
         rt.data = nullptr;
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef ASSET_ARCHIVE_H_INCLUDED
+#define ASSET_ARCHIVE_H_INCLUDED
+
+#include "stream/stream.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** a packed archive of resources
+ * @class AssetArchive asset_archive.h "platform/asset_archive.h"
+ *
+ * The archive is mapped into memory once. Entries are found by name with a perfect hash in the
+ * index at the start of the file, so a lookup hashes the name twice and compares it with one
+ * entry. Entries start on page boundaries and are either stored as is, so that they are read
+ * straight out of the mapping, or compressed with FastLZ when that makes them much smaller.
+ *
+ * The build packs res/ into an archive with pack-assets, which is asset_archive.cpp compiled
+ * with COMPILE_PACK_ASSETS defined.
+ */
+class AssetArchive final
+{
+    AssetArchive(const AssetArchive &) = delete;
+    AssetArchive &operator=(const AssetArchive &) = delete;
+
+public:
+    enum class Compression : std::uint8_t
+    {
+        None = 0,
+        FastLZ = 1,
+    };
+    static constexpr std::uint32_t magic = 0x4750414BU; // "GPAK"
+    static constexpr std::uint32_t formatVersion = 1;
+    static constexpr std::size_t pageSize = 4096;
+    /// the file name of the archive in the resource directory
+    static const wchar_t *const fileName;
+
+private:
+    struct Entry final
+    {
+        std::wstring name;
+        std::uint64_t offset;
+        std::uint64_t storedSize;
+        std::uint64_t size;
+        Compression compression;
+    };
+    std::shared_ptr<stream::MemoryReader> archive;
+    /// the hash seed for each bucket of names
+    std::vector<std::uint32_t> bucketSeeds;
+    /// the entries in the order of their hash slots
+    std::vector<Entry> entries;
+    explicit AssetArchive(std::shared_ptr<stream::MemoryReader> archive);
+    const Entry *find(const std::wstring &name) const;
+
+public:
+    /** map an archive
+     * @param fileName the name of the archive file
+     * @return the archive or nullptr if the file doesn't exist or can't be mapped
+     * @throw stream::IOException if the file isn't a valid archive
+     */
+    static std::shared_ptr<AssetArchive> open(std::wstring fileName);
+    /** open an entry
+     * @param name the name of the entry, the same as the name of the resource
+     * @return a reader for the entry or nullptr if there is no entry named name
+     * @throw stream::IOException if a compressed entry is corrupt
+     */
+    std::shared_ptr<stream::Reader> openEntry(const std::wstring &name) const;
+    std::size_t size() const
+    {
+        return entries.size();
+    }
+    /** write an archive
+     * @param writer the Writer to write the archive to
+     * @param files the names and contents of the entries
+     * @throw stream::IOException if two entries have the same name
+     */
+    static void write(stream::Writer &writer,
+                      std::vector<std::pair<std::wstring, std::vector<std::uint8_t>>> files);
+};
+}
+}
+
+#endif // ASSET_ARCHIVE_H_INCLUDED
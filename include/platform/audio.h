@@ -30,11 +30,12 @@
 #include <limits>
 #include "stream/stream.h"
 #include "util/util.h"
+#include "util/vector.h"
+#include "platform/audio_dsp.h"
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 #include <functional>
-#include "platform/thread_name.h"
 
 namespace programmerjake
 {
@@ -48,6 +49,9 @@ public:
     }
 };
 
+/// the maximum number of channels that audio is mixed in
+constexpr unsigned maxAudioChannelCount = 8;
+
 class AudioDecoder
 {
     AudioDecoder(const AudioDecoder &) = delete;
@@ -74,18 +78,46 @@ public:
     virtual std::uint64_t decodeAudioBlock(
         float *data, std::uint64_t samplesCount) = 0; // returns number of samples decoded
     virtual bool isHighLatencySource() const = 0;
+    /** move to a sample so that the next decoded sample is that sample
+     *
+     * Used to restart looping audio without creating new decoders.
+     * @param sample the sample to move to; clamped to the end of the audio if it's known
+     * @return true if successful, otherwise the decoder can be in any state and should be
+     * recreated
+     */
+    virtual bool seek(std::uint64_t sample)
+    {
+        ignore_unused_variable_warning(sample);
+        return false;
+    }
 };
 
 class MemoryAudioDecoder final : public AudioDecoder
 {
-    std::vector<float> samples;
+    std::shared_ptr<const std::vector<float>> pSamples;
+    const std::vector<float> &samples;
     unsigned sampleRate;
     std::size_t currentLocation;
     unsigned channels;
 
 public:
     MemoryAudioDecoder(const std::vector<float> &data, unsigned sampleRate, unsigned channelCount)
-        : samples(data), sampleRate(sampleRate), currentLocation(0), channels(channelCount)
+        : MemoryAudioDecoder(
+              std::make_shared<const std::vector<float>>(data), sampleRate, channelCount)
+    {
+    }
+    /** create a MemoryAudioDecoder that shares already-decoded samples
+     *
+     * Many MemoryAudioDecoders can share the same samples, each with its own position.
+     */
+    MemoryAudioDecoder(std::shared_ptr<const std::vector<float>> pSamples,
+                       unsigned sampleRate,
+                       unsigned channelCount)
+        : pSamples(std::move(pSamples)),
+          samples(*this->pSamples),
+          sampleRate(sampleRate),
+          currentLocation(0),
+          channels(channelCount)
     {
         assert(sampleRate > 0);
         assert(channels > 0);
@@ -123,100 +155,65 @@ public:
     {
         return false;
     }
+    virtual bool seek(std::uint64_t sample) override
+    {
+        currentLocation = static_cast<std::size_t>(std::min(sample, numSamples()) * channels);
+        return true;
+    }
 };
 
+/// the quality of the filter used by ResampleAudioDecoder
+enum class ResampleQuality
+{
+    Fast, ///< short filter, some aliasing near the Nyquist frequency
+    Medium, ///< good enough for game audio
+    Best, ///< long filter with a sharp cutoff
+};
+
+/** converts audio to a different sample rate
+ *
+ * Uses a polyphase windowed-sinc filter : the filter is precomputed for every phase that the
+ * reduced ratio of the sample rates can produce, so each output sample is a short dot product.
+ * Filter banks are shared between all ResampleAudioDecoders with the same ratio and quality.
+ */
 class ResampleAudioDecoder final : public AudioDecoder
 {
+public:
+    struct FilterBank;
+
+private:
     std::shared_ptr<AudioDecoder> decoder;
-    std::uint64_t position = 0; // in samples
-    std::vector<float> buffer;
-    std::uint64_t bufferStartPosition = 0; // in values
+    std::shared_ptr<const FilterBank> filterBank;
     unsigned sampleRate, channels;
+    std::vector<float> buffer; // interleaved source samples
+    std::size_t bufferStart = 0; // the first source sample used by the next output sample
+    std::size_t bufferEnd = 0; // in source samples
+    std::uint64_t phase = 0; // the fractional part of the source position
+    std::uint64_t position = 0; // in output samples
+    std::uint64_t sourceSamplesRead = 0;
+    std::uint64_t outputSampleCount = Unknown; // set when the end of decoder is reached
+    bool gotEOF = false;
+    void fillBuffer();
 
 public:
-    ResampleAudioDecoder(std::shared_ptr<AudioDecoder> decoder, unsigned sampleRate)
-        : decoder(decoder), buffer(), sampleRate(sampleRate), channels(decoder->channelCount())
-    {
-        constexpr std::size_t size = 1024;
-        buffer.resize(channels * size);
-        buffer.resize(
-            static_cast<std::size_t>(channels * decoder->decodeAudioBlock(buffer.data(), size)));
-    }
+    ResampleAudioDecoder(std::shared_ptr<AudioDecoder> decoder,
+                         unsigned sampleRate,
+                         ResampleQuality quality = ResampleQuality::Medium);
     virtual unsigned samplesPerSecond() override
     {
         return sampleRate;
     }
-    virtual std::uint64_t numSamples() override
-    {
-        std::uint64_t count = decoder->numSamples();
-        if(count == Unknown)
-            return Unknown;
-        return (count * sampleRate) / decoder->samplesPerSecond();
-    }
+    virtual std::uint64_t numSamples() override;
     virtual unsigned channelCount() override
     {
         return channels;
     }
-    virtual std::uint64_t decodeAudioBlock(float *data, std::uint64_t sampleCount) override
-    {
-        if(numSamples() != Unknown)
-            sampleCount = std::min(numSamples() - position, sampleCount);
-        if(sampleCount == 0 || buffer.size() == 0)
-            return sampleCount;
-        double rateConversionFactor = static_cast<double>(decoder->samplesPerSecond()) / sampleRate;
-        std::uint64_t retval = 0;
-        for(std::uint64_t i = 0; i < sampleCount; i++, position++, retval++)
-        {
-            double finalPosition = position * rateConversionFactor;
-            std::uint64_t startIndex = static_cast<std::uint64_t>(floor(finalPosition));
-            float t = static_cast<float>(finalPosition - startIndex);
-            startIndex *= channels;
-            std::uint64_t endIndex = startIndex + channels;
-            assert(startIndex >= bufferStartPosition);
-            if(endIndex - bufferStartPosition >= buffer.size())
-            {
-                for(unsigned i = 0; i < channels; i++)
-                    buffer[i] = buffer[buffer.size() - channels + i];
-                bufferStartPosition += buffer.size() - channels;
-                buffer.resize(buffer.capacity());
-                std::uint64_t decodeCount = 1, lastDecodeCount;
-                do
-                {
-                    lastDecodeCount = decodeCount;
-                    decodeCount += decoder->decodeAudioBlock(
-                        &buffer[static_cast<std::size_t>(decodeCount * channels)],
-                        buffer.capacity() / channels - decodeCount);
-                } while(decodeCount != lastDecodeCount
-                        && buffer.capacity() / channels < decodeCount);
-                buffer.resize(static_cast<std::size_t>(decodeCount * channels));
-            }
-            if(startIndex - bufferStartPosition >= buffer.size()
-               || (t > 0 && endIndex - bufferStartPosition >= buffer.size()))
-                return retval;
-            if(t > 0)
-            {
-                for(unsigned j = 0; j < channels; j++)
-                {
-                    *data++ = ((1 - t) * buffer[j + static_cast<std::size_t>(startIndex
-                                                                             - bufferStartPosition)]
-                               + t * buffer[j + (std::size_t)(endIndex - bufferStartPosition)]);
-                }
-            }
-            else
-            {
-                for(unsigned j = 0; j < channels; j++)
-                {
-                    *data++ =
-                        buffer[j + static_cast<std::size_t>(startIndex - bufferStartPosition)];
-                }
-            }
-        }
-        return retval;
-    }
+    virtual std::uint64_t decodeAudioBlock(float *data, std::uint64_t sampleCount) override;
     virtual bool isHighLatencySource() const override
     {
         return decoder->isHighLatencySource();
     }
+    virtual bool seek(std::uint64_t sample) override;
 };
 
 class RedistributeChannelsAudioDecoder final : public AudioDecoder
@@ -224,10 +221,16 @@ class RedistributeChannelsAudioDecoder final : public AudioDecoder
     std::shared_ptr<AudioDecoder> decoder;
     unsigned channels;
     std::vector<float> buffer;
+    std::vector<float> channelMatrix;
+    const AudioDSPKernels &kernels;
 
 public:
     RedistributeChannelsAudioDecoder(std::shared_ptr<AudioDecoder> decoder, unsigned channelCountIn)
-        : decoder(decoder), channels(channelCountIn), buffer()
+        : decoder(decoder),
+          channels(channelCountIn),
+          buffer(),
+          channelMatrix(makeChannelMatrix(decoder->channelCount(), channelCountIn)),
+          kernels(getAudioDSPKernels())
     {
     }
     virtual unsigned samplesPerSecond() override
@@ -249,570 +252,21 @@ public:
             return decoder->decodeAudioBlock(data, sampleCount);
         buffer.resize(static_cast<std::size_t>(sampleCount * sourceChannels));
         sampleCount = decoder->decodeAudioBlock(buffer.data(), sampleCount);
-        switch(channels)
-        {
-        case 1:
-        {
-            for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-            {
-                float sum = 0;
-                for(std::size_t j = 0; j < sourceChannels; j++)
-                    sum += buffer[bufferIndex++];
-                *data++ = sum / sourceChannels;
-            }
-            break;
-        }
-        case 2:
-        {
-            switch(sourceChannels)
-            {
-            case 1:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex++];
-                }
-                break;
-            case 3:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    *data++ = (2 * channel1 + channel2) / 3;
-                    *data++ = (channel2 + 2 * channel3) / 3;
-                }
-                break;
-            case 4:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    *data++ = (channel1 + channel3) / 2;
-                    *data++ = (channel2 + channel4) / 2;
-                }
-                break;
-            case 5:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    *data++ = (2 * channel1 + channel2 + 2 * channel4) / 5;
-                    *data++ = (2 * channel3 + channel2 + 2 * channel5) / 5;
-                }
-                break;
-            case 6:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    float channel6 = buffer[bufferIndex++];
-                    *data++ = (2 * channel1 + channel2 + 2 * channel4) / 5 + channel6;
-                    *data++ = (2 * channel3 + channel2 + 2 * channel5) / 5 + channel6;
-                }
-                break;
-            default:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float sum = 0;
-                    for(std::size_t j = 0; j < sourceChannels; j++)
-                        sum += buffer[bufferIndex++];
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                }
-                break;
-            }
-            break;
-        }
-        case 3:
-        {
-            switch(sourceChannels)
-            {
-            case 1:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex++];
-                }
-                break;
-            case 2:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (channel1 + channel2) / 2;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                }
-                break;
-            case 4:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    *data++ = (5 * (channel1 + channel3) - channel2 - channel4) / 8;
-                    *data++ = (channel1 + channel2 + channel3 + channel4) / 4;
-                    *data++ = (5 * (channel2 + channel4) - channel1 - channel3) / 8;
-                }
-                break;
-            case 5:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    *data++ = (channel1 + channel4) / 2;
-                    *data++ = channel2;
-                    *data++ = (channel3 + channel5) / 2;
-                }
-                break;
-            case 6:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    float channel6 = buffer[bufferIndex++];
-                    *data++ = (channel1 + channel4) / 2 + channel6;
-                    *data++ = channel2 + channel6;
-                    *data++ = (channel3 + channel5) / 2 + channel6;
-                }
-                break;
-            default:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float sum = 0;
-                    for(std::size_t j = 0; j < sourceChannels; j++)
-                        sum += buffer[bufferIndex++];
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                }
-                break;
-            }
-            break;
-        }
-        case 4:
-        {
-            switch(sourceChannels)
-            {
-            case 1:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex++];
-                }
-                break;
-            case 2:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    *data++ = channel1;
-                    *data++ = channel2;
-                    *data++ = channel1;
-                    *data++ = channel2;
-                }
-                break;
-            case 3:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    *data++ = (2 * channel1 + channel2) / 3;
-                    *data++ = (channel2 + 2 * channel3) / 3;
-                    *data++ = (2 * channel1 + channel2) / 3;
-                    *data++ = (channel2 + 2 * channel3) / 3;
-                }
-                break;
-            case 5:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    *data++ = (2 * channel1 + channel2) / 3;
-                    *data++ = (2 * channel3 + channel2) / 3;
-                    *data++ = channel4;
-                    *data++ = channel5;
-                }
-                break;
-            case 6:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    float channel6 = buffer[bufferIndex++];
-                    *data++ = (2 * channel1 + channel2) / 3 + channel6;
-                    *data++ = (2 * channel3 + channel2) / 3 + channel6;
-                    *data++ = channel4 + channel6;
-                    *data++ = channel5 + channel6;
-                }
-                break;
-            default:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float sum = 0;
-                    for(std::size_t j = 0; j < sourceChannels; j++)
-                        sum += buffer[bufferIndex++];
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                }
-                break;
-            }
-            break;
-        }
-        case 5:
-        {
-            switch(sourceChannels)
-            {
-            case 1:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex++];
-                }
-                break;
-            case 2:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (channel1 + channel2) / 2;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                }
-                break;
-            case 3:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    *data++ = channel1;
-                    *data++ = channel2;
-                    *data++ = channel3;
-                    *data++ = channel1;
-                    *data++ = channel3;
-                }
-                break;
-            case 4:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (channel1 + channel2 + channel3 + channel4) / 4;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                }
-                break;
-            case 6:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    float channel6 = buffer[bufferIndex++];
-                    *data++ = channel1 + channel6;
-                    *data++ = channel2 + channel6;
-                    *data++ = channel3 + channel6;
-                    *data++ = channel4 + channel6;
-                    *data++ = channel5 + channel6;
-                }
-                break;
-            default:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float sum = 0;
-                    for(std::size_t j = 0; j < sourceChannels; j++)
-                        sum += buffer[bufferIndex++];
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                }
-                break;
-            }
-            break;
-        }
-        case 6:
-        {
-            switch(sourceChannels)
-            {
-            case 1:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex];
-                    *data++ = buffer[bufferIndex++];
-                }
-                break;
-            case 2:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (channel1 + channel2) / 2;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                    *data++ = (channel1 + channel2) / 2;
-                }
-                break;
-            case 3:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    *data++ = channel1;
-                    *data++ = channel2;
-                    *data++ = channel3;
-                    *data++ = channel1;
-                    *data++ = channel3;
-                    *data++ = (channel1 + channel2 + channel3) / 3;
-                }
-                break;
-            case 4:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (channel1 + channel2 + channel3 + channel4) / 4;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                    *data++ = (5 * channel1 - channel2) / 4;
-                    *data++ = (5 * channel2 - channel1) / 4;
-                    *data++ = (channel1 + channel2 + channel3 + channel4) / 4;
-                }
-                break;
-            case 5:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float channel1 = buffer[bufferIndex++];
-                    float channel2 = buffer[bufferIndex++];
-                    float channel3 = buffer[bufferIndex++];
-                    float channel4 = buffer[bufferIndex++];
-                    float channel5 = buffer[bufferIndex++];
-                    *data++ = channel1;
-                    *data++ = channel2;
-                    *data++ = channel3;
-                    *data++ = channel4;
-                    *data++ = channel5;
-                    *data++ = (channel1 + channel2 + channel3 + channel4 + channel5) / 5;
-                }
-                break;
-            default:
-                for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-                {
-                    float sum = 0;
-                    for(std::size_t j = 0; j < sourceChannels; j++)
-                        sum += buffer[bufferIndex++];
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                    *data++ = sum / sourceChannels;
-                }
-                break;
-            }
-            break;
-        }
-        default:
-        {
-            for(std::size_t sample = 0, bufferIndex = 0; sample < sampleCount; sample++)
-            {
-                float sum = 0;
-                for(std::size_t j = 0; j < sourceChannels; j++)
-                    sum += buffer[bufferIndex++];
-                for(std::size_t j = 0; j < channels; j++)
-                    *data++ = sum / sourceChannels;
-            }
-            break;
-        }
-        }
+        kernels.applyChannelMatrix(data,
+                                   channels,
+                                   buffer.data(),
+                                   sourceChannels,
+                                   channelMatrix.data(),
+                                   static_cast<std::size_t>(sampleCount));
         return sampleCount;
     }
     virtual bool isHighLatencySource() const override
     {
         return decoder->isHighLatencySource();
     }
-};
-
-class StreamBufferingAudioDecoder final : public AudioDecoder
-{
-    std::shared_ptr<AudioDecoder> decoder;
-    static constexpr std::size_t bufferSize = 256, bufferCount = 256;
-    std::vector<float> leftovers;
-    std::size_t leftoversCurrentLocation = 0;
-    std::list<std::vector<float>> fullBuffers;
-    std::list<std::vector<float>> emptyBuffers;
-    std::size_t fullBufferCount = 0, emptyBufferCount = 0;
-    std::mutex buffersListsLock;
-    std::condition_variable readerCond;
-    std::condition_variable writerCond;
-    bool done;
-    std::thread decoderThread;
-    void decoderThreadFn()
-    {
-        std::unique_lock<std::mutex> lockIt(buffersListsLock);
-        while(!done)
-        {
-            while(!done && emptyBufferCount == 0)
-                writerCond.wait(lockIt);
-            if(done)
-                break;
-            std::list<std::vector<float>> theBufferInList;
-            theBufferInList.splice(theBufferInList.begin(), emptyBuffers, emptyBuffers.begin());
-            emptyBufferCount--;
-            lockIt.unlock();
-            std::vector<float> &buffer = theBufferInList.front();
-            buffer.resize(bufferSize * channelCountValue);
-            std::uint64_t decodedSampleCount = decoder->decodeAudioBlock(buffer.data(), bufferSize);
-            buffer.resize(static_cast<std::size_t>(decodedSampleCount * channelCountValue));
-            lockIt.lock();
-            if(buffer.empty())
-            {
-                done = true;
-            }
-            else
-            {
-                fullBuffers.splice(fullBuffers.end(), theBufferInList, theBufferInList.begin());
-                fullBufferCount++;
-            }
-            readerCond.notify_all();
-        }
-    }
-    std::uint64_t numSamplesValue;
-    unsigned channelCountValue;
-    unsigned samplesPerSecondValue;
-
-public:
-    StreamBufferingAudioDecoder(std::shared_ptr<AudioDecoder> decoder)
-        : decoder(decoder),
-          leftovers(),
-          fullBuffers(),
-          emptyBuffers(),
-          buffersListsLock(),
-          readerCond(),
-          writerCond(),
-          done(),
-          decoderThread(),
-          numSamplesValue(),
-          channelCountValue(),
-          samplesPerSecondValue()
-    {
-        numSamplesValue = decoder->numSamples();
-        channelCountValue = decoder->channelCount();
-        samplesPerSecondValue = decoder->samplesPerSecond();
-        emptyBuffers.resize(bufferCount);
-        fullBufferCount = 0;
-        emptyBufferCount = bufferCount;
-        leftoversCurrentLocation = 0;
-        done = false;
-        decoderThread = std::thread([this]()
-                                    {
-                                        setThreadName(L"audio buffer");
-                                        decoderThreadFn();
-                                    });
-    }
-    ~StreamBufferingAudioDecoder()
-    {
-        std::unique_lock<std::mutex> lockIt(buffersListsLock);
-        done = true;
-        writerCond.notify_all();
-        lockIt.unlock();
-        decoderThread.join();
-    }
-    virtual unsigned samplesPerSecond() override
+    virtual bool seek(std::uint64_t sample) override
     {
-        return samplesPerSecondValue;
-    }
-    virtual std::uint64_t numSamples() override
-    {
-        return numSamplesValue;
-    }
-    virtual unsigned channelCount() override
-    {
-        return channelCountValue;
-    }
-    virtual std::uint64_t decodeAudioBlock(
-        float *data, std::uint64_t samplesCount) override // returns number of samples decoded
-    {
-        std::uint64_t retval = 0;
-        std::unique_lock<std::mutex> lockIt(buffersListsLock);
-        for(; samplesCount > 0; samplesCount--, retval++)
-        {
-            if(leftoversCurrentLocation + channelCountValue > leftovers.size())
-            {
-                leftoversCurrentLocation = 0;
-                leftovers.clear();
-                while(fullBufferCount == 0)
-                {
-                    if(done)
-                        return retval;
-                    readerCond.wait(lockIt);
-                }
-                leftovers.swap(fullBuffers.front());
-                emptyBuffers.splice(emptyBuffers.end(), fullBuffers, fullBuffers.begin());
-                emptyBufferCount++;
-                fullBufferCount--;
-                writerCond.notify_all();
-            }
-            for(unsigned i = 0; i < channelCountValue; i++)
-            {
-                *data++ = leftovers[leftoversCurrentLocation++];
-            }
-        }
-        return retval;
-    }
-    virtual bool isHighLatencySource() const override
-    {
-        return false;
+        return decoder->seek(sample);
     }
 };
 
@@ -861,6 +315,7 @@ public:
         float *data, std::uint64_t samplesCount) override // returns number of samples decoded
     {
         std::uint64_t retval = 0;
+        bool justRestarted = false;
         while(samplesCount > 0)
         {
             if(!decoder)
@@ -868,8 +323,14 @@ public:
             std::uint64_t decodedAmount = decoder->decodeAudioBlock(data, samplesCount);
             retval += decodedAmount;
             samplesCount -= decodedAmount;
+            data += static_cast<std::size_t>(decodedAmount * channelCountValue);
             if(decodedAmount == 0)
             {
+                if(justRestarted) // don't loop forever on empty audio
+                    return retval;
+                justRestarted = true;
+                if(decoder->seek(0)) // restart without creating a new decoder
+                    continue;
                 decoder = nullptr; // free decoder first to save memory
                 decoder = decoderFactory();
                 if(!decoder)
@@ -881,6 +342,8 @@ public:
                     decoder =
                         std::make_shared<ResampleAudioDecoder>(decoder, samplesPerSecondValue);
             }
+            else
+                justRestarted = false;
         }
         return retval;
     }
@@ -909,6 +372,14 @@ public:
     }
     float volume();
     void volume(float v);
+    /** move a sound in 3D
+     *
+     * The first call makes the sound positional: from then on its gain and pan are computed from
+     * its position relative to the listener.
+     * @param position the new position of the sound
+     * @see setAudioListener
+     */
+    void position(VectorF position);
     double duration();
     ~PlayingAudio()
     {
@@ -921,9 +392,13 @@ public:
 #endif
 };
 
+class OfflineAudioRenderer;
+
 class Audio final
 {
     std::shared_ptr<AudioData> data;
+    friend class OfflineAudioRenderer;
+    std::shared_ptr<PlayingAudio> play(float volume, bool looped, const VectorF *position);
 
 public:
     Audio() : data(nullptr)
@@ -934,13 +409,167 @@ public:
     }
     explicit Audio(std::wstring resourceName, bool isStreaming = false);
     explicit Audio(const std::vector<float> &data, unsigned sampleRate, unsigned channelCount);
-    std::shared_ptr<PlayingAudio> play(float volume = 1, bool looped = false);
+    std::shared_ptr<PlayingAudio> play(float volume = 1, bool looped = false)
+    {
+        return play(volume, looped, nullptr);
+    }
     inline std::shared_ptr<PlayingAudio> play(bool looped)
     {
         return play(1, looped);
     }
+    /// play a positional sound
+    /// @see PlayingAudio::position
+    std::shared_ptr<PlayingAudio> play(VectorF position, float volume = 1, bool looped = false)
+    {
+        return play(volume, looped, &position);
+    }
+    /** decode the start of streaming audio in the background so that it starts playing without
+     * decoding; does nothing for audio that isn't streamed
+     * @see TrackPrefetcher
+     */
+    void prefetch();
     double duration();
 };
+
+/** mixes audio without an audio device
+ *
+ * Plays a script of timed events through the same mixing code as the audio callback, as fast as
+ * possible. Decoding is done synchronously between blocks instead of by the decode workers, so
+ * the output only depends on the script and can be compared against known hashes.
+ */
+class OfflineAudioRenderer final
+{
+    OfflineAudioRenderer(const OfflineAudioRenderer &) = delete;
+    OfflineAudioRenderer &operator=(const OfflineAudioRenderer &) = delete;
+
+public:
+    typedef std::size_t VoiceId;
+    /// how long rendering a block took
+    struct BlockCost final
+    {
+        std::size_t sampleCount;
+        double decodeSeconds; // filling the playing sounds' buffers
+        double mixSeconds; // mixing and converting to 16-bit
+    };
+
+private:
+    enum class EventType
+    {
+        Play,
+        Stop,
+        SetVolume,
+    };
+    struct Event final
+    {
+        std::uint64_t sample;
+        EventType type;
+        VoiceId voice;
+        Audio audio;
+        float volume;
+        bool looped;
+    };
+    unsigned sampleRate, channels;
+    std::size_t blockSampleCount;
+    std::vector<Event> events;
+    VoiceId nextVoiceId = 0;
+    std::vector<BlockCost> blockCosts;
+    std::uint64_t underrunCount = 0;
+    std::size_t maxAudibleVoiceCount;
+    std::uint64_t toSample(double time) const;
+
+public:
+    /** create an OfflineAudioRenderer
+     * @param sampleRate the sample rate of the rendered audio
+     * @param channels the number of channels of the rendered audio, at most maxAudioChannelCount
+     * @param blockSampleCount the most samples mixed at once, like the audio device's buffer size
+     */
+    explicit OfflineAudioRenderer(unsigned sampleRate = 48000,
+                                  unsigned channels = 2,
+                                  std::size_t blockSampleCount = 1024);
+    /** schedule playing audio
+     * @param time when to start playing, in seconds from the start of the rendered audio
+     * @return the voice to use for later events
+     */
+    VoiceId play(double time, Audio audio, float volume = 1, bool looped = false);
+    /// schedule stopping a voice
+    void stop(double time, VoiceId voice);
+    /// schedule changing the volume of a voice
+    void setVolume(double time, VoiceId voice, float volume);
+    /// set the most voices that are mixed at once; initially every voice is mixed
+    /// @see setMaxAudibleVoiceCount(std::size_t)
+    void setMaxAudibleVoiceCount(std::size_t count)
+    {
+        maxAudibleVoiceCount = count;
+    }
+    /** render the scheduled events
+     *
+     * Can be called more than once; each call starts over from time 0.
+     * @param duration how many seconds of audio to render
+     * @return the interleaved 16-bit samples
+     */
+    std::vector<std::int16_t> render(double duration);
+    /// render the scheduled events to a WAV file
+    void renderToWAV(double duration, stream::Writer &writer)
+    {
+        writeWAV(writer, render(duration), sampleRate, channels);
+    }
+    /// @return the cost of each block of the last render
+    const std::vector<BlockCost> &getBlockCosts() const
+    {
+        return blockCosts;
+    }
+    /// @return the number of times that a voice ran out of decoded audio in the last render
+    std::uint64_t getUnderrunCount() const
+    {
+        return underrunCount;
+    }
+    /** hash rendered audio to compare it against known good output
+     * @return the 64-bit FNV-1a hash of the samples, as little-endian bytes
+     */
+    static std::uint64_t hash(const std::vector<std::int16_t> &samples);
+    static void writeWAV(stream::Writer &writer,
+                         const std::vector<std::int16_t> &samples,
+                         unsigned sampleRate,
+                         unsigned channels);
+};
+
+/** get the number of times that a playing sound ran out of decoded audio in the audio callback
+ * @return the number of underruns since the program started
+ */
+std::uint64_t getAudioUnderrunCount();
+
+/** set if dither is added when the mixed audio is converted to 16-bit
+ * @param enabled if dither should be added; dither is initially disabled
+ */
+void setAudioDithering(bool enabled);
+
+/** set the most sounds that are mixed at once
+ *
+ * When more sounds are playing, only the loudest ones are mixed. The others are virtual: they
+ * keep advancing in time without being decoded or mixed, so they can become audible again later
+ * in the right place.
+ * @param count the most sounds that are mixed at once; initially 32
+ */
+void setMaxAudibleVoiceCount(std::size_t count);
+
+/** set where positional sounds are heard from
+ * @param position the position of the listener
+ * @param forward the direction that the listener faces
+ * @param up the listener's up direction
+ * @see PlayingAudio::position
+ */
+void setAudioListener(VectorF position,
+                      VectorF forward = VectorF(0, 0, -1),
+                      VectorF up = VectorF(0, 1, 0));
+
+/** set how positional sounds fade with distance
+ *
+ * Positional sounds are at full volume within referenceDistance of the listener, then fade
+ * inversely with distance. Sounds farther than maxDistance are silent and aren't mixed.
+ * @param referenceDistance the distance where sounds start fading; initially 1
+ * @param maxDistance the distance where sounds are culled; initially 64
+ */
+void setAudioDistanceRange(float referenceDistance, float maxDistance);
 }
 }
 
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef AUDIO_DSP_H_INCLUDED
+#define AUDIO_DSP_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** the kernels that process whole blocks of interleaved float audio
+ *
+ * Every implementation produces exactly the same results, so the choice of implementation never
+ * changes the output.
+ * @see getAudioDSPKernels
+ */
+struct AudioDSPKernels final
+{
+    /// the name of the instruction set used
+    const char *name;
+    /** add audio multiplied by a gain
+     *
+     * computes dest[i] += source[i] * gain
+     * @param dest the audio to add to
+     * @param source the audio to add
+     * @param count the number of values, not samples
+     * @param gain the amount to multiply source by
+     */
+    void (*mixAccumulate)(float *dest, const float *source, std::size_t count, float gain);
+    /** add audio multiplied by a different gain for each channel
+     *
+     * computes dest[i] += source[i] * gains[(i + firstChannel) % channels]
+     * @param dest the audio to add to
+     * @param source the audio to add
+     * @param count the number of values, not samples
+     * @param gains the amount to multiply each channel by
+     * @param channels the number of channels
+     * @param firstChannel the channel of source[0]; it doesn't need to start on a whole sample
+     */
+    void (*mixAccumulateWithChannelGains)(float *dest,
+                                          const float *source,
+                                          std::size_t count,
+                                          const float *gains,
+                                          unsigned channels,
+                                          unsigned firstChannel);
+    /** convert audio to 16-bit
+     *
+     * The values are scaled so that 1 maps to 0x8000, then rounded to nearest and saturated.
+     * @param dest the converted audio
+     * @param source the audio to convert
+     * @param count the number of values, not samples
+     */
+    void (*convertToInt16)(std::int16_t *dest, const float *source, std::size_t count);
+    /** change the number of channels
+     * @param dest the converted audio, with destChannels values per sample
+     * @param destChannels the number of channels of dest
+     * @param source the audio to convert, with sourceChannels values per sample
+     * @param sourceChannels the number of channels of source
+     * @param matrix destChannels rows of sourceChannels coefficients
+     * @param sampleCount the number of samples
+     * @see makeChannelMatrix
+     */
+    void (*applyChannelMatrix)(float *dest,
+                               unsigned destChannels,
+                               const float *source,
+                               unsigned sourceChannels,
+                               const float *matrix,
+                               std::size_t sampleCount);
+};
+
+/** get the fastest kernels that the processor supports
+ *
+ * The processor is checked the first time this is called.
+ */
+const AudioDSPKernels &getAudioDSPKernels();
+
+/// get the portable kernels
+const AudioDSPKernels &getScalarAudioDSPKernels();
+
+/** make the matrix that converts between channel layouts
+ * @param sourceChannels the number of channels to convert from
+ * @param destChannels the number of channels to convert to
+ * @return destChannels rows of sourceChannels coefficients
+ * @see AudioDSPKernels::applyChannelMatrix
+ */
+std::vector<float> makeChannelMatrix(unsigned sourceChannels, unsigned destChannels);
+
+/** add triangular-distribution dither of up to 1 LSB of 16-bit audio
+ *
+ * Used before AudioDSPKernels::convertToInt16 to turn quantization distortion of quiet sounds
+ * into noise.
+ * @param values the audio to add dither to
+ * @param count the number of values, not samples
+ * @param state the random number generator state, must not be 0
+ */
+void addAudioDither(float *values, std::size_t count, std::uint32_t &state);
+}
+}
+
+#endif // AUDIO_DSP_H_INCLUDED
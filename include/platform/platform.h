@@ -45,6 +45,7 @@ struct EventHandler;
 const float defaultFPS = 60;
 
 std::shared_ptr<stream::Reader> getResourceReader(std::wstring resource);
+std::wstring makeUserSpecificFilePath(std::wstring name);
 std::shared_ptr<stream::Reader> readUserSpecificFile(std::wstring name);
 std::shared_ptr<stream::Writer> createOrWriteUserSpecificFile(std::wstring name);
 
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef SOUND_BANK_H_INCLUDED
+#define SOUND_BANK_H_INCLUDED
+
+#include "platform/audio.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/// fully decoded audio that is never modified, so it can be shared between threads
+struct SoundBuffer final
+{
+    unsigned sampleRate;
+    unsigned channels;
+    std::uint64_t sampleCount;
+    std::vector<float> floatSamples; // used if int16Samples is empty
+    std::vector<std::int16_t> int16Samples;
+    std::size_t memoryUsage() const
+    {
+        return floatSamples.size() * sizeof(float) + int16Samples.size() * sizeof(std::int16_t);
+    }
+};
+
+/** plays a SoundBuffer
+ *
+ * Creating one is cheap, so each playback gets its own.
+ */
+class SoundBufferAudioDecoder final : public AudioDecoder
+{
+    std::shared_ptr<const SoundBuffer> buffer;
+    std::uint64_t position = 0; // in samples
+
+public:
+    explicit SoundBufferAudioDecoder(std::shared_ptr<const SoundBuffer> buffer)
+        : buffer(std::move(buffer))
+    {
+    }
+    virtual unsigned samplesPerSecond() override
+    {
+        return buffer->sampleRate;
+    }
+    virtual std::uint64_t numSamples() override
+    {
+        return buffer->sampleCount;
+    }
+    virtual unsigned channelCount() override
+    {
+        return buffer->channels;
+    }
+    virtual std::uint64_t decodeAudioBlock(float *data, std::uint64_t sampleCount) override;
+    virtual bool isHighLatencySource() const override
+    {
+        return false;
+    }
+    virtual bool seek(std::uint64_t sample) override
+    {
+        position = std::min(sample, buffer->sampleCount);
+        return true;
+    }
+};
+
+/** the decoded sound effects, shared by every Audio that loads the same resource
+ * @class SoundBank sound_bank.h "platform/sound_bank.h"
+ *
+ * Each resource is decoded once. Sounds that aren't playing are freed, least recently used
+ * first, when the bank uses more memory than its budget; they are decoded again the next time
+ * they're needed.
+ */
+class SoundBank final
+{
+    SoundBank(const SoundBank &) = delete;
+    SoundBank &operator=(const SoundBank &) = delete;
+
+private:
+    struct Entry final
+    {
+        std::shared_ptr<const SoundBuffer> buffer;
+        std::uint64_t lastUsed;
+    };
+    mutable std::mutex lock;
+    std::unordered_map<std::wstring, Entry> entries;
+    std::uint64_t useCounter = 0;
+    std::size_t memoryUsage = 0;
+    std::size_t memoryBudget = 64 << 20;
+    bool useInt16Samples = false;
+    SoundBank() = default;
+    static std::shared_ptr<const SoundBuffer> decode(const std::wstring &resourceName,
+                                                     bool useInt16Samples);
+    void evictIdleEntries();
+
+public:
+    static SoundBank &get();
+    /** get the decoded samples of a resource, decoding it if it's not already loaded
+     * @param resourceName the file name of the ogg vorbis resource
+     * @return the decoded samples
+     * @throw stream::IOException if the resource can't be read or decoded
+     */
+    std::shared_ptr<const SoundBuffer> load(const std::wstring &resourceName);
+    /** set the memory budget
+     *
+     * Sounds that are in use are never freed, so the bank can use more than its budget.
+     * @param bytes the number of bytes the decoded sounds should use at most
+     */
+    void setMemoryBudget(std::size_t bytes);
+    std::size_t getMemoryBudget() const;
+    /// @return the number of bytes used by the decoded sounds
+    std::size_t getMemoryUsage() const;
+    /** set if sounds decoded from now on are stored as 16-bit samples
+     *
+     * 16-bit samples use half the memory, at the cost of some precision.
+     * @param enabled if 16-bit samples should be used; initially false
+     */
+    void setUseInt16Samples(bool enabled);
+};
+}
+}
+
+#endif // SOUND_BANK_H_INCLUDED
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef TRACK_PREFETCHER_H_INCLUDED
+#define TRACK_PREFETCHER_H_INCLUDED
+
+#include "platform/audio.h"
+#include "platform/sound_bank.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** decodes the start of music tracks before they're played
+ * @class TrackPrefetcher track_prefetcher.h "platform/track_prefetcher.h"
+ *
+ * Streaming audio normally decodes its first buffers when it starts playing. Tracks that are
+ * likely to play next can be prefetched instead: a low-priority thread decodes their first few
+ * seconds into packed 16-bit samples, so they start without decoding anything. The rest of the
+ * track is streamed from the resource once the prefetched part has played.
+ */
+class TrackPrefetcher final
+{
+    TrackPrefetcher(const TrackPrefetcher &) = delete;
+    TrackPrefetcher &operator=(const TrackPrefetcher &) = delete;
+
+private:
+    struct Entry final
+    {
+        std::shared_ptr<const SoundBuffer> head; // nullptr until it's decoded
+        std::uint64_t trackSampleCount;
+        std::uint64_t lastUsed;
+    };
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<std::wstring> queue;
+    std::unordered_map<std::wstring, Entry> entries;
+    std::uint64_t useCounter = 0;
+    double prefetchDuration = 4;
+    std::size_t maxTrackCount = 4;
+    bool done = false;
+    std::thread worker;
+    TrackPrefetcher();
+    ~TrackPrefetcher();
+    void threadFn();
+    void evictOldEntries();
+
+public:
+    static TrackPrefetcher &get();
+    /** start decoding the start of a track in the background
+     *
+     * Returns right away; does nothing if the track is already prefetched.
+     * @param resourceName the file name of the ogg vorbis resource
+     */
+    void prefetch(const std::wstring &resourceName);
+    /** make a decoder that plays the prefetched start of a track and then streams the rest
+     * @param resourceName the file name of the ogg vorbis resource
+     * @return the new decoder or nullptr if the track isn't done being prefetched
+     */
+    std::shared_ptr<AudioDecoder> makeDecoder(const std::wstring &resourceName);
+    /** set how much of each track is prefetched
+     *
+     * Only changes tracks that are prefetched from now on.
+     * @param seconds the length of the start of each track to decode; initially 4
+     */
+    void setPrefetchDuration(double seconds);
+    /** set how many tracks are kept
+     *
+     * When more tracks are prefetched, the least recently used ones are freed.
+     * @param count the most tracks to keep; initially 4
+     */
+    void setMaxTrackCount(std::size_t count);
+};
+}
+}
+
+#endif // TRACK_PREFETCHER_H_INCLUDED
@@ -25,6 +25,7 @@
 #include "util/matrix.h"
 #include "texture/image.h"
 #include "stream/stream.h"
+#include "stream/bulk_rw.h"
 #include "render/render_layer.h"
 #include <vector>
 #include <cassert>
@@ -481,41 +482,29 @@ struct Mesh final
         vertices.clear();
         image = nullptr;
     }
+    /// the triangles and vertices are read in bulk
     static Mesh read(stream::Reader &reader)
     {
-        std::uint32_t triangleCount = stream::read<std::uint32_t>(reader);
-        IndexedTriangle::IndexType vertexCount = stream::read<IndexedTriangle::IndexType>(reader);
         Mesh retval;
-        retval.indexedTriangles.reserve(triangleCount);
-        retval.vertices.reserve(vertexCount);
-        for(std::uint32_t i = 0; i < triangleCount; i++)
+        retval.indexedTriangles = stream::read_span<IndexedTriangle>(reader);
+        retval.vertices = stream::read_span<Vertex>(reader, IndexedTriangle::indexMaxValue());
+        for(const IndexedTriangle &tri : retval.indexedTriangles)
         {
-            retval.indexedTriangles.push_back(
-                static_cast<IndexedTriangle>(stream::read<IndexedTriangle>(reader)));
-        }
-        for(std::uint32_t i = 0; i < vertexCount; i++)
-        {
-            retval.vertices.push_back(static_cast<Vertex>(stream::read<Vertex>(reader)));
+            for(IndexedTriangle::IndexType index : tri.v)
+            {
+                if(index >= retval.vertices.size())
+                    throw stream::InvalidDataValueException("mesh vertex index out of range");
+            }
         }
         retval.image = stream::read<Image>(reader);
         return retval;
     }
+    /// the triangles and vertices are written in bulk
     void write(stream::Writer &writer) const
     {
-        std::uint32_t triangleCount = this->triangleCount();
-        assert(triangleCount == this->triangleCount());
-        IndexedTriangle::IndexType vertexCount = this->vertexCount();
-        assert(vertexCount == this->vertexCount());
-        stream::write<std::uint32_t>(writer, triangleCount);
-        stream::write<IndexedTriangle::IndexType>(writer, vertexCount);
-        for(const IndexedTriangle &tri : indexedTriangles)
-        {
-            stream::write<IndexedTriangle>(writer, tri);
-        }
-        for(const Vertex &vertex : vertices)
-        {
-            stream::write<Vertex>(writer, vertex);
-        }
+        assert(vertexCount() <= IndexedTriangle::indexMaxValue());
+        stream::writeSpan(writer, indexedTriangles);
+        stream::writeSpan(writer, vertices);
         stream::write<Image>(writer, image);
     }
     bool operator==(const Mesh &rt) const
@@ -39,6 +39,7 @@ namespace game_puzzle
 struct TextureCoord
 {
     float u, v;
+    typedef float32_t bulk_rw_element_type;
     constexpr TextureCoord(float u, float v) : u(u), v(v)
     {
     }
@@ -78,6 +79,8 @@ struct Vertex
     VectorF p; /// position
     ColorF c; /// color
     VectorF n; /// normal
+    /// every member is made of float32_t, so arrays of Vertex are read and written in bulk
+    typedef float32_t bulk_rw_element_type;
     constexpr Vertex(TextureCoord t, VectorF p, ColorF c, VectorF n) : t(t), p(p), c(c), n(n)
     {
     }
@@ -128,6 +131,7 @@ struct IndexedTriangle final
     static_assert(std::numeric_limits<IndexType>::max() <= std::numeric_limits<std::size_t>::max(),
                   "index type is too big");
     IndexType v[3];
+    typedef IndexType bulk_rw_element_type;
     constexpr IndexedTriangle(IndexType v0, IndexType v1, IndexType v2) : v{v0, v1, v2}
     {
     }
@@ -175,6 +179,7 @@ struct IndexedTriangle16 final
     static_assert(std::numeric_limits<IndexType>::max() <= std::numeric_limits<std::size_t>::max(),
                   "index type is too big");
     IndexType v[3];
+    typedef IndexType bulk_rw_element_type;
     constexpr IndexedTriangle16(IndexType v0, IndexType v1, IndexType v2) : v{v0, v1, v2}
     {
     }
@@ -224,6 +229,7 @@ struct Triangle
     VectorF p3;
     ColorF c3;
     VectorF n3;
+    typedef float32_t bulk_rw_element_type;
     constexpr Triangle(Vertex v1, Vertex v2, Vertex v3)
         : t1(v1.t),
           p1(v1.p),
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef STREAM_BULK_RW_H_INCLUDED
+#define STREAM_BULK_RW_H_INCLUDED
+
+#include "stream/stream.h"
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+/** tells if arrays of T can be read and written in bulk, by copying their bytes
+ *
+ * Arithmetic types can be, and so can trivially copyable classes that declare the type of every
+ * one of their members with a bulk_rw_element_type typedef, like:
+ * @code
+ * struct Vertex
+ * {
+ *     float x, y, z;
+ *     typedef float32_t bulk_rw_element_type;
+ * };
+ * @endcode
+ * Bulk data is stored in little-endian byte order so that reading and writing it on
+ * little-endian machines is a single copy; big-endian machines swap each element.
+ */
+template <typename T, typename = void>
+struct bulk_rw_traits final
+{
+    static constexpr bool has_bulk_rw = false;
+};
+
+template <typename T>
+struct bulk_rw_traits<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> final
+{
+    static constexpr bool has_bulk_rw = true;
+    typedef T element_type;
+};
+
+template <typename T>
+struct bulk_rw_traits<
+    T,
+    typename std::enable_if<std::is_arithmetic<typename T::bulk_rw_element_type>::value>::type>
+    final
+{
+    typedef typename T::bulk_rw_element_type element_type;
+    static_assert(std::is_trivially_copyable<T>::value, "bulk rw type isn't trivially copyable");
+    static_assert(sizeof(T) % sizeof(element_type) == 0,
+                  "bulk rw type's size isn't a multiple of its element size");
+    static constexpr bool has_bulk_rw = true;
+};
+
+namespace bulk_rw_implementation
+{
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) \
+    && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool isBigEndianHost = true;
+#else
+constexpr bool isBigEndianHost = false;
+#endif
+
+template <std::size_t elementSize>
+inline void swapElements(std::uint8_t *bytes, std::size_t byteCount)
+{
+    for(std::size_t i = 0; i + elementSize <= byteCount; i += elementSize)
+        std::reverse(bytes + i, bytes + i + elementSize);
+}
+
+template <typename ElementType>
+inline typename std::enable_if<std::is_floating_point<ElementType>::value>::type checkElements(
+    const std::uint8_t *bytes, std::size_t byteCount)
+{
+    for(std::size_t i = 0; i < byteCount; i += sizeof(ElementType))
+    {
+        ElementType value;
+        std::memcpy(&value, bytes + i, sizeof(value));
+        if(!std::isfinite(value))
+            throw InvalidDataValueException("read value is not finite");
+    }
+}
+
+template <typename ElementType>
+inline typename std::enable_if<!std::is_floating_point<ElementType>::value>::type checkElements(
+    const std::uint8_t *, std::size_t)
+{
+}
+}
+
+/** write an array in bulk
+ * @param writer the Writer to write to
+ * @param values the array to write
+ * @param count the number of elements in values
+ */
+template <typename T>
+inline void writeBulk(Writer &writer, const T *values, std::size_t count)
+{
+    static_assert(bulk_rw_traits<T>::has_bulk_rw, "type can't be written in bulk");
+    typedef typename bulk_rw_traits<T>::element_type ElementType;
+    const std::uint8_t *bytes = reinterpret_cast<const std::uint8_t *>(values);
+    std::size_t byteCount = count * sizeof(T);
+    if(!bulk_rw_implementation::isBigEndianHost || sizeof(ElementType) == 1)
+    {
+        writer.writeBytes(bytes, byteCount);
+        return;
+    }
+    std::uint8_t buffer[sizeof(ElementType) * 512];
+    while(byteCount > 0)
+    {
+        std::size_t currentCount = std::min(byteCount, sizeof(buffer));
+        std::memcpy(buffer, bytes, currentCount);
+        bulk_rw_implementation::swapElements<sizeof(ElementType)>(buffer, currentCount);
+        writer.writeBytes(buffer, currentCount);
+        bytes += currentCount;
+        byteCount -= currentCount;
+    }
+}
+
+/** read an array in bulk
+ *
+ * Floating point elements are checked to be finite, like read_finite.
+ * @param reader the Reader to read from
+ * @param values the array to read into
+ * @param count the number of elements in values
+ */
+template <typename T>
+inline void readBulk(Reader &reader, T *values, std::size_t count)
+{
+    static_assert(bulk_rw_traits<T>::has_bulk_rw, "type can't be read in bulk");
+    typedef typename bulk_rw_traits<T>::element_type ElementType;
+    std::uint8_t *bytes = reinterpret_cast<std::uint8_t *>(values);
+    std::size_t byteCount = count * sizeof(T);
+    reader.readAllBytes(bytes, byteCount);
+    if(bulk_rw_implementation::isBigEndianHost && sizeof(ElementType) != 1)
+        bulk_rw_implementation::swapElements<sizeof(ElementType)>(bytes, byteCount);
+    bulk_rw_implementation::checkElements<ElementType>(bytes, byteCount);
+}
+
+/** write a length-prefixed span in bulk
+ * @param writer the Writer to write to
+ * @param values the span to write
+ * @see read_span
+ */
+template <typename T>
+inline void writeSpan(Writer &writer, const std::vector<T> &values)
+{
+    assert(values.size() <= std::numeric_limits<std::uint32_t>::max());
+    stream::write<std::uint32_t>(writer, values.size());
+    writeBulk(writer, values.data(), values.size());
+}
+
+GCC_PRAGMA(diagnostic push)
+GCC_PRAGMA(diagnostic ignored "-Weffc++")
+/** read a length-prefixed span written by writeSpan
+ *
+ * Unless the reader's window already holds the whole span, the returned vector is grown as the
+ * elements are read, so a corrupt length fails with an EOFException instead of allocating all
+ * the memory at once.
+ */
+template <typename T>
+struct read_span : public read_base<std::vector<T>>
+{
+    GCC_PRAGMA(diagnostic pop)
+    read_span(Reader &reader,
+              std::uint32_t maxCount = std::numeric_limits<std::uint32_t>::max())
+        : read_base<std::vector<T>>(std::vector<T>())
+    {
+        constexpr std::size_t minimumChunkSize = 1 << 16;
+        std::size_t count = stream::read_limited<std::uint32_t>(reader, 0, maxCount);
+        std::vector<T> &values = this->value;
+        std::size_t windowSize;
+        reader.peek(windowSize);
+        if(windowSize / sizeof(T) >= count)
+        {
+            values.resize(count);
+            readBulk(reader, values.data(), count);
+            return;
+        }
+        while(values.size() < count)
+        {
+            std::size_t oldSize = values.size();
+            std::size_t chunkSize =
+                std::max<std::size_t>(oldSize, minimumChunkSize / sizeof(T) + 1);
+            values.resize(oldSize + std::min(chunkSize, count - oldSize));
+            readBulk(reader, values.data() + oldSize, values.size() - oldSize);
+        }
+    }
+};
+}
+}
+}
+
+#endif // STREAM_BULK_RW_H_INCLUDED
@@ -38,18 +38,65 @@ public:
     }
 };
 
+class FastLZFormatException final : public IOException
+{
+public:
+    FastLZFormatException(const std::string &msg) : IOException("fast LZ error : " + msg)
+    {
+    }
+};
+
+/// how a CompressWriter lays out the compressed data
+enum class CompressionMode
+{
+    /// a single zlib stream, compressed on the calling thread
+    Serial,
+    /** independent blocks compressed on a worker pool, with a block index written by each
+     * CompressWriter::finish
+     *
+     * ExpandReader decompresses the blocks on the worker pool too, and can seek when the
+     * underlying reader is seekable and ends with the compressed data.
+     */
+    ParallelBlocks,
+    /** independent blocks compressed on a worker pool, joined into the same single zlib stream
+     * as Serial so that any ExpandReader can read it
+     */
+    ParallelCompatible,
+};
+
+/// the compression algorithm used by a CompressWriter
+enum class CompressionCodec
+{
+    /// zlib deflate; smaller output
+    Deflate,
+    /** FastLZ; several times faster to compress and expand than Deflate, with bigger output
+     *
+     * Always written in the block format of CompressionMode::ParallelBlocks, so it can't be
+     * used with CompressionMode::ParallelCompatible. With CompressionMode::Serial the blocks are
+     * compressed on the calling thread.
+     */
+    FastLZ,
+};
+
+/** reads the data written by a CompressWriter, detecting the CompressionMode and
+ * CompressionCodec that it was written with
+ */
 class ExpandReader final : public Reader
 {
 private:
+    struct BlockExpander;
     std::shared_ptr<Reader> preader;
     Reader &reader;
     std::shared_ptr<void> state;
     static constexpr std::size_t bufferSize = 1 << 16;
     std::vector<std::uint8_t> buffer, compressedBuffer;
     std::size_t bufferPointer = 0;
-    bool moreAvailable = false, gotEOF = false;
+    bool moreAvailable = false, gotEOF = false, checkedFormat = false;
+    /// set when reading block format data
+    std::shared_ptr<BlockExpander> blockExpander;
     void readBuffer();
     void readCompressedBuffer();
+    void readBlock();
 
 public:
     ExpandReader(std::shared_ptr<Reader> preader) : ExpandReader(*preader)
@@ -73,28 +120,62 @@ public:
         readBuffer();
         return buffer[bufferPointer++];
     }
+    virtual const std::uint8_t *peek(std::size_t &size) override
+    {
+        size = buffer.size() - bufferPointer;
+        return buffer.data() + bufferPointer;
+    }
+    virtual void commit(std::size_t count) override
+    {
+        assert(count <= buffer.size() - bufferPointer);
+        bufferPointer += count;
+    }
+    /** @throw NonSeekableException unless reading the block format written by
+     * CompressionMode::ParallelBlocks or CompressionCodec::FastLZ
+     */
+    virtual std::int64_t tell() override;
+    /** seek using the block index
+     * @throw NonSeekableException unless reading the block format from a seekable reader that
+     * ends with the compressed data
+     */
+    virtual void seek(std::int64_t offset, SeekPosition seekPosition) override;
 };
 
 class CompressWriter final : public Writer
 {
 private:
+    struct BlockCompressor;
     std::shared_ptr<Writer> pwriter;
     Writer &writer;
     std::shared_ptr<void> state;
     static constexpr std::size_t bufferSize = 1 << 16;
+    /// how much is compressed at once by each worker in the parallel modes
+    static constexpr std::size_t parallelBlockSize = 1 << 20;
+    const std::size_t blockSize;
     std::vector<std::uint8_t> buffer, compressedBuffer;
+    /// set in the parallel modes and when using CompressionCodec::FastLZ
+    std::shared_ptr<BlockCompressor> blockCompressor;
     void writeBuffer();
     void writeCompressedBuffer();
 
 public:
-    CompressWriter(std::shared_ptr<Writer> pwriter) : CompressWriter(*pwriter)
+    CompressWriter(std::shared_ptr<Writer> pwriter,
+                   CompressionMode mode = CompressionMode::Serial,
+                   CompressionCodec codec = CompressionCodec::Deflate)
+        : CompressWriter(*pwriter, mode, codec)
     {
         this->pwriter = pwriter;
     }
-    CompressWriter(Writer &writer);
+    CompressWriter(Writer &writer,
+                   CompressionMode mode = CompressionMode::Serial,
+                   CompressionCodec codec = CompressionCodec::Deflate);
     virtual ~CompressWriter()
     {
     }
+    /** compress and write everything written so far
+     *
+     * When writing the block format this waits for the workers and writes a block index.
+     */
     void finish();
     virtual void flush() override
     {
@@ -109,9 +190,21 @@ public:
         }
         buffer.push_back(v);
     }
+    virtual void writeBytes(const std::uint8_t *array, std::size_t count) override
+    {
+        while(count > 0)
+        {
+            if(writeWaits())
+                writeBuffer();
+            std::size_t currentCount = std::min(count, blockSize - buffer.size());
+            buffer.insert(buffer.end(), array, array + currentCount);
+            array += currentCount;
+            count -= currentCount;
+        }
+    }
     virtual bool writeWaits() override
     {
-        if(buffer.size() >= bufferSize)
+        if(buffer.size() >= blockSize)
             return true;
         return false;
     }
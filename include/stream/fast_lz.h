@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef STREAM_FAST_LZ_H_INCLUDED
+#define STREAM_FAST_LZ_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+/** a fast LZ77 block codec
+ * @class FastLZ fast_lz.h "stream/fast_lz.h"
+ *
+ * Uses the LZ4 block format: a sequence of literal runs each followed by a match of at least
+ * 4 bytes up to 64KiB back, with the last 5 bytes always literals. Compression uses a single
+ * hash probe per position, trading ratio for speed; it's several times faster than deflate at
+ * its fastest level, with a lower compression ratio.
+ */
+class FastLZ final
+{
+    FastLZ() = delete;
+
+public:
+    /// @return the maximum compressed size of inputSize bytes
+    static std::size_t compressBound(std::size_t inputSize)
+    {
+        return inputSize + inputSize / 255 + 16;
+    }
+    /** compress a block
+     * @param input the data to compress
+     * @param inputSize the size of the data to compress
+     * @param output where to write the compressed data; must have room for
+     * compressBound(inputSize) bytes
+     * @return the compressed size
+     */
+    static std::size_t compress(const std::uint8_t *input,
+                                std::size_t inputSize,
+                                std::uint8_t *output);
+    /** decompress a block, checking every length and offset against the buffers
+     * @param input the compressed data
+     * @param inputSize the size of the compressed data
+     * @param output where to write the decompressed data
+     * @param outputSize the exact size of the decompressed data
+     * @return true if the compressed data is valid and decompresses to exactly outputSize bytes
+     */
+    static bool decompress(const std::uint8_t *input,
+                           std::size_t inputSize,
+                           std::uint8_t *output,
+                           std::size_t outputSize);
+};
+}
+}
+}
+
+#endif // STREAM_FAST_LZ_H_INCLUDED
@@ -26,7 +26,6 @@
 #include <ostream>
 #include <streambuf>
 #include <string>
-#include "util/circular_deque.h"
 
 #include "util/wchar_bits.h"
 
@@ -36,7 +35,13 @@ namespace game_puzzle
 {
 namespace stream
 {
-class ReaderStreamBuf final : public std::wstreambuf /// reads UTF-8
+/** reads UTF-8
+ *
+ * Whole buffers of bytes are decoded at once, with a fast path for runs of ASCII. Decoding
+ * stops at the first invalid or incomplete UTF-8 sequence or when the Reader throws an
+ * IOException, after which the stream reads as EOF.
+ */
+class ReaderStreamBuf final : public std::wstreambuf
 {
     ReaderStreamBuf(const ReaderStreamBuf &) = delete;
     ReaderStreamBuf &operator=(const ReaderStreamBuf &) = delete;
@@ -44,156 +49,24 @@ class ReaderStreamBuf final : public std::wstreambuf /// reads UTF-8
 private:
     std::shared_ptr<Reader> preader;
     Reader &reader;
-    static constexpr std::size_t bufferSize = 256;
-    circularDeque<wchar_t, bufferSize + 1> buffer;
+    static constexpr std::size_t bufferSize = 4096;
     bool gotEOFOrError = false;
-    wchar_t outputBuffer[1] = {};
-    std::uint8_t charBuffer[4] = {};
-    std::size_t charBufferUsed = 0;
-    bool addToBuffer(unsigned ch) // returns if ch is a valid code-point
-    {
-        if(ch > 0x10FFFF)
-            return false;
-        if(ch >= 0xD800 && ch <= 0xDFFF) // surrogate pairs
-            return false;
-#if WCHAR_BITS == 16
-        if(ch >= 0x10000U)
-        {
-            ch -= 0x10000U;
-            ch &= 0xFFFFFU;
-            buffer.push_back(static_cast<wchar_t>((ch >> 10) + 0xD800U));
-            buffer.push_back(static_cast<wchar_t>((ch & 0x3FF) + 0xDC00U));
-        }
-        else
-#endif
-        {
-            buffer.push_back(static_cast<wchar_t>(ch));
-        }
-        return true;
-    }
-    void readAhead(std::size_t forcedReadCount)
-    {
-        if(gotEOFOrError)
-            return;
-        while(buffer.size() < buffer.capacity()
-                                  - 1 // for surrogate pairs when wchar_t is for UTF-16
-              && (forcedReadCount > 0 || reader.dataAvailable()))
-        {
-            try
-            {
-                if(1 != reader.readBytes(&charBuffer[charBufferUsed], 1))
-                {
-                    gotEOFOrError = true;
-                    return;
-                }
-                charBufferUsed++;
-                if(charBufferUsed >= 2)
-                {
-                    if((charBuffer[charBufferUsed - 1] & 0xC0)
-                       != 0x80) // expected continuation byte
-                    {
-                        gotEOFOrError = true;
-                        return;
-                    }
-                }
-                if(charBuffer[0] < 0x80)
-                {
-                    if(!addToBuffer(charBuffer[0]))
-                    {
-                        gotEOFOrError = true;
-                        return;
-                    }
-                    charBufferUsed = 0;
-                    if(forcedReadCount > 0)
-                        forcedReadCount--;
-                }
-                else if(charBuffer[0] < 0xC0) // invalid byte
-                {
-                    gotEOFOrError = true;
-                    return;
-                }
-                else if(charBuffer[0] < 0xE0) // 2 byte sequence
-                {
-                    if(charBufferUsed >= 2)
-                    {
-                        unsigned v = charBuffer[0] & 0x1F;
-                        v <<= 6;
-                        v |= charBuffer[1] & 0x3F;
-                        charBufferUsed = 0;
-                        if(!addToBuffer(v))
-                        {
-                            gotEOFOrError = true;
-                            return;
-                        }
-                        if(forcedReadCount > 0)
-                            forcedReadCount--;
-                    }
-                }
-                else if(charBuffer[0] < 0xF0) // 3 byte sequence
-                {
-                    if(charBufferUsed >= 3)
-                    {
-                        unsigned v = charBuffer[0] & 0x0F;
-                        v <<= 6;
-                        v |= charBuffer[1] & 0x3F;
-                        v <<= 6;
-                        v |= charBuffer[2] & 0x3F;
-                        charBufferUsed = 0;
-                        if(!addToBuffer(v))
-                        {
-                            gotEOFOrError = true;
-                            return;
-                        }
-                        if(forcedReadCount > 0)
-                            forcedReadCount--;
-                    }
-                }
-                else if(charBuffer[0] < 0xF8) // 4 byte sequence
-                {
-                    if(charBufferUsed >= 4)
-                    {
-                        unsigned v = charBuffer[0] & 0x0F;
-                        v <<= 6;
-                        v |= charBuffer[1] & 0x3F;
-                        v <<= 6;
-                        v |= charBuffer[2] & 0x3F;
-                        v <<= 6;
-                        v |= charBuffer[3] & 0x3F;
-                        charBufferUsed = 0;
-                        if(!addToBuffer(v))
-                        {
-                            gotEOFOrError = true;
-                            return;
-                        }
-                        if(forcedReadCount > 0)
-                            forcedReadCount--;
-                    }
-                }
-                else // invalid byte
-                {
-                    gotEOFOrError = true;
-                    return;
-                }
-            }
-            catch(EOFException &)
-            {
-                gotEOFOrError = true;
-                return;
-            }
-            catch(IOException &)
-            {
-                gotEOFOrError = true;
-                return;
-            }
-        }
-    }
+    /// set after reaching the end of the Reader; decoding continues until inputBuffer is empty
+    bool gotEOF = false;
+    std::uint8_t inputBuffer[bufferSize];
+    std::size_t inputStart = 0, inputEnd = 0;
+    wchar_t outputBuffer[bufferSize];
+    /** decode from inputBuffer into the get area, reading more bytes when needed
+     * @param wait if this should wait for the Reader when no bytes are available
+     */
+    void readAhead(bool wait);
+    void decode();
 
 public:
-    explicit ReaderStreamBuf(Reader &reader) : preader(), reader(reader), buffer()
+    explicit ReaderStreamBuf(Reader &reader) : preader(), reader(reader)
     {
     }
-    explicit ReaderStreamBuf(std::shared_ptr<Reader> preader)
-        : preader(preader), reader(*preader), buffer()
+    explicit ReaderStreamBuf(std::shared_ptr<Reader> preader) : preader(preader), reader(*preader)
     {
     }
     Reader &getReader()
@@ -208,29 +81,26 @@ public:
 protected:
     virtual std::streamsize showmanyc() override
     {
-        readAhead(0);
-        if(buffer.empty())
+        readAhead(false);
+        if(gptr() == egptr())
         {
             if(gotEOFOrError)
                 return -1;
             return 0;
         }
-        return buffer.size();
+        return egptr() - gptr();
     }
     virtual std::wint_t underflow() override
     {
-        if(buffer.empty())
+        if(gptr() == egptr())
         {
-            readAhead(1);
-            if(buffer.empty())
+            readAhead(true);
+            if(gptr() == egptr())
             {
                 return std::char_traits<wchar_t>::eof();
             }
         }
-        outputBuffer[0] = buffer.front();
-        buffer.pop_front();
-        setg(outputBuffer, outputBuffer, &outputBuffer[1]);
-        return outputBuffer[0];
+        return std::char_traits<wchar_t>::to_int_type(*gptr());
     }
 };
 class ReaderIStream final : public std::wistream
@@ -259,7 +129,13 @@ public:
         return sb.getPReader();
     }
 };
-class WriterStreamBuf final : public std::wstreambuf /// writes UTF-8
+/** writes UTF-8
+ *
+ * Characters are buffered and encoded a whole buffer at a time, with a fast path for runs of
+ * ASCII. They are written to the Writer when the buffer fills, on sync and when this is
+ * destroyed, so errors from the Writer are reported then.
+ */
+class WriterStreamBuf final : public std::wstreambuf
 {
     WriterStreamBuf(const WriterStreamBuf &) = delete;
     WriterStreamBuf &operator=(const WriterStreamBuf &) = delete;
@@ -267,22 +143,16 @@ class WriterStreamBuf final : public std::wstreambuf /// writes UTF-8
 private:
     std::shared_ptr<Writer> pwriter;
     Writer &writer;
+    static constexpr std::size_t bufferSize = 4096;
 #if WCHAR_BITS == 16
     static constexpr std::uint_fast32_t emptyCharBuffer = ~static_cast<std::uint_fast32_t>(0);
+    /// a high surrogate waiting for the next character
     std::uint_fast32_t charBuffer = emptyCharBuffer;
 #endif
-    bool writeByte(std::uint8_t v)
-    {
-        try
-        {
-            writer.writeByte(v);
-        }
-        catch(IOException &)
-        {
-            return false;
-        }
-        return true;
-    }
+    wchar_t inputBuffer[bufferSize];
+    std::uint8_t outputBuffer[bufferSize];
+    /// encode and write the characters in the put area
+    bool writeBuffer();
     bool flush()
     {
         try
@@ -295,74 +165,19 @@ private:
         }
         return true;
     }
-    bool writeCodePoint(std::uint_fast32_t ch)
-    {
-        if(ch < 0x80U)
-        {
-            return writeByte(ch);
-        }
-        if(ch < 0x800U)
-        {
-            if(!writeByte(((ch >> 6) & 0x1F) | 0xC0))
-                return false;
-            return writeByte((ch & 0x3F) | 0x80);
-        }
-        if(ch < 0x10000U)
-        {
-            if(!writeByte(((ch >> 12) & 0xF) | 0xE0))
-                return false;
-            if(!writeByte(((ch >> 6) & 0x3F) | 0x80))
-                return false;
-            return writeByte((ch & 0x3F) | 0x80);
-        }
-        if(!writeByte(((ch >> 18) & 0x7) | 0xF0))
-            return false;
-        if(!writeByte(((ch >> 12) & 0x3F) | 0x80))
-            return false;
-        if(!writeByte(((ch >> 6) & 0x3F) | 0x80))
-            return false;
-        return writeByte((ch & 0x3F) | 0x80);
-    }
-    bool writeWChar(wchar_t ch)
-    {
-#if WCHAR_BITS == 16
-        std::uint_fast32_t v = ch;
-        v &= 0xFFFFU;
-        if(charBuffer != emptyCharBuffer)
-        {
-            if(v < 0xDC00U || v > 0xDFFFU)
-            {
-                bool retval = writeCodePoint(charBuffer);
-                charBuffer = emptyCharBuffer;
-                if(!retval)
-                    return false;
-            }
-            else
-            {
-                v &= 0x3FFU;
-                v |= (charBuffer & 0x3FFU) << 10;
-                v += 0x10000U;
-                charBuffer = emptyCharBuffer;
-                return writeCodePoint(v);
-            }
-        }
-        if(v >= 0xD800U && v <= 0xDBFFU)
-        {
-            charBuffer = v;
-            return true;
-        }
-        return writeCodePoint(v);
-#else
-        return writeCodePoint(ch);
-#endif // WCHAR_BITS == 16
-    }
 
 public:
     explicit WriterStreamBuf(Writer &writer) : pwriter(), writer(writer)
     {
+        setp(inputBuffer, inputBuffer + bufferSize);
     }
     explicit WriterStreamBuf(std::shared_ptr<Writer> pwriter) : pwriter(pwriter), writer(*pwriter)
     {
+        setp(inputBuffer, inputBuffer + bufferSize);
+    }
+    virtual ~WriterStreamBuf()
+    {
+        writeBuffer();
     }
     Writer &getWriter()
     {
@@ -376,21 +191,23 @@ public:
 protected:
     virtual int sync() override
     {
-        if(flush())
+        if(writeBuffer() && flush())
             return 0;
         return -1;
     }
     virtual std::wint_t overflow(std::wint_t ch = std::char_traits<wchar_t>::eof()) override
     {
+        if(!writeBuffer())
+            return std::char_traits<wchar_t>::eof();
         if(std::char_traits<wchar_t>::not_eof(ch) != ch) // got EOF
         {
             if(flush())
                 return L' '; // not EOF : success
             return std::char_traits<wchar_t>::eof();
         }
-        if(writeWChar(ch))
-            return ch;
-        return std::char_traits<wchar_t>::eof();
+        *pptr() = std::char_traits<wchar_t>::to_char_type(ch);
+        pbump(1);
+        return ch;
     }
 };
 class WriterOStream final : public std::wostream
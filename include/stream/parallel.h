@@ -24,9 +24,9 @@
 #include "stream/stream.h"
 #include <memory>
 #include "util/util.h"
-#include "util/lock.h"
+#include "util/interval_tree.h"
 #include <mutex>
-#include <vector>
+#include <list>
 #include <condition_variable>
 
 namespace programmerjake
@@ -145,13 +145,18 @@ public:
                                                        std::uint64_t sectionSize) = 0;
 };
 
+/** a Parallel stored in memory
+ *
+ * Sections read and write the memory directly, so reading non-overlapping sections from
+ * different threads never contends on a lock once the sections are locked.
+ */
 class ParallelMemory final : public Parallel
 {
 private:
     const std::shared_ptr<Parallel> implementation;
 
 public:
-    ParallelMemory(std::size_t size);
+    explicit ParallelMemory(std::size_t size = 0);
     virtual std::uint64_t size() override
     {
         return implementation->size();
@@ -173,125 +178,123 @@ public:
     virtual std::shared_ptr<StreamRW> readWriteSection(std::uint64_t sectionStart,
                                                        std::uint64_t sectionSize) override
     {
-        return implementation->readWriteSection(std::uint64_t sectionStart,
-                                                std::uint64_t sectionSize);
+        return implementation->readWriteSection(sectionStart, sectionSize);
     }
 };
 
+/** implements the section locking for a Parallel
+ *
+ * Locked sections are kept in a range lock: any number of read sections can overlap, but a
+ * write section excludes every section that overlaps it. Sections are granted in the order
+ * they are requested, so a waiting write section isn't starved by later read sections.
+ * The derived class only has to implement the actual reading and writing, which is called
+ * without holding any lock, so non-overlapping sections proceed concurrently.
+ *
+ * Resizing locks everything past the smaller of the old and new sizes, so it waits for the
+ * sections that it affects. Writing past the end grows this Parallel before locking the
+ * section, so a thread can append while it holds other sections.
+ * @warning a thread holding a section must not shrink this Parallel to less than the end of that
+ * section, or it will wait forever.
+ */
 class SerializedParallel : public Parallel
 {
 private:
-    std::recursive_mutex globalLock;
-    std::condition_variable_any globalCond;
     struct Region final
     {
         std::uint64_t start;
-        std::uint64_t size;
+        std::uint64_t end;
         bool isReadOnly;
-        Region(std::uint64_t start, std::uint64_t size, bool isReadOnly)
-            : start(start), size(size), isReadOnly(isReadOnly)
+        Region(std::uint64_t start, std::uint64_t end, bool isReadOnly)
+            : start(start), end(end), isReadOnly(isReadOnly)
         {
-            assert(start + size >= start); // assert not wrapping around
+            assert(start <= end);
         }
         bool intersects(const Region &rt) const
         {
             if(isReadOnly && rt.isReadOnly)
                 return false;
-            if(start >= rt.start + rt.size)
+            if(start >= rt.end)
                 return false;
-            if(rt.start >= start + size)
+            if(rt.start >= end)
                 return false;
             return true;
         }
     };
-    std::vector<std::weak_ptr<const Region>> lockedRegions; // the regions that are currently locked
-    std::vector<std::shared_ptr<const Region>>
-        waitingRegions; // the regions that are waiting to be locked
+    class SectionReader;
+    class SectionWriter;
+    std::mutex globalLock;
+    std::condition_variable globalCond;
+    /// the regions that are currently locked
+    interval_tree<Region> lockedRegions;
+    /// the regions that are waiting to be locked, in the order they were requested
+    std::list<Region> waitingRegions;
     std::uint64_t publicSize;
-    bool settingPublicSize;
-    std::size_t waitingOnPublicSizeCount = 0;
-    class MyReader final : public Reader
-    {
-#error finish
-    };
+    bool intersectsLockedRegion(const Region &region) const;
+    /** lock a region, waiting for any intersecting regions that are locked or were requested
+     * first
+     * @return the handle for the locked region; the region is unlocked when it is destroyed
+     */
+    std::shared_ptr<void> lockRegion(std::uint64_t start, std::uint64_t end, bool isReadOnly);
+    /// set the size, shrinking it only if growOnly is false
+    void changeSize(std::uint64_t newSize, bool growOnly);
+    std::shared_ptr<void> lockSection(std::uint64_t sectionStart,
+                                      std::uint64_t sectionSize,
+                                      bool isReadOnly);
 
 protected:
-    std::uint64_t getRequiredSize(std::unique_lock<std::mutex> &theGlobalLock)
-    {
-        ignore_unused_variable_warning(theGlobalLock);
-        std::uint64_t requiredSize = 0;
-        for(auto i = lockedRegions.begin(); i != lockedRegions.end();)
-        {
-            std::shared_ptr<const Region> region = i->lock();
-            if(region == nullptr)
-            {
-                i = lockedRegions.erase(i);
-                continue;
-            }
-            else
-                ++i;
-            std::uint64_t currentRequiredSize = region->start + region->size;
-            if(currentRequiredSize > requiredSize)
-                requiredSize = currentRequiredSize;
-        }
-        for(const std::shared_ptr<const Region> &region : waitingRegions)
-        {
-            std::uint64_t currentRequiredSize = region->start + region->size;
-            if(currentRequiredSize > requiredSize)
-                requiredSize = currentRequiredSize;
-        }
-        return requiredSize;
-    }
-    bool trySetPublicSize(std::uint64_t newSize, std::unique_lock<std::mutex> &theGlobalLock)
-    {
-        if(newSize >= getRequiredSize(theGlobalLock))
-        {
-            publicSize = newSize;
-            return true;
-        }
-        return false;
-    }
-    void setPublicSize(std::uint64_t newSize, std::unique_lock<std::mutex> &theGlobalLock)
+    /** read from the backing storage
+     *
+     * Only called for bytes in a locked section, without holding any lock.
+     * @throw IOException if reading fails
+     */
+    virtual void internalRead(std::uint8_t *data, std::uint64_t start, std::size_t count) = 0;
+    /** write to the backing storage
+     *
+     * Only called for bytes in a locked write section, without holding any lock.
+     * @throw IOException if writing fails
+     */
+    virtual void internalWrite(const std::uint8_t *data,
+                               std::uint64_t start,
+                               std::size_t count) = 0;
+    /** resize the backing storage; new bytes must read as zero
+     *
+     * Only called while everything from the smaller of oldSize and newSize on is locked for
+     * writing, so sections before that can still be in use and their bytes must not move.
+     * @throw IOException if resizing fails
+     */
+    virtual void internalResize(std::uint64_t oldSize, std::uint64_t newSize) = 0;
+    /** get direct access to the bytes starting at start
+     * @param start the position of the first byte
+     * @param size set to the number of bytes that can be accessed through the returned pointer
+     * @return a pointer to the bytes starting at start if they can be accessed directly or
+     * nullptr
+     */
+    virtual std::uint8_t *getDirectPointer(std::uint64_t start, std::uint64_t &size)
     {
-        settingPublicSize = true;
-        try
-        {
-            while(!trySetPublicSize(newSize, theGlobalLock))
-            {
-                globalCond.wait(theGlobalLock);
-            }
-        }
-        catch(...)
-        {
-            settingPublicSize = false;
-            throw;
-        }
-        settingPublicSize = false;
+        ignore_unused_variable_warning(start);
+        size = 0;
+        return nullptr;
     }
-    virtual void internalResize(std::uint64_t newSize,
-                                std::unique_lock<std::mutex> &theGlobalLock) = 0;
-    virtual void checkReadSectionImplemented(std::uint64_t sectionStart,
-                                             std::uint64_t sectionSize) const
+    /// @throw WriteOnlyException if reading is not supported
+    virtual void checkReadSectionImplemented() const
     {
     }
-    virtual void checkWriteSectionImplemented(std::uint64_t sectionStart,
-                                              std::uint64_t sectionSize) const
+    /// @throw ReadOnlyException if writing is not supported
+    virtual void checkWriteSectionImplemented() const
     {
     }
-    virtual void checkResizeImplemented(std::uint64_t newSize)
+    /// @throw NonResizableException if resizing is not supported
+    virtual void checkResizeImplemented() const
     {
     }
-    virtual std::size_t internalReadSection(std::uint8_t *data,
-                                            std::uint64_t start,
-                                            std::size_t count,
-                                            std::unique_lock<std::mutex> &theGlobalLock) = 0;
-    virtual std::size_t internalWriteSection(const std::uint8_t *data,
-                                             std::uint64_t start,
-                                             std::size_t count,
-                                             std::unique_lock<std::mutex> &theGlobalLock) = 0;
 
 public:
-    explicit SerializedParallel(std::uint64_t initialSize) : globalLock(), publicSize(initialSize)
+    explicit SerializedParallel(std::uint64_t initialSize)
+        : globalLock(),
+          globalCond(),
+          lockedRegions(),
+          waitingRegions(),
+          publicSize(initialSize)
     {
     }
     virtual std::uint64_t size() override final
@@ -299,37 +302,31 @@ public:
         std::unique_lock<std::mutex> lockIt(globalLock);
         return publicSize;
     }
-    virtual void resize(std::uint64_t newSize)
+    virtual void resize(std::uint64_t newSize) override final
     {
-        std::unique_lock<std::mutex> lockIt(globalLock);
-        internalResize(newSize, lockIt);
+        changeSize(newSize, false);
     }
     virtual std::shared_ptr<Reader> readSection(std::uint64_t sectionStart,
-                                                std::uint64_t sectionSize)
-    {
-        std::unique_lock<std::mutex> lockIt(globalLock);
-        checkReadSectionImplemented(sectionStart, sectionSize);
-    }
+                                                std::uint64_t sectionSize) override final;
     virtual std::shared_ptr<Writer> writeSection(std::uint64_t sectionStart,
-                                                 std::uint64_t sectionSize)
-    {
-        return implementation->writeSection(sectionStart, sectionSize);
-    }
+                                                 std::uint64_t sectionSize) override final;
     virtual std::shared_ptr<StreamRW> readWriteSection(std::uint64_t sectionStart,
-                                                       std::uint64_t sectionSize)
-    {
-        return implementation->readWriteSection(std::uint64_t sectionStart,
-                                                std::uint64_t sectionSize);
-    }
+                                                       std::uint64_t sectionSize) override final;
 };
 
+/** a Parallel stored in a file
+ *
+ * Sections use positional reads and writes, so sections that don't overlap don't share a
+ * file position and proceed concurrently. The file is created if it doesn't exist, and is
+ * opened read-only if it can't be opened for writing.
+ */
 class ParallelFile final : public Parallel
 {
 private:
     const std::shared_ptr<Parallel> implementation;
 
 public:
-    ParallelFile(std::wstring fileName);
+    explicit ParallelFile(std::wstring fileName);
     virtual std::uint64_t size() override
     {
         return implementation->size();
@@ -351,8 +348,7 @@ public:
     virtual std::shared_ptr<StreamRW> readWriteSection(std::uint64_t sectionStart,
                                                        std::uint64_t sectionSize) override
     {
-        return implementation->readWriteSection(std::uint64_t sectionStart,
-                                                std::uint64_t sectionSize);
+        return implementation->readWriteSection(sectionStart, sectionSize);
     }
 };
 }
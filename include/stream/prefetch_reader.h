@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef PREFETCH_READER_H_INCLUDED
+#define PREFETCH_READER_H_INCLUDED
+
+#include "stream/stream.h"
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+/** reads ahead of the caller on an I/O worker thread so that reads don't wait for storage
+ *
+ * Blocks are read from the underlying reader ahead of what has been read from this. After
+ * opening or seeking, one block is read ahead and that doubles with every block read up to the
+ * prefetch depth, so readers that seek a lot, like vorbisfile when it opens a file, don't wait
+ * for much data that they don't use.
+ *
+ * The underlying reader is read on the I/O worker, so it must not be used by anything else while
+ * this exists. Errors from the underlying reader are thrown by the read that would have returned
+ * the data.
+ */
+class PrefetchReader final : public Reader
+{
+private:
+    struct State;
+    std::shared_ptr<State> state;
+    std::vector<std::uint8_t> block;
+    std::size_t blockPosition = 0;
+    /// the position of the start of block in the underlying reader or -1 if it isn't known
+    std::int64_t blockOffset;
+    std::uint64_t hitCount = 0, missCount = 0;
+    /** move to the next prefetched block
+     * @param wait if this should wait for the I/O worker to read the block
+     * @return false if there is no block yet or at EOF
+     */
+    bool readBlock(bool wait);
+
+public:
+    static constexpr std::size_t defaultDepth = 4;
+    static constexpr std::size_t defaultBlockSize = 1 << 16;
+    /**
+     * @param preader the reader to read ahead from
+     * @param depth the most blocks to read ahead
+     * @param blockSize how much to read at once
+     */
+    explicit PrefetchReader(std::shared_ptr<Reader> preader,
+                            std::size_t depth = defaultDepth,
+                            std::size_t blockSize = defaultBlockSize);
+    /// doesn't wait for the I/O worker to finish reading the current block
+    virtual ~PrefetchReader();
+    /** wrap a reader in a PrefetchReader if reading it can wait for storage
+     * @return preader if it's a MemoryReader or already a PrefetchReader, otherwise a new
+     * PrefetchReader for preader
+     */
+    static std::shared_ptr<Reader> wrap(std::shared_ptr<Reader> preader,
+                                        std::size_t depth = defaultDepth);
+    virtual bool dataAvailable() override;
+    virtual std::uint8_t readByte() override
+    {
+        if(blockPosition >= block.size() && !readBlock(true))
+            throw EOFException();
+        return block[blockPosition++];
+    }
+    virtual const std::uint8_t *peek(std::size_t &size) override
+    {
+        if(blockPosition >= block.size())
+            readBlock(false);
+        size = block.size() - blockPosition;
+        return block.data() + blockPosition;
+    }
+    virtual void commit(std::size_t count) override
+    {
+        assert(count <= block.size() - blockPosition);
+        blockPosition += count;
+    }
+    /// @throw NonSeekableException if the underlying reader can't tell
+    virtual std::int64_t tell() override
+    {
+        if(blockOffset < 0)
+            throw NonSeekableException();
+        return blockOffset + static_cast<std::int64_t>(blockPosition);
+    }
+    /// drops the prefetched data and starts prefetching from the new position
+    virtual void seek(std::int64_t offset, SeekPosition seekPosition) override;
+    /// @return the number of blocks that were already read ahead when they were needed
+    std::uint64_t getHitCount() const
+    {
+        return hitCount;
+    }
+    /// @return the number of blocks that had to be waited for
+    std::uint64_t getMissCount() const
+    {
+        return missCount;
+    }
+};
+}
+}
+}
+
+#endif // PREFETCH_READER_H_INCLUDED
@@ -37,6 +37,7 @@
 #include <unordered_map>
 #include <atomic>
 #include <utility>
+#include <algorithm>
 #include "util/string_cast.h"
 #include "util/enum_traits.h"
 #include "util/circular_deque.h"
@@ -194,6 +195,26 @@ private:
         }
         return v;
     }
+    /// read a big-endian integer, straight out of the window if it's big enough
+    template <typename T>
+    T readBigEndian()
+    {
+        std::uint8_t localBytes[sizeof(T)];
+        std::size_t windowSize;
+        const std::uint8_t *bytes = peek(windowSize);
+        bool isFromWindow = windowSize >= sizeof(T);
+        if(!isFromWindow)
+        {
+            readAllBytes(localBytes, sizeof(T));
+            bytes = localBytes;
+        }
+        T retval = 0;
+        for(std::size_t i = 0; i < sizeof(T); i++)
+            retval = static_cast<T>(retval << 8) | bytes[i];
+        if(isFromWindow)
+            commit(sizeof(T));
+        return retval;
+    }
 
 public:
     Reader()
@@ -217,16 +238,48 @@ public:
     {
         throw NonSeekableException();
     }
+    /** get the bytes that can be read without waiting, without reading them
+     *
+     * Lets bulk and typed reads copy straight out of a reader's buffer instead of calling
+     * readByte for every byte. Readers without a buffer return an empty window.
+     * @param size set to the number of bytes in the returned window
+     * @return the window; only valid until any other function of this reader is called
+     * @see commit
+     */
+    virtual const std::uint8_t *peek(std::size_t &size)
+    {
+        size = 0;
+        return nullptr;
+    }
+    /** read bytes from the window returned by peek
+     * @param count the number of bytes to read; at most the size of the window
+     */
+    virtual void commit(std::size_t count)
+    {
+        assert(count == 0);
+        ignore_unused_variable_warning(count);
+    }
     virtual std::size_t readAvailableBytes(std::uint8_t *array, std::size_t maxCount)
     {
-        std::size_t retval;
+        std::size_t retval = 0;
         try
         {
-            for(retval = 0; retval < maxCount; retval++)
+            while(retval < maxCount)
             {
+                std::size_t windowSize;
+                const std::uint8_t *window = peek(windowSize);
+                if(windowSize > 0)
+                {
+                    windowSize = std::min(windowSize, maxCount - retval);
+                    std::memcpy(array + retval, window, windowSize);
+                    commit(windowSize);
+                    retval += windowSize;
+                    continue;
+                }
                 if(!dataAvailable())
                     return retval;
-                *array++ = readByte();
+                array[retval] = readByte();
+                retval++;
             }
         }
         catch(EOFException &)
@@ -237,12 +290,24 @@ public:
     }
     virtual std::size_t readBytes(std::uint8_t *array, std::size_t maxCount)
     {
-        std::size_t retval;
+        std::size_t retval = 0;
         try
         {
-            for(retval = 0; retval < maxCount; retval++)
+            while(retval < maxCount)
             {
-                *array++ = readByte();
+                std::size_t windowSize;
+                const std::uint8_t *window = peek(windowSize);
+                if(windowSize > 0)
+                {
+                    windowSize = std::min(windowSize, maxCount - retval);
+                    std::memcpy(array + retval, window, windowSize);
+                    commit(windowSize);
+                    retval += windowSize;
+                    continue;
+                }
+                // readByte waits for more data, which can refill the window
+                array[retval] = readByte();
+                retval++;
             }
         }
         catch(EOFException &)
@@ -273,8 +338,7 @@ public:
     }
     std::uint16_t readU16()
     {
-        std::uint16_t v = readU8();
-        std::uint16_t retval = (v << 8) | readU8();
+        std::uint16_t retval = readBigEndian<std::uint16_t>();
         DUMP_V(readU16, retval);
         return retval;
     }
@@ -286,8 +350,7 @@ public:
     }
     std::uint32_t readU32()
     {
-        std::uint32_t v = readU16();
-        std::uint32_t retval = (v << 16) | readU16();
+        std::uint32_t retval = readBigEndian<std::uint32_t>();
         DUMP_V(readU32, retval);
         return retval;
     }
@@ -299,8 +362,7 @@ public:
     }
     std::uint64_t readU64()
     {
-        std::uint64_t v = readU32();
-        std::uint64_t retval = (v << 32) | readU32();
+        std::uint64_t retval = readBigEndian<std::uint64_t>();
         DUMP_V(readU64, retval);
         return retval;
     }
@@ -342,62 +404,55 @@ public:
     }
     std::wstring readString()
     {
-        std::string retval = "";
+        std::string retval;
         for(;;)
         {
-            std::uint32_t b1 = readU8();
-            if(b1 == 0)
-            {
-                break;
-            }
-            else if((b1 & 0x80) == 0)
+            // find the terminating 0 in the window instead of reading byte by byte
+            std::size_t windowSize;
+            const std::uint8_t *window = peek(windowSize);
+            if(windowSize > 0)
             {
-                retval += static_cast<char>(b1);
+                const void *end = std::memchr(window, 0, windowSize);
+                std::size_t count =
+                    end ? static_cast<const std::uint8_t *>(end) - window : windowSize;
+                retval.append(reinterpret_cast<const char *>(window), count);
+                commit(end ? count + 1 : count);
+                if(end)
+                    break;
+                continue;
             }
+            std::uint8_t b = readU8();
+            if(b == 0)
+                break;
+            retval += static_cast<char>(b);
+        }
+        for(std::size_t i = 0; i < retval.size();)
+        {
+            std::uint32_t b1 = static_cast<std::uint8_t>(retval[i]);
+            std::size_t length;
+            if((b1 & 0x80) == 0)
+                length = 1;
             else if((b1 & 0xE0) == 0xC0)
-            {
-                retval += static_cast<char>(b1);
-                std::uint32_t b2 = readU8();
-                if((b2 & 0xC0) != 0x80)
-                    throw UTFDataFormatException();
-                retval += static_cast<char>(b2);
-            }
+                length = 2;
             else if((b1 & 0xF0) == 0xE0)
-            {
-                retval += static_cast<char>(b1);
-                std::uint32_t b2 = readU8();
-                if((b2 & 0xC0) != 0x80)
-                    throw UTFDataFormatException();
-                retval += static_cast<char>(b2);
-                std::uint32_t b3 = readU8();
-                if((b3 & 0xC0) != 0x80)
-                    throw UTFDataFormatException();
-                retval += static_cast<char>(b3);
-            }
+                length = 3;
             else if((b1 & 0xF8) == 0xF0)
+                length = 4;
+            else
+                throw UTFDataFormatException();
+            if(length > retval.size() - i)
+                throw UTFDataFormatException();
+            std::uint32_t v = b1 & (0x7F >> length);
+            for(std::size_t j = 1; j < length; j++)
             {
-                retval += static_cast<char>(b1);
-                std::uint32_t b2 = readU8();
-                if((b2 & 0xC0) != 0x80)
-                    throw UTFDataFormatException();
-                retval += static_cast<char>(b2);
-                std::uint32_t b3 = readU8();
-                if((b3 & 0xC0) != 0x80)
-                    throw UTFDataFormatException();
-                retval += static_cast<char>(b3);
-                std::uint32_t b4 = readU8();
-                if((b4 & 0xC0) != 0x80)
-                    throw UTFDataFormatException();
-                retval += static_cast<char>(b4);
-                std::uint32_t v = b4 & 0x3F;
-                v |= (b3 & 0x3F) << 6;
-                v |= (b2 & 0x3F) << 12;
-                v |= (b1 & 0x7) << 18;
-                if(v >= 0x10FFFF)
+                std::uint32_t b = static_cast<std::uint8_t>(retval[i + j]);
+                if((b & 0xC0) != 0x80)
                     throw UTFDataFormatException();
+                v = (v << 6) | (b & 0x3F);
             }
-            else
+            if(length == 4 && v >= 0x10FFFF)
                 throw UTFDataFormatException();
+            i += length;
         }
         return string_cast<std::wstring>(retval);
     }
@@ -463,6 +518,20 @@ public:
 
 class Writer : public Stream
 {
+private:
+    /// write a big-endian integer with one call to writeBytes
+    template <typename T>
+    void writeBigEndian(T v)
+    {
+        std::uint8_t bytes[sizeof(T)];
+        for(std::size_t i = sizeof(T); i-- > 0;)
+        {
+            bytes[i] = static_cast<std::uint8_t>(v & 0xFF);
+            v = static_cast<T>(v >> 8);
+        }
+        writeBytes(bytes, sizeof(T));
+    }
+
 public:
     Writer()
     {
@@ -495,8 +564,7 @@ public:
     }
     void writeU16(std::uint16_t v)
     {
-        writeU8(static_cast<std::uint8_t>(v >> 8));
-        writeU8(static_cast<std::uint8_t>(v & 0xFF));
+        writeBigEndian(v);
     }
     void writeS16(std::int16_t v)
     {
@@ -504,8 +572,7 @@ public:
     }
     void writeU32(std::uint32_t v)
     {
-        writeU16(static_cast<std::uint16_t>(v >> 16));
-        writeU16(static_cast<std::uint16_t>(v & 0xFFFF));
+        writeBigEndian(v);
     }
     void writeS32(std::int32_t v)
     {
@@ -513,8 +580,7 @@ public:
     }
     void writeU64(std::uint64_t v)
     {
-        writeU32(static_cast<std::uint64_t>(v >> 32));
-        writeU32(static_cast<std::uint64_t>(v & 0xFFFFFFFFU));
+        writeBigEndian(v);
     }
     void writeS64(std::int64_t v)
     {
@@ -549,19 +615,22 @@ public:
     void writeString(std::wstring v)
     {
         std::string str = string_cast<std::string>(v);
+        std::vector<std::uint8_t> bytes;
+        bytes.reserve(str.size() + 1);
         for(char ch : str)
         {
             if(ch != 0)
             {
-                writeU8(ch);
+                bytes.push_back(static_cast<std::uint8_t>(ch));
             }
             else
             {
-                writeU8(0xC0);
-                writeU8(0x80);
+                bytes.push_back(0xC0);
+                bytes.push_back(0x80);
             }
         }
-        writeU8(0);
+        bytes.push_back(0);
+        writeBytes(bytes.data(), bytes.size());
     }
     virtual std::int64_t tell()
     {
@@ -581,7 +650,7 @@ struct read_base
 
 protected:
     ReturnType value;
-    read_base(ReturnType &&value) : value(value)
+    read_base(ReturnType &&value) : value(std::move(value))
     {
     }
 
@@ -870,6 +939,11 @@ public:
     virtual std::int64_t tell() override;
     virtual void seek(std::int64_t offset, SeekPosition seekPosition) override;
     virtual std::size_t readBytes(std::uint8_t *array, std::size_t maxCount) override;
+    virtual std::size_t readAvailableBytes(std::uint8_t *array, std::size_t maxCount) override
+    {
+        // reading a file never waits for another thread to write it
+        return readBytes(array, maxCount);
+    }
 };
 
 class FileWriter final : public Writer
@@ -910,7 +984,7 @@ public:
     virtual void seek(std::int64_t offset, SeekPosition seekPosition) override;
 };
 
-class MemoryReader final : public Reader
+class MemoryReader : public Reader
 {
 private:
     std::shared_ptr<const std::uint8_t> mem;
@@ -965,12 +1039,25 @@ public:
     {
         if(maxCount > length - offset)
             maxCount = length - offset;
-        for(std::size_t i = 0; i < maxCount; i++)
-        {
-            *array++ = mem.get()[offset++];
-        }
+        if(maxCount > 0)
+            std::memcpy(array, mem.get() + offset, maxCount);
+        offset += maxCount;
         return maxCount;
     }
+    virtual std::size_t readBytes(std::uint8_t *array, std::size_t maxCount) override
+    {
+        return readAvailableBytes(array, maxCount);
+    }
+    virtual const std::uint8_t *peek(std::size_t &size) override
+    {
+        size = length - offset;
+        return mem.get() + offset;
+    }
+    virtual void commit(std::size_t count) override
+    {
+        assert(count <= length - offset);
+        offset += count;
+    }
     virtual std::int64_t tell() override
     {
         return offset;
@@ -999,6 +1086,54 @@ public:
             UNREACHABLE();
         }
     }
+    /** make a reader for part of the memory without copying it
+     * @param sliceOffset the offset of the start of the slice
+     * @param sliceLength the length of the slice
+     * @return the new reader, which shares the memory with this reader
+     * @throw SeekOutOfRangeException if the slice doesn't fit in the memory
+     */
+    std::shared_ptr<MemoryReader> slice(std::size_t sliceOffset, std::size_t sliceLength) const
+    {
+        if(sliceOffset > length || sliceLength > length - sliceOffset)
+            throw SeekOutOfRangeException();
+        return std::make_shared<MemoryReader>(
+            std::shared_ptr<const std::uint8_t>(mem, mem.get() + sliceOffset), sliceLength);
+    }
+};
+
+/** reads a file by mapping all of it into memory
+ *
+ * Reading, seeking and slicing are pointer arithmetic and peek() returns the whole rest of the
+ * file, so decoders read straight out of the page cache.
+ */
+class MmapReader final : public MemoryReader
+{
+private:
+    MmapReader(std::shared_ptr<const std::uint8_t> mem, std::size_t length)
+        : MemoryReader(std::move(mem), length)
+    {
+    }
+
+public:
+    /// how the mapped file will be read, so the kernel can read ahead to suit it
+    enum class AccessPattern
+    {
+        /// read from front to back; pages are read well ahead and dropped after they are read
+        Sequential,
+        /// read in scattered pieces; pages are only read when they are touched
+        Random,
+        /// the default read-ahead
+        Normal
+    };
+    /** map a file
+     * @param fileName the name of the file to map
+     * @param accessPattern how the file will be read; resources are usually read from front to
+     * back
+     * @return the new reader or nullptr if the file isn't a regular file or can't be mapped
+     * @note always returns nullptr on platforms without mmap
+     */
+    static std::shared_ptr<MmapReader> open(
+        std::wstring fileName, AccessPattern accessPattern = AccessPattern::Sequential);
 };
 
 class MemoryWriter final : public Writer
@@ -1044,10 +1179,8 @@ public:
         if(count == 0)
             return;
         expandBuffer(count);
-        for(; count > 0; count--, array++)
-        {
-            memory[writeOffset++] = *array;
-        }
+        std::memcpy(&memory[writeOffset], array, count);
+        writeOffset += count;
     }
     virtual std::int64_t tell() override
     {
@@ -1078,6 +1211,19 @@ public:
     }
 };
 
+/// how a StreamPipe synchronizes its reader and writer
+enum class StreamPipeMode
+{
+    /// double buffered, swapping the buffers while holding a lock
+    Locked,
+    /** a lock-free ring buffer for exactly one reading thread and one writing thread
+     *
+     * The threads only block when the ring is empty or full. Written data is visible to the
+     * reader after a flush or after enough data is written.
+     */
+    SingleProducerSingleConsumer,
+};
+
 class StreamPipe final
 {
     StreamPipe(const StreamPipe &) = delete;
@@ -1088,7 +1234,7 @@ private:
     std::shared_ptr<Writer> writerInternal;
 
 public:
-    StreamPipe();
+    explicit StreamPipe(StreamPipeMode mode = StreamPipeMode::Locked);
     Reader &reader()
     {
         return *readerInternal;
@@ -1249,43 +1395,54 @@ template <std::size_t BufferSize = 32768>
 class BufferedReader final : public Reader
 {
     std::shared_ptr<Reader> preader;
-    circularDeque<std::uint8_t, BufferSize + 1> buffer;
-    void readChunk()
+    std::unique_ptr<std::uint8_t[]> buffer;
+    std::size_t bufferStart = 0, bufferEnd = 0;
+    /// refill buffer with what preader has without waiting
+    void readAvailableChunk()
     {
-        const std::size_t localBufferSize = 4096;
-        std::uint8_t localBuffer[localBufferSize];
-        for(;;)
-        {
-            if(buffer.size() >= buffer.capacity())
-                return;
-            std::size_t readChunkSize = buffer.capacity() - buffer.size();
-            if(readChunkSize > localBufferSize)
-                readChunkSize = localBufferSize;
-            std::uint8_t *data = &localBuffer[0];
-            readChunkSize = readAvailableBytes(data, readChunkSize);
-            if(readChunkSize == 0)
-                return;
-            for(std::size_t i = 0; i < readChunkSize; i++)
-                buffer.push_back(*data++);
-        }
+        bufferStart = 0;
+        bufferEnd = preader->readAvailableBytes(buffer.get(), BufferSize);
     }
 
 public:
-    BufferedReader(std::shared_ptr<Reader> preader) : preader(preader)
+    BufferedReader(std::shared_ptr<Reader> preader)
+        : preader(preader), buffer(new std::uint8_t[BufferSize])
     {
     }
     virtual bool dataAvailable() override
     {
-        return !buffer.empty() || preader->dataAvailable();
+        return bufferStart < bufferEnd || preader->dataAvailable();
     }
     virtual std::uint8_t readByte() override
     {
-        if(buffer.empty())
-            readChunk();
-        if(buffer.empty())
+        if(bufferStart >= bufferEnd)
+            readAvailableChunk();
+        if(bufferStart >= bufferEnd)
             return preader->readByte();
-        std::uint8_t retval = buffer.front();
-        buffer.pop_front();
+        return buffer[bufferStart++];
+    }
+    virtual const std::uint8_t *peek(std::size_t &size) override
+    {
+        if(bufferStart >= bufferEnd)
+            readAvailableChunk();
+        size = bufferEnd - bufferStart;
+        return buffer.get() + bufferStart;
+    }
+    virtual void commit(std::size_t count) override
+    {
+        assert(count <= bufferEnd - bufferStart);
+        bufferStart += count;
+    }
+    virtual std::size_t readBytes(std::uint8_t *array, std::size_t maxCount) override
+    {
+        std::size_t retval = std::min(maxCount, bufferEnd - bufferStart);
+        if(retval > 0)
+            std::memcpy(array, buffer.get() + bufferStart, retval);
+        bufferStart += retval;
+        if(maxCount - retval >= BufferSize) // too big to be worth copying through buffer
+            return retval + preader->readBytes(array + retval, maxCount - retval);
+        if(retval < maxCount)
+            retval += Reader::readBytes(array + retval, maxCount - retval);
         return retval;
     }
 };
@@ -1294,35 +1451,50 @@ template <std::size_t BufferSize = 32768>
 class BufferedWriter final : public Writer
 {
     std::shared_ptr<Writer> pwriter;
-    circularDeque<std::uint8_t, BufferSize + 1> buffer;
-    void writeBuffer(bool writeAll)
+    std::unique_ptr<std::uint8_t[]> buffer;
+    std::size_t bufferUsed = 0;
+    void writeBuffer()
     {
-        while(!buffer.empty()
-              && (writeAll || buffer.size() >= buffer.capacity() || !pwriter->writeWaits()))
-        {
-            pwriter->writeByte(buffer.front());
-            buffer.pop_front();
-        }
+        if(bufferUsed == 0)
+            return;
+        pwriter->writeBytes(buffer.get(), bufferUsed);
+        bufferUsed = 0;
     }
 
 public:
-    BufferedWriter(std::shared_ptr<Writer> pwriter) : pwriter(pwriter)
+    BufferedWriter(std::shared_ptr<Writer> pwriter)
+        : pwriter(pwriter), buffer(new std::uint8_t[BufferSize])
     {
     }
     virtual bool writeWaits() override
     {
-        return buffer.size() >= buffer.capacity() && pwriter->writeWaits();
+        return bufferUsed >= BufferSize && pwriter->writeWaits();
     }
     virtual void flush() override
     {
-        writeBuffer(true);
+        writeBuffer();
         pwriter->flush();
     }
     virtual void writeByte(std::uint8_t v) override
     {
-        if(buffer.size() >= buffer.capacity() / 2)
-            writeBuffer(false);
-        buffer.push_back(v);
+        if(bufferUsed >= BufferSize)
+            writeBuffer();
+        buffer[bufferUsed++] = v;
+    }
+    virtual void writeBytes(const std::uint8_t *array, std::size_t count) override
+    {
+        if(count > BufferSize - bufferUsed)
+        {
+            writeBuffer();
+            if(count >= BufferSize) // too big to be worth copying through buffer
+            {
+                pwriter->writeBytes(array, count);
+                return;
+            }
+        }
+        if(count > 0)
+            std::memcpy(buffer.get() + bufferUsed, array, count);
+        bufferUsed += count;
     }
 };
 }
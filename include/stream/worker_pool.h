@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+/** a fixed set of detached threads that run submitted jobs in order
+ *
+ * The pools are never destroyed, so the detached threads can't outlive them.
+ */
+class WorkerPool final
+{
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+private:
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<std::function<void()>> jobs;
+    const std::size_t threadCount;
+    explicit WorkerPool(std::size_t threadCount);
+    void threadFn();
+
+public:
+    /// the pool for work that keeps a processor busy, like compression; has a thread per processor
+    static WorkerPool &compute();
+    /// the pool for work that mostly waits for storage; doesn't depend on the number of processors
+    static WorkerPool &io();
+    std::size_t getThreadCount() const
+    {
+        return threadCount;
+    }
+    void submit(std::function<void()> job);
+    /// run fn on the pool
+    /// @return the future for fn's result
+    template <typename T>
+    std::future<T> submitTask(std::function<T()> fn)
+    {
+        auto task = std::make_shared<std::packaged_task<T()>>(std::move(fn));
+        std::future<T> retval = task->get_future();
+        submit([task]()
+               {
+                   (*task)();
+               });
+        return retval;
+    }
+};
+}
+}
+}
+
+#endif // WORKER_POOL_H_INCLUDED
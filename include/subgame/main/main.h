@@ -54,6 +54,10 @@ private:
 
 public:
     MainGame(std::shared_ptr<GameState> gameState, ui::GameUi *gameUi);
+    static std::wstring getBackgroundMusicName()
+    {
+        return L"main.ogg";
+    }
     virtual std::shared_ptr<PlayingAudio> startBackgroundMusic() override
     {
         return backgroundMusic->play();
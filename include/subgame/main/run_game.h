@@ -60,6 +60,7 @@ public:
           gameState(std::move(gameState)),
           gameUi(gameUi)
     {
+        this->subgameMaker->prefetch();
     }
 
     virtual void move(double deltaTime) override
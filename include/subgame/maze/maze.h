@@ -29,6 +29,7 @@
 #include "texture/texture_atlas.h"
 #include "util/game_version.h"
 #include "ui/label.h"
+#include "platform/track_prefetcher.h"
 
 namespace programmerjake
 {
@@ -55,12 +56,16 @@ private:
     std::shared_ptr<ui::Label> instructionsLabel;
 
 public:
+    static std::wstring getBackgroundMusicName()
+    {
+        return L"maze.ogg";
+    }
     MazeGame(std::shared_ptr<GameState> gameState,
              ui::GameUi *gameUi,
              std::shared_ptr<const MazeMap> mazeMap,
              std::shared_ptr<bool> won)
         : Subgame(std::move(gameState), gameUi, !GameVersion::DEBUG),
-          backgroundMusic(std::make_shared<Audio>(L"maze.ogg", true)),
+          backgroundMusic(std::make_shared<Audio>(getBackgroundMusicName(), true)),
           mazeMap(std::move(mazeMap)),
           won(std::move(won)),
           position(this->mazeMap->width / 2 + 0.5f, 0, this->mazeMap->height / 2 + 0.5f),
@@ -178,6 +183,10 @@ public:
             std::make_shared<maze::MazeMap>(maze::MazeMap::makeRandom(8, mazeSeed)),
             result);
     }
+    virtual void prefetch() const override
+    {
+        TrackPrefetcher::get().prefetch(maze::MazeGame::getBackgroundMusicName());
+    }
 };
 }
 }
@@ -72,6 +72,10 @@ public:
     {
     }
     virtual ~SubgameMaker() = default;
+    /// start loading what the subgame needs in the background, so that it starts right away
+    virtual void prefetch() const
+    {
+    }
     virtual std::shared_ptr<Subgame> makeSubgame(std::shared_ptr<GameState> gameState,
                                                  ui::GameUi *gameUi,
                                                  std::shared_ptr<bool> result) const
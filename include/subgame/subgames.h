@@ -31,6 +31,8 @@ namespace game_puzzle
 namespace subgames
 {
 std::shared_ptr<Subgame> makeMainSubgame(std::shared_ptr<GameState> gameState, ui::GameUi *gameUi);
+/// start loading what the main subgame needs in the background
+void prefetchMainSubgame();
 }
 }
 }
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef DECODED_TEXTURE_CACHE_H_INCLUDED
+#define DECODED_TEXTURE_CACHE_H_INCLUDED
+
+#include "texture/image.h"
+#include <cstdint>
+#include <string>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** on-disk cache of decoded image resources
+ * @class DecodedTextureCache decoded_texture_cache.h "texture/decoded_texture_cache.h"
+ *
+ * Each cached image is stored in the user-specific directory as a header followed by
+ * the raw RGBA pixels of every stored mipmap level, with the rows stored bottom to top
+ * so that the Image doesn't need to be flipped before uploading it to OpenGL.
+ * The header records the size of the source file and a hash of all of it, so stale entries are
+ * detected and rebuilt.
+ */
+class DecodedTextureCache final
+{
+    DecodedTextureCache() = delete;
+
+public:
+    /// incremented whenever the cache file layout changes
+    static constexpr std::uint32_t formatVersion = 4;
+    /// the size of the cache file header; the pixels start on the following page
+    static constexpr std::size_t headerSize = 4096;
+    /** load a png image resource
+     *
+     * If the user-specific cache has an up-to-date copy of the decoded image then it is
+     * memory-mapped into the returned Image without copying it. Otherwise the image is
+     * decoded and the cache entry is rebuilt.
+     * @param resourceName the file name of the image resource to load
+     * @param mipmapped if the mipmap levels should be loaded too, generating and caching them if
+     * they aren't already cached
+     * @return the loaded Image
+     * @throw stream::IOException if the resource can't be read or decoded
+     */
+    static Image load(std::wstring resourceName, bool mipmapped = false);
+    /** get the file name used to cache a resource
+     * @param resourceName the file name of the image resource
+     * @return the file name, relative to the user-specific directory
+     */
+    static std::wstring getCacheFileName(std::wstring resourceName);
+};
+}
+}
+
+#endif // DECODED_TEXTURE_CACHE_H_INCLUDED
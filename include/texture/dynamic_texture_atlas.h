@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef DYNAMIC_TEXTURE_ATLAS_H_INCLUDED
+#define DYNAMIC_TEXTURE_ATLAS_H_INCLUDED
+
+#include "texture/texture_descriptor.h"
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** packs Images into a few large shared pages at run time
+ * @class DynamicTextureAtlas dynamic_texture_atlas.h "texture/dynamic_texture_atlas.h"
+ *
+ * Meshes using textures from the same page can be appended to each other, so they can be drawn
+ * with one draw call. Each page is packed with a bottom-left skyline packer. Images can be
+ * inserted at any time; the TextureDescriptors returned earlier stay valid because pages are
+ * only ever added to and are modified in place.
+ */
+class DynamicTextureAtlas final
+{
+    DynamicTextureAtlas(const DynamicTextureAtlas &) = delete;
+    DynamicTextureAtlas &operator=(const DynamicTextureAtlas &) = delete;
+
+private:
+    struct SkylineNode final
+    {
+        unsigned left, top, width;
+    };
+    struct Page final
+    {
+        Image image;
+        std::vector<SkylineNode> skyline;
+    };
+
+private:
+    const unsigned pageSize;
+    const unsigned padding;
+    const Image::TextureOptions textureOptions;
+    std::vector<Page> pages;
+    std::mutex lock;
+    bool findPosition(const Page &page,
+                      unsigned w,
+                      unsigned h,
+                      std::size_t &nodeIndex,
+                      unsigned &left,
+                      unsigned &top) const;
+    void addSkylineNode(Page &page, std::size_t nodeIndex, SkylineNode newNode);
+    void copyImage(Image &page, unsigned left, unsigned top, const Image &image) const;
+
+public:
+    /** create a new empty DynamicTextureAtlas
+     * @param pageSize the width and height of each page
+     * @param padding the number of pixels around each Image that are filled by extending the
+     * edges of the Image so that texture filtering doesn't mix in neighboring Images
+     * @param textureOptions the texture options for each page
+     */
+    explicit DynamicTextureAtlas(unsigned pageSize = 1024,
+                                 unsigned padding = 1,
+                                 Image::TextureOptions textureOptions = Image::TextureOptions());
+    /** add an Image to this atlas
+     *
+     * Images that don't fit on a page get their own page.
+     * @param image the Image to copy into this atlas
+     * @return the TextureDescriptor for the copied Image
+     * @pre image is not empty
+     */
+    TextureDescriptor insert(Image image);
+    /** get the number of pages
+     * @return the number of pages
+     */
+    std::size_t pageCount();
+    /** get a page
+     * @param index the index of the page to get
+     * @return the page
+     */
+    Image getPage(std::size_t index);
+    /** get the global atlas for generated content such as text and thumbnails
+     * @return the global atlas
+     */
+    static DynamicTextureAtlas &get();
+};
+}
+}
+
+#endif // DYNAMIC_TEXTURE_ATLAS_H_INCLUDED
@@ -21,10 +21,12 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <cassert>
 #include <cstdint>
 #include <cwchar>
 #include <string>
 #include <stdexcept>
+#include <atomic>
 #include <mutex>
 #include <memory>
 #include <type_traits>
@@ -52,16 +54,57 @@ struct SerializedImages;
 /** copy-on-write Image class
  * @class Image image.h "texture/image.h"
  *
+ * Copies of an Image share its pixels until one of them is modified. The number of Images
+ * sharing the pixels is kept in an atomic count, so reading pixels and deciding when to copy
+ * them doesn't lock.
  */
 class Image final
 {
     friend struct SerializedImages;
+    friend class DecodedTextureCache;
 
 public:
+    enum class RowOrder
+    {
+        TopToBottom,
+        BottomToTop
+    };
+    /** controls how an Image is stored as an OpenGL texture
+     * @see setTextureOptions
+     */
+    struct TextureOptions final
+    {
+        /// generate gamma-correct mipmaps and use trilinear filtering for minification
+        bool mipmapped;
+        /// let the driver store the texture compressed if it supports texture compression
+        bool compressed;
+        constexpr TextureOptions(bool mipmapped = false, bool compressed = false)
+            : mipmapped(mipmapped), compressed(compressed)
+        {
+        }
+        friend bool operator==(TextureOptions l, TextureOptions r)
+        {
+            return l.mipmapped == r.mipmapped && l.compressed == r.compressed;
+        }
+        friend bool operator!=(TextureOptions l, TextureOptions r)
+        {
+            return !(l == r);
+        }
+    };
+    /** a reduced-size level of a mipmapped Image
+     * @see generateMipmaps
+     */
+    struct MipLevel final
+    {
+        /// the BytesPerPixel * w * h bytes of the level in the order: red green blue alpha
+        std::shared_ptr<const std::uint8_t> pixels;
+        unsigned w, h;
+    };
     /** load an image resource
      * @param resourceName the file name of the image resource to load
+     * @param textureOptions how the loaded Image is stored as an OpenGL texture
      */
-    explicit Image(std::wstring resourceName);
+    explicit Image(std::wstring resourceName, TextureOptions textureOptions = TextureOptions());
     /** create a new transparent Image
      * @param w the width of the new image
      * @param h the height of the new image
@@ -72,6 +115,15 @@ public:
      * @param c the color to set the new Image to
      */
     explicit Image(ColorI c);
+    /** create a new Image that uses already-decoded pixels without copying them
+     * @param pixels the pixel storage; it must hold BytesPerPixel * w * h writable bytes
+     * in the order: red green blue alpha
+     * @param w the width of the new Image
+     * @param h the height of the new Image
+     * @param rowOrder the order of the rows of pixels in pixels
+     * @note pixels is released when the last Image using it is destroyed
+     */
+    explicit Image(std::shared_ptr<std::uint8_t> pixels, unsigned w, unsigned h, RowOrder rowOrder);
     /// create a new empty Image
     Image() noexcept : data()
     {
@@ -80,6 +132,26 @@ public:
     Image(std::nullptr_t) noexcept : Image()
     {
     }
+    Image(const Image &rt) noexcept : data(rt.data)
+    {
+        if(data)
+            data->imageCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    Image(Image &&rt) noexcept : data(std::move(rt.data))
+    {
+    }
+    Image &operator=(Image rt) noexcept
+    {
+        data.swap(rt.data);
+        return *this;
+    }
+    ~Image()
+    {
+        // release so that our reads of the pixels happen before another Image that then holds
+        // the only reference modifies them
+        if(data)
+            data->imageCount.fetch_sub(1, std::memory_order_release);
+    }
 
     /** @brief set a pixel
      *
@@ -109,6 +181,19 @@ public:
     /** unbind the current OpenGL texture.
      */
     static void unbind();
+    /** set how this Image is stored as an OpenGL texture
+     *
+     * The texture is uploaded again the next time this Image is bound.
+     * @param textureOptions the new texture options
+     * @note the texture options are shared by every Image that shares this Image's pixels
+     * @pre this Image is not empty
+     */
+    void setTextureOptions(TextureOptions textureOptions);
+    /** get how this Image is stored as an OpenGL texture
+     * @return the texture options
+     * @pre this Image is not empty
+     */
+    TextureOptions getTextureOptions() const;
     /** get the width of this Image
      * @return the width of this Image
      * @pre this Image is not empty
@@ -174,11 +259,6 @@ public:
         return static_cast<std::size_t>(data->w) * static_cast<std::size_t>(data->h)
                * BytesPerPixel;
     }
-    enum class RowOrder
-    {
-        TopToBottom,
-        BottomToTop
-    };
     /** get this Image's pixels
      * @param dest the memory to store this Image's pixels into
      * @param rowOrder the order of the rows of pixels stored into dest
@@ -235,46 +315,225 @@ public:
         int destLeft, int destTop, int destW, int destH, Image src, int srcLeft, int srcTop);
     static constexpr std::size_t BytesPerPixel = 4;
 
+private:
+    struct data_t;
+
+public:
+    /** scoped read-only access to the pixels of an Image
+     * @class Image::ConstPixelView image.h "texture/image.h"
+     *
+     * Reading pixels through the view doesn't lock. Shared pixels are only modified in place
+     * through mapSharedForWrite, so the view sees every other change as a copy that it doesn't
+     * read.
+     * @note the view must not outlive the Image it was created from, the Image must not be
+     * modified while the view exists, and the pixels must not be modified through
+     * mapSharedForWrite while the view exists
+     * @see mapForRead
+     */
+    class ConstPixelView final
+    {
+        friend class Image;
+
+    private:
+        const data_t *data;
+        explicit ConstPixelView(const data_t *data) : data(data)
+        {
+        }
+
+    public:
+        ConstPixelView(ConstPixelView &&) = default;
+        ConstPixelView &operator=(ConstPixelView &&) = default;
+        unsigned width() const
+        {
+            return data->w;
+        }
+        unsigned height() const
+        {
+            return data->h;
+        }
+        /** get a row of pixels
+         * @param y the zero-based number of pixels from the top of the row
+         * @return the width() * BytesPerPixel bytes of the row in the order: red green blue alpha
+         */
+        const std::uint8_t *row(unsigned y) const
+        {
+            assert(y < data->h);
+            if(data->rowOrder == RowOrder::BottomToTop)
+                y = data->h - y - 1;
+            return &data->data[static_cast<std::size_t>(y) * data->w * BytesPerPixel];
+        }
+        /** get a pixel without bounds checking
+         * @param x the zero-based number of pixels from the left of the pixel to get
+         * @param y the zero-based number of pixels from the top of the pixel to get
+         * @return the color of the pixel at (x, y)
+         */
+        ColorI getPixel(unsigned x, unsigned y) const
+        {
+            assert(x < data->w);
+            const std::uint8_t *pixel = row(y) + BytesPerPixel * x;
+            return RGBAI(pixel[0], pixel[1], pixel[2], pixel[3]);
+        }
+    };
+    /** scoped read-write access to the pixels of an Image
+     * @class Image::PixelView image.h "texture/image.h"
+     *
+     * A view from mapForWrite copies the Image's pixels if they are shared when the view is
+     * created, so writing pixels through it never needs to lock. A view from mapSharedForWrite
+     * instead locks the shared pixels once for the whole lifetime of the view.
+     * @note the view must not outlive the Image it was created from and the Image must not be
+     * copied, bound, or modified except through the view while the view exists
+     * @see mapForWrite
+     * @see mapSharedForWrite
+     */
+    class PixelView final
+    {
+        friend class Image;
+
+    private:
+        data_t *data;
+        std::unique_lock<std::mutex> lock;
+        PixelView(data_t *data, bool needLock) : data(data), lock(data->lock, std::defer_lock)
+        {
+            if(needLock)
+                lock.lock();
+        }
+
+    public:
+        PixelView(PixelView &&) = default;
+        PixelView &operator=(PixelView &&) = default;
+        unsigned width() const
+        {
+            return data->w;
+        }
+        unsigned height() const
+        {
+            return data->h;
+        }
+        /** get a row of pixels
+         * @param y the zero-based number of pixels from the top of the row
+         * @return the width() * BytesPerPixel bytes of the row in the order: red green blue alpha
+         */
+        std::uint8_t *row(unsigned y) const
+        {
+            assert(y < data->h);
+            if(data->rowOrder == RowOrder::BottomToTop)
+                y = data->h - y - 1;
+            return &data->data[static_cast<std::size_t>(y) * data->w * BytesPerPixel];
+        }
+        /** get a pixel without bounds checking
+         * @param x the zero-based number of pixels from the left of the pixel to get
+         * @param y the zero-based number of pixels from the top of the pixel to get
+         * @return the color of the pixel at (x, y)
+         */
+        ColorI getPixel(unsigned x, unsigned y) const
+        {
+            assert(x < data->w);
+            const std::uint8_t *pixel = row(y) + BytesPerPixel * x;
+            return RGBAI(pixel[0], pixel[1], pixel[2], pixel[3]);
+        }
+        /** set a pixel without bounds checking
+         * @param x the zero-based number of pixels from the left of the pixel to set
+         * @param y the zero-based number of pixels from the top of the pixel to set
+         * @param c the color to set to
+         */
+        void setPixel(unsigned x, unsigned y, ColorI c) const
+        {
+            assert(x < data->w);
+            std::uint8_t *pixel = row(y) + BytesPerPixel * x;
+            pixel[0] = c.r;
+            pixel[1] = c.g;
+            pixel[2] = c.b;
+            pixel[3] = c.a;
+        }
+    };
+    /** get read-only access to this Image's pixels
+     * @return the new view
+     * @pre this Image is not empty
+     */
+    ConstPixelView mapForRead() const;
+    /** get read-write access to this Image's pixels
+     *
+     * Copies the pixels first if they are shared with another Image.
+     * @return the new view
+     * @pre this Image is not empty
+     */
+    PixelView mapForWrite();
+    /** get read-write access to this Image's pixels without copying them
+     *
+     * Unlike every other way of modifying an Image, the changes are seen by every Image that
+     * shares this Image's pixels. The pixels are locked for the lifetime of the returned view,
+     * which keeps other shared writers and binding out, but reads through other Images don't
+     * lock, so the caller has to keep them from running at the same time.
+     * @return the new view
+     * @pre this Image is not empty
+     */
+    PixelView mapSharedForWrite();
+
 private:
     struct data_t
     {
         data_t(const data_t &) = delete;
         data_t &operator=(const data_t &) = delete;
+        const std::shared_ptr<std::uint8_t> storage;
         std::uint8_t *const data;
         const unsigned w, h;
         RowOrder rowOrder;
+        TextureOptions textureOptions;
+        /// empty until generated; the rows are always stored bottom to top
+        std::vector<MipLevel> mipLevels;
         std::uint32_t texture;
         bool textureValid;
+        TextureOptions uploadedTextureOptions;
         std::uint64_t textureGraphicsContextId;
+        /// the number of Images sharing this data; only 1 means this data can be modified in place
+        std::atomic_size_t imageCount;
+        /// held by mapSharedForWrite and while binding
         std::mutex lock;
-        data_t(std::uint8_t *data, unsigned w, unsigned h, RowOrder rowOrder)
-            : data(data),
+        data_t(std::shared_ptr<std::uint8_t> storage, unsigned w, unsigned h, RowOrder rowOrder)
+            : storage(std::move(storage)),
+              data(this->storage.get()),
               w(w),
               h(h),
               rowOrder(rowOrder),
+              textureOptions(),
+              mipLevels(),
               texture(0),
               textureValid(false),
+              uploadedTextureOptions(),
               textureGraphicsContextId(0),
+              imageCount(1),
               lock()
         {
         }
+        data_t(std::uint8_t *data, unsigned w, unsigned h, RowOrder rowOrder)
+            : data_t(std::shared_ptr<std::uint8_t>(data,
+                                                   [](std::uint8_t *data)
+                                                   {
+                                                       delete[] data;
+                                                   }),
+                     w,
+                     h,
+                     rowOrder)
+        {
+        }
         data_t(std::uint8_t *data, std::shared_ptr<data_t> rt)
-            : data(data),
-              w(rt->w),
-              h(rt->h),
-              rowOrder(rt->rowOrder),
-              texture(0),
-              textureValid(false),
-              textureGraphicsContextId(0),
-              lock()
+            : data_t(data, rt->w, rt->h, rt->rowOrder)
         {
+            textureOptions = rt->textureOptions;
         }
         ~data_t();
     };
     std::shared_ptr<data_t> data;
+    /// @return true if this is the only Image using its pixels
+    bool isUnique() const
+    {
+        // acquire so that the other Images' reads of the pixels happen before we modify them
+        return data->imageCount.load(std::memory_order_acquire) == 1;
+    }
     void setRowOrder(RowOrder newRowOrder) const;
     void swapRows(unsigned y1, unsigned y2) const;
     void copyOnWrite();
+    void uploadTexture(bool isNewTexture, const std::uint8_t *pixels) const;
     struct Hasher final
     {
         std::hash<std::shared_ptr<data_t>> hasher;
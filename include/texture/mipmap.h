@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef MIPMAP_H_INCLUDED
+#define MIPMAP_H_INCLUDED
+
+#include "texture/image.h"
+#include <cstdint>
+#include <vector>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** get the number of mipmap levels of an image
+ * @param w the width of the full-size image
+ * @param h the height of the full-size image
+ * @return the number of levels, including the full-size level and the 1x1 level
+ */
+unsigned getMipmapLevelCount(unsigned w, unsigned h);
+
+/** generate the mipmap levels of an image
+ *
+ * Each level is made by averaging 2x2 blocks of the previous level. Colors are averaged in linear
+ * light instead of in sRGB and are weighted by alpha, so that levels don't get darker and
+ * transparent pixels don't bleed into their neighbors.
+ * @param pixels the BytesPerPixel * w * h bytes of the full-size image in the order:
+ * red green blue alpha
+ * @param w the width of the full-size image
+ * @param h the height of the full-size image
+ * @return every level after the full-size level, in order of decreasing size. The rows of each
+ * level are in the same order as the rows of pixels.
+ */
+std::vector<Image::MipLevel> generateMipmaps(const std::uint8_t *pixels, unsigned w, unsigned h);
+}
+}
+
+#endif // MIPMAP_H_INCLUDED
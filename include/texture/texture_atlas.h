@@ -39,7 +39,20 @@ public:
         MazeWall2, MazeWall3, MazeWall4, MazeFinish;
 
 public:
+    /** get the texture holding an image resource
+     *
+     * Image resources that aren't mipmapped are packed into a page of DynamicTextureAtlas::get()
+     * so that they can be drawn in the same batch as each other and as generated content.
+     * @param textureIndex the index of the image resource
+     * @return the texture
+     */
     static Image texture(std::size_t textureIndex);
+    /** get where an image resource is in its texture
+     * @param textureIndex the index of the image resource
+     * @return the part of texture(textureIndex) that holds the image resource
+     */
+    static TextureDescriptor placement(std::size_t textureIndex);
+    /// the coordinates in the image resource; see td for the coordinates in the texture
     float minU() const
     {
         return (left + pixelOffset) / textureXRes(textureIndex);
@@ -67,25 +80,33 @@ public:
     static constexpr float pixelOffset = 0.05f;
     TextureDescriptor td() const
     {
-        return TextureDescriptor(texture(textureIndex), minU(), maxU(), minV(), maxV());
+        return placement(textureIndex).subTexture(minU(), maxU(), minV(), maxV());
     }
     TextureDescriptor tdNoOffset() const
     {
-        return TextureDescriptor(texture(textureIndex),
-                                 static_cast<float>(left) / textureXRes(textureIndex),
-                                 static_cast<float>(left + width) / textureXRes(textureIndex),
-                                 1 - static_cast<float>(top + height) / textureYRes(textureIndex),
-                                 1 - static_cast<float>(top) / textureYRes(textureIndex));
+        return placement(textureIndex)
+            .subTexture(static_cast<float>(left) / textureXRes(textureIndex),
+                        static_cast<float>(left + width) / textureXRes(textureIndex),
+                        1 - static_cast<float>(top + height) / textureYRes(textureIndex),
+                        1 - static_cast<float>(top) / textureYRes(textureIndex));
     }
 
 private:
     struct ImageDescriptor final
     {
-        Image *image;
+        TextureDescriptor *placement;
         const wchar_t *const fileName;
         const int width, height;
-        constexpr ImageDescriptor(const wchar_t *fileName, int width, int height)
-            : image(nullptr), fileName(fileName), width(width), height(height)
+        const Image::TextureOptions textureOptions;
+        constexpr ImageDescriptor(const wchar_t *fileName,
+                                  int width,
+                                  int height,
+                                  Image::TextureOptions textureOptions = Image::TextureOptions())
+            : placement(nullptr),
+              fileName(fileName),
+              width(width),
+              height(height),
+              textureOptions(textureOptions)
         {
         }
         ImageDescriptor(const ImageDescriptor &) = default;
@@ -143,6 +143,8 @@ struct ColorF final
 {
     friend constexpr ColorF RGBAF(float r, float g, float b, float a);
     float r, g, b, a; /// a is opacity -- 0 is transparent and 1 is opaque
+    typedef float32_t bulk_rw_element_type;
+
 private:
     constexpr ColorF(float r, float g, float b, float a) : r(r), g(g), b(b), a(a)
     {
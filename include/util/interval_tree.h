@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef INTERVAL_TREE_H_INCLUDED
+#define INTERVAL_TREE_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include "util/util.h"
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** a set of half-open intervals [start, end) with values, searchable by overlap
+ * @class interval_tree interval_tree.h "util/interval_tree.h"
+ *
+ * A treap ordered by start where every node also holds the largest end in its subtree, so a
+ * search skips every subtree that ends before the searched interval. Finding an overlapping
+ * interval takes O(log n + k) expected time, where k is the number of overlapping intervals
+ * visited, however long the stored intervals are.
+ */
+template <typename T>
+class interval_tree final
+{
+    interval_tree(const interval_tree &) = delete;
+    interval_tree &operator=(const interval_tree &) = delete;
+
+private:
+    struct Node;
+    typedef std::unique_ptr<Node> NodePointer;
+    struct Node final
+    {
+        std::uint64_t start, end, maxEnd;
+        /// makes the key unique when intervals start at the same place
+        std::uint64_t sequence;
+        std::uint64_t priority;
+        T value;
+        NodePointer left, right;
+        Node(std::uint64_t start, std::uint64_t end, std::uint64_t sequence, T value)
+            : start(start),
+              end(end),
+              maxEnd(end),
+              sequence(sequence),
+              priority(hashSequence(sequence)),
+              value(std::move(value)),
+              left(),
+              right()
+        {
+        }
+        void update()
+        {
+            maxEnd = end;
+            if(left)
+                maxEnd = std::max(maxEnd, left->maxEnd);
+            if(right)
+                maxEnd = std::max(maxEnd, right->maxEnd);
+        }
+        bool isBefore(std::uint64_t keyStart, std::uint64_t keySequence) const
+        {
+            if(start != keyStart)
+                return start < keyStart;
+            return sequence < keySequence;
+        }
+    };
+    NodePointer root;
+    std::uint64_t nextSequence;
+    std::size_t nodeCount;
+    /// the treap's priorities; a hash of the sequence number spreads them like random numbers
+    static std::uint64_t hashSequence(std::uint64_t v)
+    {
+        v += 0x9E3779B97F4A7C15ULL;
+        v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        v = (v ^ (v >> 27)) * 0x94D049BB133111EBULL;
+        return v ^ (v >> 31);
+    }
+    /// split tree into the nodes before the key and the rest
+    static void split(NodePointer tree,
+                      std::uint64_t keyStart,
+                      std::uint64_t keySequence,
+                      NodePointer &before,
+                      NodePointer &after)
+    {
+        if(!tree)
+        {
+            before = nullptr;
+            after = nullptr;
+            return;
+        }
+        if(tree->isBefore(keyStart, keySequence))
+        {
+            split(std::move(tree->right), keyStart, keySequence, tree->right, after);
+            tree->update();
+            before = std::move(tree);
+        }
+        else
+        {
+            split(std::move(tree->left), keyStart, keySequence, before, tree->left);
+            tree->update();
+            after = std::move(tree);
+        }
+    }
+    /// join two trees where every node of before comes before every node of after
+    static NodePointer merge(NodePointer before, NodePointer after)
+    {
+        if(!before)
+            return after;
+        if(!after)
+            return before;
+        if(before->priority > after->priority)
+        {
+            before->right = merge(std::move(before->right), std::move(after));
+            before->update();
+            return before;
+        }
+        after->left = merge(std::move(before), std::move(after->left));
+        after->update();
+        return after;
+    }
+    template <typename Fn>
+    static bool findOverlapping(const Node *node, std::uint64_t start, std::uint64_t end, Fn &fn)
+    {
+        // nothing in this subtree ends after start
+        if(!node || node->maxEnd <= start)
+            return false;
+        if(findOverlapping(node->left.get(), start, end, fn))
+            return true;
+        // this node and everything after it start at or after end
+        if(node->start >= end)
+            return false;
+        if(node->end > start && fn(node->value))
+            return true;
+        return findOverlapping(node->right.get(), start, end, fn);
+    }
+
+public:
+    /// identifies an interval for erase
+    struct handle final
+    {
+        std::uint64_t start;
+        std::uint64_t sequence;
+    };
+    interval_tree() : root(), nextSequence(0), nodeCount(0)
+    {
+    }
+    ~interval_tree()
+    {
+        clear();
+    }
+    std::size_t size() const
+    {
+        return nodeCount;
+    }
+    bool empty() const
+    {
+        return nodeCount == 0;
+    }
+    void clear()
+    {
+        // take the tree apart one merge at a time so destroying a degenerate tree can't
+        // recurse deeply
+        while(root)
+            root = merge(std::move(root->left), std::move(root->right));
+        nodeCount = 0;
+    }
+    /** add an interval
+     * @param start the start of the interval
+     * @param end the end of the interval, one past the last position in it
+     * @param value the value to store with the interval
+     * @return the handle to pass to erase
+     */
+    handle insert(std::uint64_t start, std::uint64_t end, T value)
+    {
+        assert(start <= end);
+        std::uint64_t sequence = nextSequence++;
+        NodePointer before, after;
+        split(std::move(root), start, sequence, before, after);
+        NodePointer node(new Node(start, end, sequence, std::move(value)));
+        root = merge(merge(std::move(before), std::move(node)), std::move(after));
+        nodeCount++;
+        return handle{start, sequence};
+    }
+    /** remove an interval
+     * @param h the handle returned by insert for the interval to remove
+     */
+    void erase(handle h)
+    {
+        NodePointer before, rest, node, after;
+        split(std::move(root), h.start, h.sequence, before, rest);
+        split(std::move(rest), h.start, h.sequence + 1, node, after);
+        assert(node && !node->left && !node->right);
+        if(node)
+            nodeCount--;
+        root = merge(std::move(before), std::move(after));
+    }
+    /** call fn with the value of each interval that overlaps [start, end) in order of their
+     * starts, until fn returns true
+     *
+     * Intervals overlap if each one starts before the other ends.
+     * @return true if fn returned true
+     */
+    template <typename Fn>
+    bool anyOverlapping(std::uint64_t start, std::uint64_t end, Fn fn) const
+    {
+        return findOverlapping(root.get(), start, end, fn);
+    }
+};
+}
+}
+
+#endif // INTERVAL_TREE_H_INCLUDED
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef LOCK_FREE_QUEUE_H_INCLUDED
+#define LOCK_FREE_QUEUE_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** bounded lock-free multiple-producer multiple-consumer queue
+ *
+ * Never allocates after construction, so it can be used from real-time threads such as the audio
+ * callback.
+ * @tparam T the type of the elements; it must be default-constructible and copy-assignable
+ * @tparam queueCapacity the maximum number of elements; it must be a power of 2
+ */
+template <typename T, std::size_t queueCapacity>
+class LockFreeQueue final
+{
+    static_assert(queueCapacity >= 2 && (queueCapacity & (queueCapacity - 1)) == 0,
+                  "queueCapacity must be a power of 2");
+    LockFreeQueue(const LockFreeQueue &) = delete;
+    LockFreeQueue &operator=(const LockFreeQueue &) = delete;
+
+private:
+    struct Cell final
+    {
+        std::atomic_size_t sequence;
+        T value;
+    };
+    Cell cells[queueCapacity];
+    std::atomic_size_t pushPosition, popPosition;
+
+public:
+    LockFreeQueue() : pushPosition(0), popPosition(0)
+    {
+        for(std::size_t i = 0; i < queueCapacity; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    static constexpr std::size_t capacity()
+    {
+        return queueCapacity;
+    }
+    /** add an element to the back of the queue
+     * @param value the element to add
+     * @return false if the queue is full
+     */
+    bool push(const T &value)
+    {
+        std::size_t position = pushPosition.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            Cell &cell = cells[position & (queueCapacity - 1)];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference =
+                static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if(difference == 0)
+            {
+                if(pushPosition.compare_exchange_weak(
+                       position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(difference < 0)
+                return false;
+            else
+                position = pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+    /** remove the element at the front of the queue
+     * @param value set to the removed element
+     * @return false if the queue is empty
+     */
+    bool pop(T &value)
+    {
+        std::size_t position = popPosition.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            Cell &cell = cells[position & (queueCapacity - 1)];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference =
+                static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if(difference == 0)
+            {
+                if(popPosition.compare_exchange_weak(
+                       position, position + 1, std::memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(position + queueCapacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(difference < 0)
+                return false;
+            else
+                position = popPosition.load(std::memory_order_relaxed);
+        }
+    }
+};
+}
+}
+
+#endif // LOCK_FREE_QUEUE_H_INCLUDED
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef SPSC_RING_H_INCLUDED
+#define SPSC_RING_H_INCLUDED
+
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+/** wait-free single-producer single-consumer ring buffer
+ *
+ * One thread may write while another thread reads. Neither side ever locks, waits, or allocates
+ * after construction.
+ *
+ * The capacity is a power of two and the read and write positions count up forever, so
+ * positions map to elements with a mask. Elements are transferred in at most two contiguous
+ * spans, either by copying with read and write or in place with readSpans and writeSpans.
+ */
+template <typename T>
+class SPSCRing final
+{
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing &operator=(const SPSCRing &) = delete;
+
+public:
+    /** part of the ring as at most two contiguous pieces
+     *
+     * first is always used before second.
+     */
+    template <typename U>
+    struct Spans final
+    {
+        U *first;
+        std::size_t firstCount;
+        U *second;
+        std::size_t secondCount;
+        std::size_t size() const
+        {
+            return firstCount + secondCount;
+        }
+    };
+
+private:
+    const std::size_t bufferSize;
+    std::unique_ptr<T[]> buffer;
+    std::atomic_size_t readPosition, writePosition;
+    static std::size_t roundUpToPowerOf2(std::size_t v)
+    {
+        std::size_t retval = 1;
+        while(retval < v)
+            retval <<= 1;
+        return retval;
+    }
+    template <typename U>
+    Spans<U> makeSpans(std::size_t position, std::size_t count) const
+    {
+        std::size_t index = position & (bufferSize - 1);
+        std::size_t firstCount = std::min(count, bufferSize - index);
+        return Spans<U>{&buffer[index], firstCount, &buffer[0], count - firstCount};
+    }
+
+public:
+    /** create a SPSCRing
+     * @param capacity the minimum number of elements that can be stored; rounded up to a power
+     * of two
+     */
+    explicit SPSCRing(std::size_t capacity)
+        : bufferSize(roundUpToPowerOf2(capacity)),
+          buffer(new T[bufferSize]),
+          readPosition(0),
+          writePosition(0)
+    {
+    }
+    std::size_t capacity() const
+    {
+        return bufferSize;
+    }
+    /// @return the number of elements that can be read; exact when called by the reader
+    std::size_t size() const
+    {
+        std::size_t read = readPosition.load(std::memory_order_acquire);
+        std::size_t write = writePosition.load(std::memory_order_acquire);
+        return write - read;
+    }
+    /// @return the number of elements that can be written; exact when called by the writer
+    std::size_t freeSpace() const
+    {
+        return capacity() - size();
+    }
+    /** get the elements that can be read without removing them; only call from the reading thread
+     * @param maxCount the maximum number of elements to return
+     * @return the readable elements
+     * @see consume
+     */
+    Spans<const T> readSpans(std::size_t maxCount) const
+    {
+        std::size_t read = readPosition.load(std::memory_order_relaxed);
+        std::size_t write = writePosition.load(std::memory_order_acquire);
+        return makeSpans<const T>(read, std::min(maxCount, write - read));
+    }
+    /** remove elements after they are read; only call from the reading thread
+     * @param count the number of elements to remove; at most the size of the last readSpans
+     */
+    void consume(std::size_t count)
+    {
+        std::size_t read = readPosition.load(std::memory_order_relaxed);
+        assert(count <= writePosition.load(std::memory_order_relaxed) - read);
+        readPosition.store(read + count, std::memory_order_release);
+    }
+    /** get the free space that can be written to; only call from the writing thread
+     * @param maxCount the maximum number of elements to return
+     * @return the writable elements
+     * @see commit
+     */
+    Spans<T> writeSpans(std::size_t maxCount)
+    {
+        std::size_t write = writePosition.load(std::memory_order_relaxed);
+        std::size_t read = readPosition.load(std::memory_order_acquire);
+        return makeSpans<T>(write, std::min(maxCount, bufferSize - (write - read)));
+    }
+    /** make written elements readable; only call from the writing thread
+     * @param count the number of elements written; at most the size of the last writeSpans
+     */
+    void commit(std::size_t count)
+    {
+        std::size_t write = writePosition.load(std::memory_order_relaxed);
+        assert(count <= bufferSize - (write - readPosition.load(std::memory_order_relaxed)));
+        writePosition.store(write + count, std::memory_order_release);
+    }
+    /** write elements; only call from the writing thread
+     * @param values the elements to write
+     * @param count the number of elements to write
+     * @return the number of elements written, which is less than count if the ring is full
+     */
+    std::size_t write(const T *values, std::size_t count)
+    {
+        Spans<T> spans = writeSpans(count);
+        std::copy(values, values + spans.firstCount, spans.first);
+        std::copy(values + spans.firstCount, values + spans.size(), spans.second);
+        commit(spans.size());
+        return spans.size();
+    }
+    /** read elements; only call from the reading thread
+     * @param values the memory to read the elements into
+     * @param count the number of elements to read
+     * @return the number of elements read, which is less than count if the ring is empty
+     */
+    std::size_t read(T *values, std::size_t count)
+    {
+        Spans<const T> spans = readSpans(count);
+        values = std::copy(spans.first, spans.first + spans.firstCount, values);
+        std::copy(spans.second, spans.second + spans.secondCount, values);
+        consume(spans.size());
+        return spans.size();
+    }
+};
+}
+}
+
+#endif // SPSC_RING_H_INCLUDED
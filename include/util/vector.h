@@ -39,6 +39,7 @@ struct VectorF;
 struct VectorI
 {
     std::int32_t x, y, z;
+    typedef std::int32_t bulk_rw_element_type;
     constexpr VectorI(std::int32_t x, std::int32_t y, std::int32_t z) : x(x), y(y), z(z)
     {
     }
@@ -171,6 +172,7 @@ public:
 struct VectorF
 {
     float x, y, z;
+    typedef float32_t bulk_rw_element_type;
 
     constexpr VectorF(float x, float y, float z) : x(x), y(y), z(z)
     {
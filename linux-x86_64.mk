@@ -9,5 +9,6 @@ CFLAGS += -pthread
 DEFERRED_LDFLAGS := -pthread -lGL -ldl -lrt
 ARCHIVE_EXTENSION := .txz
 ARCHIVE_COMMAND := tar -cvaf
+USE_ASSET_ARCHIVE := 1
 
 include common.mk
\ No newline at end of file
@@ -23,6 +23,11 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <vector>
 #include "util/util.h"
 
 using namespace std;
@@ -44,29 +49,89 @@ void pngloadwarning(png_structp, png_const_charp)
     // do nothing
 }
 
+struct BlockReader final
+{
+    static constexpr size_t bufferSize = 1 << 16;
+    stream::Reader &reader;
+    vector<uint8_t> buffer;
+    size_t position = 0, size = 0;
+    explicit BlockReader(stream::Reader &reader) : reader(reader), buffer()
+    {
+    }
+    void read(uint8_t *output, size_t count)
+    {
+        while(count > 0)
+        {
+            if(position == size)
+            {
+                size_t windowSize;
+                const uint8_t *window = reader.peek(windowSize);
+                if(windowSize > 0) // copy straight out of the reader's memory
+                {
+                    size_t readCount = std::min(count, windowSize);
+                    memcpy(output, window, readCount);
+                    reader.commit(readCount);
+                    output += readCount;
+                    count -= readCount;
+                    continue;
+                }
+                if(count >= bufferSize)
+                {
+                    reader.readAllBytes(output, count);
+                    return;
+                }
+                buffer.resize(bufferSize);
+                position = 0;
+                size = reader.readAvailableBytes(buffer.data(), bufferSize);
+                if(size == 0)
+                    size = reader.readBytes(buffer.data(), bufferSize);
+                if(size == 0)
+                    throw stream::EOFException();
+            }
+            size_t readCount = std::min(count, size - position);
+            memcpy(output, &buffer[position], readCount);
+            position += readCount;
+            output += readCount;
+            count -= readCount;
+        }
+    }
+};
+
 void readBytes(png_structp png_ptr, png_bytep output, png_size_t count)
 {
-    png_voidp user_data = png_get_io_ptr(png_ptr);
-    stream::Reader &reader = *(stream::Reader *)user_data;
+    BlockReader &blockReader = *(BlockReader *)png_get_io_ptr(png_ptr);
+    bool failed = false;
     try
     {
-        reader.readBytes((uint8_t *)output, count);
+        blockReader.read((uint8_t *)output, count);
     }
     catch(stream::IOException &e)
     {
         *(string *)png_get_error_ptr(png_ptr) = e.what();
-        longjmp(png_jmpbuf(png_ptr), 1);
+        failed = true;
     }
+    if(failed)
+        longjmp(png_jmpbuf(png_ptr), 1);
 }
 
-inline bool LoadPNG(
-    stream::Reader *preader, uint8_t *&pixels, unsigned &width, unsigned &height, string &errorMsg)
+struct DecodeState final
+{
+    PngDecoder::Destination &destination;
+    string errorMsg;
+    bool canceled = false;
+    exception_ptr destinationException;
+    explicit DecodeState(PngDecoder::Destination &destination) : destination(destination)
+    {
+    }
+};
+
+inline bool LoadPNG(stream::Reader &reader, DecodeState &state)
 {
     png_structp png_ptr = png_create_read_struct(
-        PNG_LIBPNG_VER_STRING, (void *)&errorMsg, pngloaderror, pngloadwarning);
+        PNG_LIBPNG_VER_STRING, (void *)&state.errorMsg, pngloaderror, pngloadwarning);
     if(!png_ptr)
     {
-        errorMsg = "can't create png read struct";
+        state.errorMsg = "can't create png read struct";
         return false;
     }
 
@@ -74,22 +139,19 @@ inline bool LoadPNG(
     if(!info_ptr)
     {
         png_destroy_read_struct(&png_ptr, nullptr, nullptr);
-        errorMsg = "can't create png info struct";
+        state.errorMsg = "can't create png info struct";
         return false;
     }
 
-    uint8_t *volatile retval = nullptr; // so that it isn't messed up by longjmp
-    volatile png_bytepp rows = nullptr;
+    BlockReader blockReader(reader);
 
     if(setjmp(png_jmpbuf(png_ptr)))
     {
         png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        delete[] retval;
-        delete[] rows;
         return false;
     }
 
-    png_set_read_fn(png_ptr, (png_voidp)preader, readBytes);
+    png_set_read_fn(png_ptr, (png_voidp)&blockReader, readBytes);
 
     png_read_info(png_ptr, info_ptr);
 
@@ -119,44 +181,102 @@ inline bool LoadPNG(
         png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
     }
 
-    width = XRes;
-    height = YRes;
-    retval = new uint8_t[width * height * 4];
-    if(!retval)
+    int passCount = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    // exceptions can't be thrown through libpng, so they are rethrown after cleaning up
+    bool failed = false;
+    try
     {
-        errorMsg = "can't allocate image data array";
-        longjmp(png_jmpbuf(png_ptr), 1);
+        state.destination.setSize(XRes, YRes);
     }
-    rows = (png_bytepp) new png_bytep[YRes];
-    if(!rows)
+    catch(...)
     {
-        errorMsg = "can't allocate image row indirection array";
-        longjmp(png_jmpbuf(png_ptr), 1);
+        state.destinationException = current_exception();
+        failed = true;
     }
-    for(unsigned y = 0; y < YRes; y++)
+    if(failed)
+        longjmp(png_jmpbuf(png_ptr), 1);
+
+    for(int pass = 1; pass <= passCount; pass++)
     {
-        rows[y] = (png_bytep)&retval[y * XRes * 4];
+        for(png_uint_32 y = 0; y < YRes; y++)
+        {
+            png_bytep row = nullptr;
+            try
+            {
+                if(state.destination.isCanceled())
+                    state.canceled = true;
+                else
+                    row = (png_bytep)state.destination.getRow(y);
+            }
+            catch(...)
+            {
+                state.destinationException = current_exception();
+                failed = true;
+            }
+            if(failed || state.canceled)
+                longjmp(png_jmpbuf(png_ptr), 1);
+            // use the row as the display row so that interlaced pngs fill in the pixels
+            // that aren't decoded yet
+            png_read_row(png_ptr, nullptr, row);
+        }
+        try
+        {
+            state.destination.passFinished(pass, passCount);
+        }
+        catch(...)
+        {
+            state.destinationException = current_exception();
+            failed = true;
+        }
+        if(failed)
+            longjmp(png_jmpbuf(png_ptr), 1);
     }
 
-    png_read_image(png_ptr, rows);
-
     png_read_end(png_ptr, info_ptr);
 
-    delete[] rows;
-
     png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-    pixels = (uint8_t *)retval;
     return true;
 }
+
+struct AllocatingDestination final : public PngDecoder::Destination
+{
+    unsigned w = 0, h = 0;
+    unique_ptr<uint8_t[]> data;
+    virtual void setSize(unsigned w, unsigned h) override
+    {
+        this->w = w;
+        this->h = h;
+        data.reset(new uint8_t[static_cast<size_t>(w) * h * 4]);
+    }
+    virtual uint8_t *getRow(unsigned y) override
+    {
+        return &data[static_cast<size_t>(y) * w * 4];
+    }
+};
 }
 
-PngDecoder::PngDecoder(stream::Reader &reader) : w(), h(), data()
+void PngDecoder::decode(stream::Reader &reader, Destination &destination)
 {
-    string errorMsg;
-    if(!LoadPNG(&reader, data, w, h, errorMsg))
+    DecodeState state(destination);
+    if(!LoadPNG(reader, state))
     {
-        throw PngLoadError(errorMsg);
+        if(state.destinationException)
+            rethrow_exception(state.destinationException);
+        if(state.canceled)
+            throw PngDecodeCanceled();
+        throw PngLoadError(state.errorMsg);
     }
 }
+
+PngDecoder::PngDecoder(stream::Reader &reader) : w(), h(), data()
+{
+    AllocatingDestination destination;
+    decode(reader, destination);
+    w = destination.w;
+    h = destination.h;
+    data = destination.data.release();
+}
 }
 }
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "platform/asset_archive.h"
+#include "stream/compressed_stream.h"
+#include "stream/fast_lz.h"
+#include "util/string_cast.h"
+#include "util/util.h"
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+constexpr uint32_t AssetArchive::magic;
+constexpr uint32_t AssetArchive::formatVersion;
+constexpr size_t AssetArchive::pageSize;
+const wchar_t *const AssetArchive::fileName = L"assets.gpak";
+
+namespace
+{
+/// the average number of names in each bucket of the perfect hash
+constexpr size_t namesPerBucket = 4;
+/// the size of the fixed-size fields of an entry in the index
+constexpr size_t entryFieldsSize = 8 * 3 + 1;
+/// FastLZ can't expand each compressed byte into more than this many bytes
+constexpr uint64_t maxCompressionRatio = 255;
+
+uint64_t hashName(const string &name, uint32_t seed) // seeded FNV-1a
+{
+    uint64_t retval = 0xCBF29CE484222325ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+    for(char ch : name)
+    {
+        retval ^= static_cast<uint8_t>(ch);
+        retval *= 0x100000001B3ULL;
+    }
+    // FNV's low bits are weak, so mix the high bits in before they're used with %
+    retval ^= retval >> 32;
+    retval *= 0xD6E8FEB86659FD93ULL;
+    retval ^= retval >> 32;
+    return retval;
+}
+
+size_t getBucket(const string &name, size_t bucketCount)
+{
+    return static_cast<size_t>(hashName(name, 0) % bucketCount);
+}
+
+size_t getSlot(const string &name, uint32_t seed, size_t entryCount)
+{
+    return static_cast<size_t>(hashName(name, seed) % entryCount);
+}
+
+uint64_t roundUpToPage(uint64_t offset)
+{
+    return (offset + AssetArchive::pageSize - 1) / AssetArchive::pageSize * AssetArchive::pageSize;
+}
+
+void writePadding(stream::Writer &writer, uint64_t &offset, uint64_t newOffset)
+{
+    static const uint8_t zeros[AssetArchive::pageSize] = {};
+    assert(newOffset >= offset && newOffset - offset <= AssetArchive::pageSize);
+    writer.writeBytes(zeros, static_cast<size_t>(newOffset - offset));
+    offset = newOffset;
+}
+}
+
+AssetArchive::AssetArchive(shared_ptr<stream::MemoryReader> archiveIn)
+    : archive(std::move(archiveIn)), bucketSeeds(), entries()
+{
+    size_t archiveSize;
+    archive->peek(archiveSize);
+    shared_ptr<stream::MemoryReader> reader = archive->slice(0, archiveSize);
+    try
+    {
+        if(stream::read<uint32_t>(*reader) != magic)
+            throw stream::IOException("not an asset archive");
+        if(stream::read<uint32_t>(*reader) != formatVersion)
+            throw stream::IOException("unsupported asset archive version");
+        uint32_t entryCount = stream::read<uint32_t>(*reader);
+        uint32_t bucketCount = stream::read<uint32_t>(*reader);
+        // check the counts against the file size before allocating anything
+        if((entryCount == 0) != (bucketCount == 0) || bucketCount > entryCount
+           || entryCount > archiveSize / (entryFieldsSize + 1))
+            throw stream::IOException("invalid asset archive index size");
+        bucketSeeds.reserve(bucketCount);
+        for(uint32_t i = 0; i < bucketCount; i++)
+            bucketSeeds.push_back(stream::read<uint32_t>(*reader));
+        entries.reserve(entryCount);
+        for(uint32_t slot = 0; slot < entryCount; slot++)
+        {
+            Entry entry;
+            entry.name = reader->readString();
+            entry.offset = stream::read<uint64_t>(*reader);
+            entry.storedSize = stream::read<uint64_t>(*reader);
+            entry.size = stream::read<uint64_t>(*reader);
+            uint8_t compression = stream::read<uint8_t>(*reader);
+            if(compression > static_cast<uint8_t>(Compression::FastLZ))
+                throw stream::IOException("invalid asset archive entry compression");
+            entry.compression = static_cast<Compression>(compression);
+            if(entry.offset > archiveSize || entry.storedSize > archiveSize - entry.offset)
+                throw stream::IOException("asset archive entry is past the end of the file");
+            if(entry.compression == Compression::None ? entry.size != entry.storedSize :
+                                                        entry.size / maxCompressionRatio
+                                                            > entry.storedSize)
+                throw stream::IOException("invalid asset archive entry size");
+            string name = string_cast<string>(entry.name);
+            uint32_t seed = bucketSeeds[getBucket(name, bucketCount)];
+            if(getSlot(name, seed, entryCount) != slot)
+                throw stream::IOException("asset archive entry is in the wrong slot");
+            entries.push_back(std::move(entry));
+        }
+    }
+    catch(stream::EOFException &)
+    {
+        throw stream::IOException("asset archive index is truncated");
+    }
+}
+
+shared_ptr<AssetArchive> AssetArchive::open(wstring fileName)
+{
+    // entries are read in whatever order the game loads them, so read-ahead past an entry and
+    // dropping the pages behind it would both work against it
+    shared_ptr<stream::MemoryReader> archive =
+        stream::MmapReader::open(std::move(fileName), stream::MmapReader::AccessPattern::Normal);
+    if(archive == nullptr)
+        return nullptr;
+    return shared_ptr<AssetArchive>(new AssetArchive(std::move(archive)));
+}
+
+const AssetArchive::Entry *AssetArchive::find(const wstring &name) const
+{
+    if(entries.empty())
+        return nullptr;
+    string str = string_cast<string>(name);
+    uint32_t seed = bucketSeeds[getBucket(str, bucketSeeds.size())];
+    const Entry &entry = entries[getSlot(str, seed, entries.size())];
+    if(entry.name != name)
+        return nullptr;
+    return &entry;
+}
+
+shared_ptr<stream::Reader> AssetArchive::openEntry(const wstring &name) const
+{
+    const Entry *entry = find(name);
+    if(entry == nullptr)
+        return nullptr;
+    shared_ptr<stream::MemoryReader> stored =
+        archive->slice(static_cast<size_t>(entry->offset), static_cast<size_t>(entry->storedSize));
+    switch(entry->compression)
+    {
+    case Compression::None:
+        return stored;
+    case Compression::FastLZ:
+    {
+        size_t storedSize;
+        const uint8_t *storedBytes = stored->peek(storedSize);
+        vector<uint8_t> expanded(static_cast<size_t>(entry->size));
+        if(!stream::FastLZ::decompress(storedBytes, storedSize, expanded.data(), expanded.size()))
+            throw stream::FastLZFormatException("corrupt asset archive entry : "
+                                                + string_cast<string>(name));
+        return make_shared<stream::MemoryReader>(std::move(expanded));
+    }
+    }
+    UNREACHABLE();
+    return nullptr;
+}
+
+void AssetArchive::write(stream::Writer &writer, vector<pair<wstring, vector<uint8_t>>> files)
+{
+    const size_t entryCount = files.size();
+    if(entryCount > static_cast<uint32_t>(-1))
+        throw stream::IOException("too many asset archive entries");
+    vector<string> names;
+    names.reserve(entryCount);
+    unordered_set<string> nameSet;
+    for(const pair<wstring, vector<uint8_t>> &file : files)
+    {
+        names.push_back(string_cast<string>(file.first));
+        if(!get<1>(nameSet.insert(names.back())))
+            throw stream::IOException("duplicate asset archive entry : " + names.back());
+    }
+
+    // build the perfect hash: place the biggest buckets first while most slots are free, trying
+    // seeds until every name in the bucket lands in a different free slot
+    const size_t bucketCount = (entryCount + namesPerBucket - 1) / namesPerBucket;
+    vector<vector<size_t>> buckets(bucketCount);
+    for(size_t i = 0; i < entryCount; i++)
+        buckets[getBucket(names[i], bucketCount)].push_back(i);
+    vector<size_t> bucketOrder(bucketCount);
+    iota(bucketOrder.begin(), bucketOrder.end(), static_cast<size_t>(0));
+    stable_sort(bucketOrder.begin(),
+                bucketOrder.end(),
+                [&](size_t a, size_t b)
+                {
+                    return buckets[a].size() > buckets[b].size();
+                });
+    constexpr size_t emptySlot = static_cast<size_t>(-1);
+    vector<size_t> slotFiles(entryCount, emptySlot);
+    vector<uint32_t> seeds(bucketCount, 0);
+    vector<size_t> bucketSlots;
+    for(size_t bucket : bucketOrder)
+    {
+        if(buckets[bucket].empty())
+            break;
+        constexpr uint32_t maxSeed = 1 << 24;
+        uint32_t seed = 1;
+        for(;; seed++)
+        {
+            if(seed > maxSeed)
+                throw stream::IOException("can't build the asset archive's perfect hash");
+            bucketSlots.clear();
+            bool fits = true;
+            for(size_t file : buckets[bucket])
+            {
+                size_t slot = getSlot(names[file], seed, entryCount);
+                if(slotFiles[slot] != emptySlot
+                   || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end())
+                {
+                    fits = false;
+                    break;
+                }
+                bucketSlots.push_back(slot);
+            }
+            if(fits)
+                break;
+        }
+        seeds[bucket] = seed;
+        for(size_t i = 0; i < bucketSlots.size(); i++)
+            slotFiles[bucketSlots[i]] = buckets[bucket][i];
+    }
+
+    // compress the entries that shrink by at least an eighth
+    vector<Entry> slotEntries(entryCount);
+    uint64_t indexSize = 4 * 4 + 4 * bucketCount;
+    for(size_t slot = 0; slot < entryCount; slot++)
+    {
+        pair<wstring, vector<uint8_t>> &file = files[slotFiles[slot]];
+        Entry &entry = slotEntries[slot];
+        entry.name = std::move(get<0>(file));
+        entry.size = get<1>(file).size();
+        entry.compression = Compression::None;
+        vector<uint8_t> compressed(stream::FastLZ::compressBound(get<1>(file).size()));
+        size_t compressedSize =
+            stream::FastLZ::compress(get<1>(file).data(), get<1>(file).size(), compressed.data());
+        if(compressedSize <= get<1>(file).size() - get<1>(file).size() / 8)
+        {
+            compressed.resize(compressedSize);
+            get<1>(file) = std::move(compressed);
+            entry.compression = Compression::FastLZ;
+        }
+        entry.storedSize = get<1>(file).size();
+        indexSize += names[slotFiles[slot]].size() + 1 + entryFieldsSize;
+    }
+    uint64_t offset = roundUpToPage(indexSize);
+    for(Entry &entry : slotEntries)
+    {
+        entry.offset = offset;
+        offset = roundUpToPage(offset + entry.storedSize);
+    }
+
+    stream::write<uint32_t>(writer, magic);
+    stream::write<uint32_t>(writer, formatVersion);
+    stream::write<uint32_t>(writer, static_cast<uint32_t>(entryCount));
+    stream::write<uint32_t>(writer, static_cast<uint32_t>(bucketCount));
+    for(uint32_t seed : seeds)
+        stream::write<uint32_t>(writer, seed);
+    for(const Entry &entry : slotEntries)
+    {
+        writer.writeString(entry.name);
+        stream::write<uint64_t>(writer, entry.offset);
+        stream::write<uint64_t>(writer, entry.storedSize);
+        stream::write<uint64_t>(writer, entry.size);
+        stream::write<uint8_t>(writer, static_cast<uint8_t>(entry.compression));
+    }
+    offset = indexSize;
+    for(size_t slot = 0; slot < entryCount; slot++)
+    {
+        writePadding(writer, offset, slotEntries[slot].offset);
+        const vector<uint8_t> &data = get<1>(files[slotFiles[slot]]);
+        if(!data.empty())
+            writer.writeBytes(data.data(), data.size());
+        offset += data.size();
+    }
+}
+}
+}
+
+#ifdef COMPILE_PACK_ASSETS
+#include <iostream>
+
+using namespace programmerjake::game_puzzle;
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        cerr << "usage: pack-assets <archive> <file>..." << endl;
+        return 1;
+    }
+    try
+    {
+        vector<pair<wstring, vector<uint8_t>>> files;
+        for(int i = 2; i < argc; i++)
+        {
+            string path = argv[i];
+            string name = path.substr(path.find_last_of('/') + 1);
+            stream::FileReader reader(string_cast<wstring>(path));
+            vector<uint8_t> data;
+            uint8_t buffer[1 << 16];
+            for(;;)
+            {
+                size_t readCount = reader.readBytes(buffer, sizeof(buffer));
+                if(readCount == 0)
+                    break;
+                data.insert(data.end(), buffer, buffer + readCount);
+            }
+            files.emplace_back(string_cast<wstring>(name), std::move(data));
+        }
+        stream::FileWriter writer(string_cast<wstring>(string(argv[1])));
+        AssetArchive::write(writer, std::move(files));
+        writer.flush();
+    }
+    catch(stream::IOException &e)
+    {
+        cerr << "pack-assets: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+#endif // COMPILE_PACK_ASSETS
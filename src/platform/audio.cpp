@@ -21,17 +21,27 @@
 #include "platform/audio.h"
 #include "platform/platform.h"
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <algorithm>
 #include <functional>
 #include <unordered_set>
 #include <SDL.h>
 #include <iostream>
 #include <cstdlib>
 #include <sstream>
-#include "util/circular_deque.h"
+#include <cmath>
+#include "util/checked_array.h"
+#include "util/math_constants.h"
+#include "util/lock_free_queue.h"
+#include "util/spsc_ring.h"
 #include "decoder/ogg_vorbis_decoder.h"
 #include "platform/thread_priority.h"
+#include "platform/thread_name.h"
+#include "platform/sound_bank.h"
+#include "platform/track_prefetcher.h"
 
 using namespace std;
 
@@ -43,125 +53,389 @@ struct AudioData
 {
     function<shared_ptr<AudioDecoder>()> makeAudioDecoder;
     double duration;
+    wstring streamingResourceName; // empty if this isn't streamed from a resource
     AudioData(function<shared_ptr<AudioDecoder>()> makeAudioDecoder)
         : makeAudioDecoder(makeAudioDecoder), duration(makeAudioDecoder()->lengthInSeconds())
     {
     }
 };
 
+namespace
+{
+/// where positional sounds are heard from; protected by the audio state mutex
+struct AudioListener final
+{
+    VectorF position = VectorF(0);
+    VectorF forward = VectorF(0, 0, -1);
+    VectorF up = VectorF(0, 1, 0);
+    float referenceDistance = 1;
+    float maxDistance = 64;
+};
+
+/** get which side of the listener a channel plays on
+ * @return -1 for left, 1 for right, or 0 for center or unknown layouts
+ * @see makeChannelMatrix for the channel layouts
+ */
+int getChannelSide(unsigned channels, unsigned channel)
+{
+    switch(channels)
+    {
+    case 2: // left, right
+        return channel == 0 ? -1 : 1;
+    case 3: // left, center, right
+        return static_cast<int>(channel) - 1;
+    case 4: // front left, front right, rear left, rear right
+        return channel % 2 == 0 ? -1 : 1;
+    case 5: // left, center, right, rear left, rear right
+    case 6: // left, center, right, rear left, rear right, low frequency
+    {
+        static const int sides[] = {-1, 0, 1, -1, 1, 0};
+        return sides[channel];
+    }
+    }
+    return 0;
+}
+
+/** compute the gain of each channel of a positional sound
+ *
+ * The gain falls off inversely with distance and is 0 past the listener's maximum distance.
+ * Sounds to one side are panned by turning down the channels on the other side.
+ */
+void computeChannelGains(const AudioListener &listener,
+                         VectorF position,
+                         unsigned channels,
+                         float *gains)
+{
+    VectorF offset = position - listener.position;
+    float distance = abs(offset);
+    float distanceGain = 0;
+    if(distance < listener.maxDistance)
+        distanceGain = listener.referenceDistance / std::max(listener.referenceDistance, distance);
+    float pan = 0;
+    if(distance > 1e-4f)
+        pan = limit(dot(offset / distance, normalizeNoThrow(cross(listener.forward, listener.up))),
+                    -1.0f,
+                    1.0f);
+    for(unsigned channel = 0; channel < channels; channel++)
+    {
+        float panGain = std::min(1.0f, 1.0f + pan * getChannelSide(channels, channel));
+        gains[channel] = distanceGain * panGain;
+    }
+}
+}
+
 struct PlayingAudioData
 {
     shared_ptr<AudioData> audioData;
-    shared_ptr<AudioDecoder> decoder;
-    static constexpr size_t bufferValueCount = 32768;
-    circularDeque<float, bufferValueCount + 1> bufferQueue;
-    float volume;
-    bool looped;
-    bool overallEOF = false;
-    uint64_t playedSamples = 0;
-    PlayingAudioData(shared_ptr<AudioData> audioData, float volume, bool looped)
-        : audioData(audioData), decoder(), bufferQueue(), volume(volume), looped(looped)
-    {
-        restartDecoder();
+    shared_ptr<AudioDecoder> decoder; // only used by the decode thread after construction
+    const unsigned channels;
+    const unsigned sampleRate;
+    const double duration;
+    static constexpr size_t bufferSampleCount = 16384;
+    SPSCRing<float> ring;
+    vector<float> decodeBuffer;
+    atomic<float> volume;
+    atomic<float> channelGains[maxAudioChannelCount]; // all 1 unless this is positional
+    const bool looped;
+    atomic_bool decoderEOF; // set after the last decoded samples are written to ring
+    atomic_bool stopRequested;
+    atomic_bool retired; // set by the audio callback once it no longer uses this
+    bool claimedByDecodeWorker = false; // protected by the decode service lock
+    atomic<uint64_t> playedSamples;
+    bool isPositional = false; // protected by the audio state mutex
+    VectorF position; // protected by the audio state mutex
+    atomic_bool virtualized; // set by the audio callback while it isn't mixing this
+    /// samples that the audio callback played without anything in ring; the decoder skips them
+    atomic<uint64_t> skippedSamples;
+    bool audible = false; // only used by the audio callback
+    bool refilling = false; // only used by the audio callback; set until ring has caught up
+    uint64_t decoderPosition = 0; // the next sample that decoder returns
+    bool decoderCanSeek = true;
+    PlayingAudioData(shared_ptr<AudioData> audioData,
+                     shared_ptr<AudioDecoder> sourceDecoder,
+                     float volume,
+                     bool looped,
+                     unsigned outputSampleRate,
+                     unsigned outputChannels)
+        : audioData(audioData),
+          decoder(makeDecoder(sourceDecoder, outputSampleRate, outputChannels)),
+          channels(outputChannels),
+          sampleRate(outputSampleRate),
+          duration(decoder->lengthInSeconds()),
+          ring(bufferSampleCount * channels),
+          decodeBuffer(bufferSampleCount * channels),
+          volume(volume),
+          looped(looped),
+          decoderEOF(false),
+          stopRequested(false),
+          retired(false),
+          playedSamples(0),
+          position(),
+          virtualized(false),
+          skippedSamples(0)
+    {
+        for(atomic<float> &gain : channelGains)
+            gain.store(1, memory_order_relaxed);
+        fill();
+    }
+    /// convert to the output format
+    static shared_ptr<AudioDecoder> makeDecoder(shared_ptr<AudioDecoder> decoder,
+                                                unsigned sampleRate,
+                                                unsigned channels)
+    {
+        if(decoder->samplesPerSecond() != sampleRate)
+            decoder = make_shared<ResampleAudioDecoder>(decoder, sampleRate);
+        if(decoder->channelCount() != channels)
+            decoder = make_shared<RedistributeChannelsAudioDecoder>(decoder, channels);
+        return decoder;
+    }
+    /// move this in 3D; called with the audio state mutex locked
+    void setPosition(VectorF newPosition, const AudioListener &listener)
+    {
+        isPositional = true;
+        position = newPosition;
+        updateChannelGains(listener);
+    }
+    /// called with the audio state mutex locked
+    void updateChannelGains(const AudioListener &listener)
+    {
+        if(!isPositional)
+            return;
+        float gains[maxAudioChannelCount];
+        computeChannelGains(listener, position, channels, gains);
+        for(unsigned i = 0; i < channels; i++)
+            channelGains[i].store(gains[i], memory_order_relaxed);
+    }
+    bool needsFill() const
+    {
+        if(decoderEOF.load(memory_order_relaxed) || stopRequested.load(memory_order_relaxed))
+            return false;
+        uint64_t skipped = skippedSamples.load(memory_order_relaxed);
+        // virtual sounds only need to keep their decoder caught up, so do that in big steps
+        if(virtualized.load(memory_order_relaxed))
+            return skipped >= bufferSampleCount / 2;
+        return skipped > 0 || ring.freeSpace() / channels >= bufferSampleCount / 2;
+    }
+    /// @return how long until ring runs out, in samples
+    size_t bufferedSamples() const
+    {
+        return ring.size() / channels;
     }
+    /// move decoder back to the start of the audio
     void restartDecoder()
     {
-        decoder = audioData->makeAudioDecoder();
-        if(decoder->samplesPerSecond() != getGlobalAudioSampleRate())
-            decoder = make_shared<ResampleAudioDecoder>(decoder, getGlobalAudioSampleRate());
-        if(decoder->channelCount() != getGlobalAudioChannelCount())
-            decoder = make_shared<RedistributeChannelsAudioDecoder>(decoder,
-                                                                    getGlobalAudioChannelCount());
-        if(decoder->isHighLatencySource())
-            decoder = make_shared<StreamBufferingAudioDecoder>(decoder);
-        unsigned channels = decoder->channelCount();
-        typedef checked_array<float, bufferValueCount> BufferType;
-        auto pbuffer = std::unique_ptr<BufferType>(new BufferType);
-        auto &buffer = *pbuffer;
-        uint64_t bufferSamples = (bufferQueue.capacity() - bufferQueue.size()) / channels;
-        uint64_t decodedAmount;
-        for(decodedAmount = 0; decodedAmount < bufferSamples;)
+        decoderPosition = 0;
+        // restart in place if possible so that looping doesn't allocate
+        if(decoder->seek(0))
+            return;
+        decoder = nullptr; // free decoder first to save memory
+        decoder = makeDecoder(audioData->makeAudioDecoder(), sampleRate, channels);
+    }
+    /** decode into decodeBuffer, going back to the start of looped audio when it ends
+     * @param sampleCount the most samples to decode, at most bufferSampleCount
+     * @param hitEnd set to if the audio ended
+     * @return the number of samples decoded
+     */
+    size_t decodeSamples(size_t sampleCount, bool &hitEnd)
+    {
+        size_t decodedAmount = 0;
+        bool justRestarted = false;
+        hitEnd = false;
+        while(decodedAmount < sampleCount)
         {
-            uint64_t currentDecodeStep = decoder->decodeAudioBlock(
-                &buffer[static_cast<std::size_t>(decodedAmount * channels)],
-                bufferSamples - decodedAmount);
+            size_t currentDecodeStep = static_cast<size_t>(decoder->decodeAudioBlock(
+                &decodeBuffer[decodedAmount * channels], sampleCount - decodedAmount));
             if(currentDecodeStep == 0)
             {
-                if(!looped)
-                    overallEOF = true;
-                break;
+                if(!looped || justRestarted) // don't loop forever on empty sounds
+                {
+                    hitEnd = true;
+                    break;
+                }
+                restartDecoder();
+                justRestarted = true;
+                continue;
             }
+            justRestarted = false;
             decodedAmount += currentDecodeStep;
+            decoderPosition += currentDecodeStep;
         }
-        for(size_t i = 0; i < decodedAmount * channels; i++)
-            bufferQueue.push_back(buffer[i]);
+        return decodedAmount;
     }
-    bool addInAudioSample(float *data)
+    /** move decoder past the samples that the audio callback skipped
+     * @return false if the audio ended
+     */
+    bool skipDecoderAhead()
     {
-        unsigned channels = decoder->channelCount();
-        if(!overallEOF && bufferQueue.size() < bufferQueue.capacity() / 2)
+        uint64_t skipCount = skippedSamples.exchange(0, memory_order_relaxed);
+        if(skipCount == 0)
+            return true;
+        uint64_t remainingCount = skipCount;
+        if(decoderCanSeek)
         {
-            typedef checked_array<float, bufferValueCount> BufferType;
-            auto pbuffer = std::unique_ptr<BufferType>(new BufferType);
-            auto &buffer = *pbuffer;
-            uint64_t bufferSamples = (bufferQueue.capacity() - bufferQueue.size()) / channels;
-            uint64_t decodedAmount;
-            bool hitEnd = false;
-            for(decodedAmount = 0; decodedAmount < bufferSamples;)
+            uint64_t target = decoderPosition + skipCount;
+            uint64_t length = decoder->numSamples();
+            if(length != AudioDecoder::Unknown && target >= length)
             {
-                uint64_t currentDecodeStep = decoder->decodeAudioBlock(
-                    &buffer[static_cast<std::size_t>(decodedAmount * channels)],
-                    bufferSamples - decodedAmount);
-                if(currentDecodeStep == 0)
-                {
-                    hitEnd = true;
-                    break;
-                }
-                decodedAmount += currentDecodeStep;
+                if(!looped || length == 0)
+                    return false;
+                target %= length;
             }
-            for(size_t i = 0; i < decodedAmount * channels; i++)
-                bufferQueue.push_back(buffer[i]);
-            if(hitEnd)
+            if(decoder->seek(target))
             {
-                if(looped)
-                    restartDecoder();
-                else
-                    overallEOF = true;
+                decoderPosition = target;
+                return true;
             }
+            // the decoder is in an unknown state now, so decode from the start
+            decoderCanSeek = false;
+            restartDecoder();
+            remainingCount = target;
         }
-        if(bufferQueue.size() >= channels)
+        while(remainingCount > 0)
         {
-            for(size_t i = 0; i < channels; i++)
-            {
-                *data++ += bufferQueue.front() * volume;
-                bufferQueue.pop_front();
-            }
-            playedSamples++;
-            return true;
+            bool hitEnd;
+            remainingCount -= decodeSamples(
+                static_cast<size_t>(std::min<uint64_t>(remainingCount, bufferSampleCount)), hitEnd);
+            if(hitEnd)
+                return false;
         }
-        return false;
+        return true;
+    }
+    /** decode more audio into ring if it is at least half empty
+     *
+     * Only called from the thread that created this and from the decode worker that claimed
+     * this.
+     */
+    void fill()
+    {
+        if(!needsFill())
+            return;
+        if(!skipDecoderAhead())
+        {
+            decoderEOF.store(true, memory_order_release);
+            return;
+        }
+        if(virtualized.load(memory_order_relaxed))
+            return; // nothing would hear it
+        // the ring's capacity is rounded up to a power of 2, so it can be bigger than decodeBuffer
+        size_t freeSamples = std::min(ring.freeSpace() / channels, bufferSampleCount);
+        bool hitEnd;
+        size_t decodedAmount = decodeSamples(freeSamples, hitEnd);
+        size_t writtenAmount = ring.write(decodeBuffer.data(), decodedAmount * channels);
+        assert(writtenAmount == decodedAmount * channels);
+        ignore_unused_variable_warning(writtenAmount);
+        if(hitEnd)
+            decoderEOF.store(true, memory_order_release);
+    }
+    /// @return how loud this is; used by the audio callback to pick which sounds to mix
+    float getLoudness() const
+    {
+        float retval = 0;
+        for(unsigned i = 0; i < channels; i++)
+            retval = std::max(retval, channelGains[i].load(memory_order_relaxed));
+        return retval * volume.load(memory_order_relaxed);
     }
-    bool addInAudio(float *data, size_t sampleCount)
+    /** mix into the output
+     *
+     * Only called from the audio callback. Never locks, allocates, or decodes.
+     * @return false if this finished playing
+     */
+    bool addInAudio(float *data,
+                    size_t sampleCount,
+                    const AudioDSPKernels &kernels,
+                    uint64_t &underrunCount)
     {
-        unsigned channels = decoder->channelCount();
-        for(size_t i = 0; i < sampleCount; i++)
+        if(stopRequested.load(memory_order_relaxed))
+            return false;
+        virtualized.store(false, memory_order_relaxed);
+        bool gotEOF = decoderEOF.load(memory_order_acquire);
+        float currentVolume = volume.load(memory_order_relaxed);
+        assert(channels <= maxAudioChannelCount);
+        float gains[maxAudioChannelCount];
+        bool isUniform = true;
+        for(unsigned i = 0; i < channels; i++)
         {
-            if(!addInAudioSample(data))
+            gains[i] = channelGains[i].load(memory_order_relaxed);
+            if(gains[i] != 1)
+                isUniform = false;
+            gains[i] *= currentVolume;
+        }
+        // mix straight out of the ring; it only ever holds whole samples
+        SPSCRing<float>::Spans<const float> spans = ring.readSpans(sampleCount * channels);
+        if(isUniform)
+        {
+            kernels.mixAccumulate(data, spans.first, spans.firstCount, currentVolume);
+            kernels.mixAccumulate(
+                data + spans.firstCount, spans.second, spans.secondCount, currentVolume);
+        }
+        else
+        {
+            // the ring can wrap around in the middle of a sample
+            kernels.mixAccumulateWithChannelGains(
+                data, spans.first, spans.firstCount, gains, channels, 0);
+            kernels.mixAccumulateWithChannelGains(data + spans.firstCount,
+                                                  spans.second,
+                                                  spans.secondCount,
+                                                  gains,
+                                                  channels,
+                                                  spans.firstCount % channels);
+        }
+        ring.consume(spans.size());
+        size_t playedCount = spans.size() / channels;
+        if(playedCount < sampleCount)
+        {
+            if(gotEOF)
             {
+                playedSamples.fetch_add(playedCount, memory_order_relaxed);
                 return false;
             }
-            data += channels;
+            if(!refilling)
+            {
+                underrunCount++;
+                playedSamples.fetch_add(playedCount, memory_order_relaxed);
+                return true;
+            }
+            // still catching up after being virtual, so keep time moving
+            skippedSamples.fetch_add(sampleCount - playedCount, memory_order_relaxed);
+            playedCount = sampleCount;
         }
+        else
+            refilling = false;
+        playedSamples.fetch_add(playedCount, memory_order_relaxed);
         return true;
     }
-    bool hitEOF()
+    /** advance without mixing
+     *
+     * Only called from the audio callback. Never locks, allocates, or decodes.
+     * @return false if this finished playing
+     */
+    bool skipAudio(size_t sampleCount)
     {
-        if(overallEOF && bufferQueue.size() < decoder->channelCount())
-            return true;
-        return false;
+        if(stopRequested.load(memory_order_relaxed))
+            return false;
+        virtualized.store(true, memory_order_relaxed);
+        refilling = true;
+        bool gotEOF = decoderEOF.load(memory_order_acquire);
+        // use up what was already decoded first so the decoder stays in step with the playback
+        size_t consumedCount = std::min(ring.size(), sampleCount * channels);
+        ring.consume(consumedCount);
+        size_t skipCount = sampleCount - consumedCount / channels;
+        if(skipCount > 0)
+        {
+            if(gotEOF)
+            {
+                playedSamples.fetch_add(consumedCount / channels, memory_order_relaxed);
+                return false;
+            }
+            skippedSamples.fetch_add(skipCount, memory_order_relaxed);
+        }
+        playedSamples.fetch_add(sampleCount, memory_order_relaxed);
+        return true;
     }
 };
 
+constexpr size_t PlayingAudioData::bufferSampleCount;
+
 namespace
 {
 mutex &getAudioStateMutex()
@@ -174,32 +448,232 @@ unordered_set<shared_ptr<PlayingAudioData>> &getPlayingAudioSet()
     static unordered_set<shared_ptr<PlayingAudioData>> playingAudioSet;
     return playingAudioSet;
 }
+AudioListener &getAudioListener()
+{
+    static AudioListener audioListener;
+    return audioListener;
+}
 
-void startAudioImp(shared_ptr<PlayingAudioData> audio)
+/** the state that is only used by the audio callback
+ *
+ * Playing sounds are added through a lock-free queue; the callback removes sounds when they
+ * finish or are stopped and then marks them retired so that the decode thread can free them.
+ * Only the loudest maxAudibleVoiceCount sounds are mixed, so the cost of mixing doesn't grow with
+ * the number of playing sounds; the rest are skipped ahead without being decoded.
+ */
+struct Mixer final
 {
-    assert(audio);
+    static constexpr size_t maxVoiceCount = 256;
+    static constexpr size_t mixBufferSampleCount = 1024;
+    LockFreeQueue<PlayingAudioData *, 1024> addVoiceQueue;
+    checked_array<PlayingAudioData *, maxVoiceCount> voices;
+    size_t voiceCount = 0;
+    checked_array<float, mixBufferSampleCount * maxAudioChannelCount> mixBuffer;
+    checked_array<float, maxVoiceCount> voiceLoudness;
+    checked_array<size_t, maxVoiceCount> voiceOrder;
+    const AudioDSPKernels &kernels;
+    atomic<uint64_t> underrunCount;
+    atomic_bool ditherEnabled;
+    atomic<size_t> maxAudibleVoiceCount;
+    uint32_t ditherState = 0x12345678;
+    Mixer()
+        : addVoiceQueue(),
+          voices(),
+          mixBuffer(),
+          voiceLoudness(),
+          voiceOrder(),
+          kernels(getAudioDSPKernels()),
+          underrunCount(0),
+          ditherEnabled(false),
+          maxAudibleVoiceCount(32)
+    {
+    }
+    static Mixer &get()
+    {
+        static Mixer retval;
+        return retval;
+    }
+    void addVoice(PlayingAudioData *voice)
+    {
+        while(!addVoiceQueue.push(voice))
+            this_thread::yield();
+    }
+    /// pick which voices are mixed; the rest are virtual
+    void selectAudibleVoices()
     {
-        unique_lock<mutex> lock(getAudioStateMutex());
-        getPlayingAudioSet().insert(audio);
+        size_t audibleCount = 0;
+        for(size_t i = 0; i < voiceCount; i++)
+        {
+            voiceLoudness[i] = voices[i]->getLoudness();
+            voices[i]->audible = voiceLoudness[i] > 0; // silent or culled voices are virtual
+            if(voices[i]->audible)
+                voiceOrder[audibleCount++] = i;
+        }
+        size_t maxAudibleCount = maxAudibleVoiceCount.load(memory_order_relaxed);
+        if(audibleCount <= maxAudibleCount)
+            return;
+        auto louder = [this](size_t a, size_t b)
+        {
+            return voiceLoudness[a] > voiceLoudness[b];
+        };
+        nth_element(voiceOrder.begin(),
+                    voiceOrder.begin() + maxAudibleCount,
+                    voiceOrder.begin() + audibleCount,
+                    louder);
+        for(size_t i = maxAudibleCount; i < audibleCount; i++)
+            voices[voiceOrder[i]]->audible = false;
     }
+    void mix(int16_t *output, size_t sampleCount, unsigned channels)
+    {
+        PlayingAudioData *newVoice;
+        while(addVoiceQueue.pop(newVoice))
+        {
+            if(voiceCount < maxVoiceCount)
+                voices[voiceCount++] = newVoice;
+            else
+                newVoice->retired.store(true, memory_order_release);
+        }
+        uint64_t underruns = 0;
+        bool dither = ditherEnabled.load(memory_order_relaxed);
+        while(sampleCount > 0)
+        {
+            size_t currentSampleCount = std::min(sampleCount, mixBufferSampleCount);
+            size_t valueCount = currentSampleCount * channels;
+            std::fill_n(mixBuffer.begin(), valueCount, 0.0f);
+            selectAudibleVoices();
+            for(size_t i = 0; i < voiceCount;)
+            {
+                bool stillPlaying;
+                if(voices[i]->audible)
+                    stillPlaying = voices[i]->addInAudio(
+                        mixBuffer.data(), currentSampleCount, kernels, underruns);
+                else
+                    stillPlaying = voices[i]->skipAudio(currentSampleCount);
+                if(stillPlaying)
+                {
+                    i++;
+                    continue;
+                }
+                voices[i]->retired.store(true, memory_order_release);
+                voices[i] = voices[--voiceCount];
+            }
+            if(dither)
+                addAudioDither(mixBuffer.data(), valueCount, ditherState);
+            kernels.convertToInt16(output, mixBuffer.data(), valueCount);
+            output += valueCount;
+            sampleCount -= currentSampleCount;
+        }
+        if(underruns > 0)
+            underrunCount.fetch_add(underruns, memory_order_relaxed);
+    }
+};
 
-    programmerjake::game_puzzle::startAudio();
-}
+constexpr size_t Mixer::maxVoiceCount;
+constexpr size_t Mixer::mixBufferSampleCount;
 
-void stopAudioImp(shared_ptr<PlayingAudioData> audio)
+/** keeps every playing sound's ring full and frees retired sounds
+ *
+ * A small pool of worker threads is shared by every playing sound, so the number of threads
+ * doesn't depend on the number of playing sounds. Each worker refills the sound that is
+ * closest to running out next, so the audio callback never decodes.
+ */
+class DecodeService final
 {
-    assert(audio);
+    mutex lock;
+    condition_variable cond;
+    bool done = false;
+    vector<thread> workers;
+    static constexpr auto pollInterval = chrono::milliseconds(10);
+    static size_t getWorkerCount()
+    {
+        return limit<size_t>(getProcessorCount() / 2, 1, 4);
+    }
+    /** pick the playing sound that is closest to underrun and claim it
+     * @return the claimed sound or nullptr if no sound needs to be decoded
+     */
+    shared_ptr<PlayingAudioData> claimMostUrgentVoice()
+    {
+        unique_lock<mutex> stateLock(getAudioStateMutex());
+        auto &playingAudioSet = getPlayingAudioSet();
+        bool hadVoices = !playingAudioSet.empty();
+        shared_ptr<PlayingAudioData> retval;
+        for(auto i = playingAudioSet.begin(); i != playingAudioSet.end();)
+        {
+            const shared_ptr<PlayingAudioData> &voice = *i;
+            if(voice->retired.load(memory_order_acquire) && !voice->claimedByDecodeWorker)
+            {
+                i = playingAudioSet.erase(i);
+                continue;
+            }
+            if(!voice->claimedByDecodeWorker && voice->needsFill()
+               && (retval == nullptr || voice->bufferedSamples() < retval->bufferedSamples()))
+                retval = voice;
+            i++;
+        }
+        if(hadVoices && playingAudioSet.empty())
+            endAudio();
+        if(retval != nullptr)
+            retval->claimedByDecodeWorker = true;
+        return retval;
+    }
+    void threadFn()
+    {
+        setThreadName(L"audio decode");
+        unique_lock<mutex> lockIt(lock);
+        while(!done)
+        {
+            lockIt.unlock();
+            shared_ptr<PlayingAudioData> voice = claimMostUrgentVoice();
+            if(voice != nullptr)
+            {
+                voice->fill();
+                unique_lock<mutex> stateLock(getAudioStateMutex());
+                voice->claimedByDecodeWorker = false;
+            }
+            lockIt.lock();
+            if(voice == nullptr && !done)
+                cond.wait_for(lockIt, pollInterval);
+        }
+    }
 
-    bool terminateAudio = false;
+public:
+    DecodeService() : lock(), cond(), workers()
     {
-        unique_lock<mutex> lock(getAudioStateMutex());
-        getPlayingAudioSet().erase(audio);
-        if(getPlayingAudioSet().empty())
-            terminateAudio = true;
+        // construct these first so that they are destroyed after this
+        getAudioStateMutex();
+        getPlayingAudioSet();
+        size_t workerCount = getWorkerCount();
+        for(size_t i = 0; i < workerCount; i++)
+        {
+            workers.push_back(thread([this]()
+                                     {
+                                         threadFn();
+                                     }));
+        }
     }
-    if(terminateAudio)
-        endAudio();
-}
+    ~DecodeService()
+    {
+        unique_lock<mutex> lockIt(lock);
+        done = true;
+        cond.notify_all();
+        lockIt.unlock();
+        for(thread &worker : workers)
+            worker.join();
+    }
+    /// wake up the workers so that a new sound is decoded right away
+    void notify()
+    {
+        unique_lock<mutex> lockIt(lock);
+        cond.notify_all();
+    }
+    static DecodeService &get()
+    {
+        static DecodeService retval;
+        return retval;
+    }
+};
+
+constexpr chrono::milliseconds DecodeService::pollInterval;
 }
 
 PlayingAudio::PlayingAudio(shared_ptr<PlayingAudioData> data) : data(data)
@@ -209,73 +683,98 @@ PlayingAudio::PlayingAudio(shared_ptr<PlayingAudioData> data) : data(data)
 void PlayingAudio::audioCallback(void *, uint8_t *buffer_in, int length)
 {
     setThreadPriority(ThreadPriority::High);
-    static vector<float> buffer;
+    unsigned channels = getGlobalAudioChannelCount();
+    assert(length % (channels * sizeof(int16_t)) == 0);
+    size_t sampleCount = length / (channels * sizeof(int16_t));
+    Mixer::get().mix((int16_t *)buffer_in, sampleCount, channels);
+}
+
+uint64_t getAudioUnderrunCount()
+{
+    return Mixer::get().underrunCount.load(memory_order_relaxed);
+}
+
+void setAudioDithering(bool enabled)
+{
+    Mixer::get().ditherEnabled.store(enabled, memory_order_relaxed);
+}
+
+void setMaxAudibleVoiceCount(size_t count)
+{
+    Mixer::get().maxAudibleVoiceCount.store(count, memory_order_relaxed);
+}
+
+void setAudioListener(VectorF position, VectorF forward, VectorF up)
+{
     unique_lock<mutex> lock(getAudioStateMutex());
-    int16_t *buffer16 = (int16_t *)buffer_in;
-    memset((void *)buffer16, 0, length);
-    assert(length % (getGlobalAudioChannelCount() * sizeof(int16_t)) == 0);
-    size_t sampleCount = length / (getGlobalAudioChannelCount() * sizeof(int16_t));
-    buffer.assign(sampleCount * getGlobalAudioChannelCount(), 0);
-    for(auto i = getPlayingAudioSet().begin(); i != getPlayingAudioSet().end();)
-    {
-        if(!(*i)->addInAudio(buffer.data(), sampleCount))
-            i = getPlayingAudioSet().erase(i);
-        else
-            i++;
-    }
-    for(float v : buffer)
-    {
-        *buffer16++ = limit<int>(static_cast<int>(v * 0x8000),
-                                 numeric_limits<int16_t>::min(),
-                                 numeric_limits<int16_t>::max());
-    }
+    AudioListener &listener = getAudioListener();
+    listener.position = position;
+    listener.forward = forward;
+    listener.up = up;
+    for(const shared_ptr<PlayingAudioData> &voice : getPlayingAudioSet())
+        voice->updateChannelGains(listener);
+}
+
+void setAudioDistanceRange(float referenceDistance, float maxDistance)
+{
+    assert(referenceDistance > 0 && maxDistance >= referenceDistance);
+    unique_lock<mutex> lock(getAudioStateMutex());
+    AudioListener &listener = getAudioListener();
+    listener.referenceDistance = referenceDistance;
+    listener.maxDistance = maxDistance;
+    for(const shared_ptr<PlayingAudioData> &voice : getPlayingAudioSet())
+        voice->updateChannelGains(listener);
 }
 
 bool PlayingAudio::isPlaying()
 {
     if(!data)
         return false;
-    unique_lock<mutex> lock(getAudioStateMutex());
-    return audioRunning() && !data->hitEOF();
+    return audioRunning() && !data->stopRequested.load(memory_order_relaxed)
+           && !data->retired.load(memory_order_relaxed);
 }
 
 double PlayingAudio::currentTime()
 {
     if(!data)
         return 0;
-    unique_lock<mutex> lock(getAudioStateMutex());
-    return (double)data->playedSamples / data->decoder->samplesPerSecond();
+    return (double)data->playedSamples.load(memory_order_relaxed) / data->sampleRate;
 }
 
 void PlayingAudio::stop()
 {
     if(!data)
         return;
-    stopAudioImp(data);
+    data->stopRequested.store(true, memory_order_relaxed);
 }
 
 float PlayingAudio::volume()
 {
     if(!data)
         return 0;
-    unique_lock<mutex> lock(getAudioStateMutex());
-    return data->volume;
+    return data->volume.load(memory_order_relaxed);
 }
 
 void PlayingAudio::volume(float v)
+{
+    if(!data)
+        return;
+    data->volume.store(limit(v, 0.0f, 1.0f), memory_order_relaxed);
+}
+
+void PlayingAudio::position(VectorF position)
 {
     if(!data)
         return;
     unique_lock<mutex> lock(getAudioStateMutex());
-    data->volume = limit(v, 0.0f, 1.0f);
+    data->setPosition(position, getAudioListener());
 }
 
 double PlayingAudio::duration()
 {
     if(!data)
         return 0;
-    unique_lock<mutex> lock(getAudioStateMutex());
-    return data->decoder->lengthInSeconds();
+    return data->duration;
 }
 
 Audio::Audio(wstring resourceName, bool isStreaming) : data()
@@ -285,6 +784,10 @@ Audio::Audio(wstring resourceName, bool isStreaming) : data()
         data = make_shared<AudioData>(
             [resourceName]() -> shared_ptr<AudioDecoder>
             {
+                shared_ptr<AudioDecoder> prefetchedDecoder =
+                    TrackPrefetcher::get().makeDecoder(resourceName);
+                if(prefetchedDecoder)
+                    return prefetchedDecoder;
                 try
                 {
                     shared_ptr<stream::Reader> preader = getResourceReader(resourceName);
@@ -296,35 +799,29 @@ Audio::Audio(wstring resourceName, bool isStreaming) : data()
                         vector<float>(), getGlobalAudioSampleRate(), getGlobalAudioChannelCount());
                 }
             });
+        data->streamingResourceName = resourceName;
     }
     else
     {
         try
         {
-            shared_ptr<stream::Reader> preader = getResourceReader(resourceName);
-            shared_ptr<AudioDecoder> decoder = make_shared<OggVorbisDecoder>(preader);
-            vector<float> buffer;
-            buffer.resize(decoder->channelCount() * 8192);
-            uint64_t finalSize = 0;
-            for(;;)
-            {
-                buffer.resize(static_cast<std::size_t>(finalSize + decoder->channelCount() * 8192));
-                uint64_t currentSize = decoder->channelCount()
-                                       * decoder->decodeAudioBlock(
-                                             &buffer[static_cast<std::size_t>(finalSize)],
-                                             (buffer.size() - finalSize) / decoder->channelCount());
-                if(currentSize == 0)
-                    break;
-                finalSize += currentSize;
-            }
-            buffer.resize(static_cast<std::size_t>(finalSize));
-            shared_ptr<MemoryAudioDecoder> memDecoder = make_shared<MemoryAudioDecoder>(
-                buffer, decoder->samplesPerSecond(), decoder->channelCount());
-            data = make_shared<AudioData>([memDecoder]() -> shared_ptr<AudioDecoder>
-                                          {
-                                              memDecoder->reset();
-                                              return memDecoder;
-                                          });
+            // keep the sound loaded until data has its duration
+            shared_ptr<const SoundBuffer> buffer = SoundBank::get().load(resourceName);
+            data = make_shared<AudioData>(
+                [resourceName]() -> shared_ptr<AudioDecoder>
+                {
+                    try
+                    {
+                        return make_shared<SoundBufferAudioDecoder>(
+                            SoundBank::get().load(resourceName));
+                    }
+                    catch(stream::IOException &)
+                    {
+                        return make_shared<MemoryAudioDecoder>(vector<float>(),
+                                                               getGlobalAudioSampleRate(),
+                                                               getGlobalAudioChannelCount());
+                    }
+                });
         }
         catch(stream::IOException &e)
         {
@@ -335,25 +832,56 @@ Audio::Audio(wstring resourceName, bool isStreaming) : data()
 
 Audio::Audio(const vector<float> &data, unsigned sampleRate, unsigned channelCount) : data()
 {
-    shared_ptr<MemoryAudioDecoder> memDecoder =
-        make_shared<MemoryAudioDecoder>(data, sampleRate, channelCount);
-    this->data = make_shared<AudioData>([memDecoder]() -> shared_ptr<AudioDecoder>
+    auto samples = make_shared<const vector<float>>(data);
+    this->data = make_shared<AudioData>([samples, sampleRate, channelCount]()
+                                            -> shared_ptr<AudioDecoder>
                                         {
-                                            memDecoder->reset();
-                                            return memDecoder;
+                                            return make_shared<MemoryAudioDecoder>(
+                                                samples, sampleRate, channelCount);
                                         });
 }
 
-shared_ptr<PlayingAudio> Audio::play(float volume, bool looped)
+shared_ptr<PlayingAudio> Audio::play(float volume, bool looped, const VectorF *position)
 {
     if(!data)
         return shared_ptr<PlayingAudio>(new PlayingAudio(nullptr));
+    DecodeService &decodeService = DecodeService::get();
+    Mixer &mixer = Mixer::get();
+    unique_lock<mutex> lock(getAudioStateMutex());
     programmerjake::game_puzzle::startAudio();
-    auto playingAudioData = make_shared<PlayingAudioData>(data, volume, looped);
-    startAudioImp(playingAudioData);
+    shared_ptr<PlayingAudioData> playingAudioData;
+    for(;;)
+    {
+        unsigned sampleRate = getGlobalAudioSampleRate();
+        unsigned channelCount = getGlobalAudioChannelCount();
+        lock.unlock();
+        // opening the source can load the sound and the constructor decodes the start of it, so
+        // don't hold the lock for them
+        playingAudioData = make_shared<PlayingAudioData>(
+            data, data->makeAudioDecoder(), volume, looped, sampleRate, channelCount);
+        lock.lock();
+        // the decode worker closes the device when the last sound finishes, which can happen
+        // while this one is being primed; a reopened device can have a different format
+        programmerjake::game_puzzle::startAudio();
+        if(sampleRate == getGlobalAudioSampleRate()
+           && channelCount == getGlobalAudioChannelCount())
+            break;
+    }
+    if(position)
+        playingAudioData->setPosition(*position, getAudioListener());
+    getPlayingAudioSet().insert(playingAudioData);
+    mixer.addVoice(playingAudioData.get());
+    lock.unlock();
+    decodeService.notify();
     return shared_ptr<PlayingAudio>(new PlayingAudio(playingAudioData));
 }
 
+void Audio::prefetch()
+{
+    if(data && !data->streamingResourceName.empty())
+        TrackPrefetcher::get().prefetch(data->streamingResourceName);
+}
+
 double Audio::duration()
 {
     if(!data)
@@ -361,6 +889,236 @@ double Audio::duration()
     return data->duration;
 }
 
+OfflineAudioRenderer::OfflineAudioRenderer(unsigned sampleRate,
+                                           unsigned channels,
+                                           size_t blockSampleCount)
+    : sampleRate(sampleRate),
+      channels(channels),
+      blockSampleCount(blockSampleCount),
+      events(),
+      maxAudibleVoiceCount(Mixer::maxVoiceCount)
+{
+    assert(sampleRate > 0);
+    assert(channels > 0 && channels <= maxAudioChannelCount);
+    assert(blockSampleCount > 0);
+}
+
+uint64_t OfflineAudioRenderer::toSample(double time) const
+{
+    if(time <= 0)
+        return 0;
+    return static_cast<uint64_t>(std::round(time * sampleRate));
+}
+
+OfflineAudioRenderer::VoiceId OfflineAudioRenderer::play(double time,
+                                                         Audio audio,
+                                                         float volume,
+                                                         bool looped)
+{
+    VoiceId voice = nextVoiceId++;
+    events.push_back(
+        Event{toSample(time), EventType::Play, voice, std::move(audio), volume, looped});
+    return voice;
+}
+
+void OfflineAudioRenderer::stop(double time, VoiceId voice)
+{
+    events.push_back(Event{toSample(time), EventType::Stop, voice, Audio(), 0, false});
+}
+
+void OfflineAudioRenderer::setVolume(double time, VoiceId voice, float volume)
+{
+    events.push_back(Event{toSample(time), EventType::SetVolume, voice, Audio(), volume, false});
+}
+
+vector<int16_t> OfflineAudioRenderer::render(double duration)
+{
+    typedef chrono::steady_clock Clock;
+    vector<Event> sortedEvents = events;
+    stable_sort(sortedEvents.begin(),
+                sortedEvents.end(),
+                [](const Event &a, const Event &b)
+                {
+                    return a.sample < b.sample;
+                });
+    uint64_t sampleCount = toSample(duration);
+    vector<int16_t> retval(static_cast<size_t>(sampleCount * channels));
+    unique_ptr<Mixer> mixer(new Mixer);
+    mixer->maxAudibleVoiceCount.store(maxAudibleVoiceCount, memory_order_relaxed);
+    unordered_map<VoiceId, shared_ptr<PlayingAudioData>> voices;
+    blockCosts.clear();
+    size_t eventIndex = 0;
+    for(uint64_t position = 0; position < sampleCount;)
+    {
+        for(; eventIndex < sortedEvents.size() && sortedEvents[eventIndex].sample <= position;
+            eventIndex++)
+        {
+            const Event &event = sortedEvents[eventIndex];
+            if(event.type == EventType::Play)
+            {
+                if(!event.audio.data)
+                    continue;
+                shared_ptr<AudioData> audioData = event.audio.data;
+                auto voice = make_shared<PlayingAudioData>(audioData,
+                                                           audioData->makeAudioDecoder(),
+                                                           event.volume,
+                                                           event.looped,
+                                                           sampleRate,
+                                                           channels);
+                mixer->addVoice(voice.get());
+                voices[event.voice] = voice;
+                continue;
+            }
+            auto iter = voices.find(event.voice);
+            if(iter == voices.end())
+                continue;
+            if(event.type == EventType::Stop)
+                iter->second->stopRequested.store(true, memory_order_relaxed);
+            else
+                iter->second->volume.store(event.volume, memory_order_relaxed);
+        }
+        uint64_t blockEnd = std::min<uint64_t>(sampleCount, position + blockSampleCount);
+        if(eventIndex < sortedEvents.size())
+            blockEnd = std::min(blockEnd, sortedEvents[eventIndex].sample);
+        BlockCost blockCost;
+        blockCost.sampleCount = static_cast<size_t>(blockEnd - position);
+        Clock::time_point startTime = Clock::now();
+        for(const auto &voice : voices)
+            voice.second->fill();
+        Clock::time_point mixStartTime = Clock::now();
+        mixer->mix(&retval[static_cast<size_t>(position * channels)],
+                   blockCost.sampleCount,
+                   channels);
+        Clock::time_point endTime = Clock::now();
+        blockCost.decodeSeconds = chrono::duration<double>(mixStartTime - startTime).count();
+        blockCost.mixSeconds = chrono::duration<double>(endTime - mixStartTime).count();
+        blockCosts.push_back(blockCost);
+        for(auto i = voices.begin(); i != voices.end();)
+        {
+            if(i->second->retired.load(memory_order_acquire))
+                i = voices.erase(i);
+            else
+                ++i;
+        }
+        position = blockEnd;
+    }
+    underrunCount = mixer->underrunCount.load(memory_order_relaxed);
+    return retval;
+}
+
+uint64_t OfflineAudioRenderer::hash(const vector<int16_t> &samples)
+{
+    uint64_t retval = 0xCBF29CE484222325ULL;
+    for(int16_t sample : samples)
+    {
+        uint16_t value = static_cast<uint16_t>(sample);
+        for(uint8_t byte : {static_cast<uint8_t>(value & 0xFF), static_cast<uint8_t>(value >> 8)})
+        {
+            retval ^= byte;
+            retval *= 0x100000001B3ULL;
+        }
+    }
+    return retval;
+}
+
+void OfflineAudioRenderer::writeWAV(stream::Writer &writer,
+                                    const vector<int16_t> &samples,
+                                    unsigned sampleRate,
+                                    unsigned channels)
+{
+    vector<uint8_t> header;
+    auto writeU16 = [&header](uint16_t v)
+    {
+        header.push_back(static_cast<uint8_t>(v & 0xFF));
+        header.push_back(static_cast<uint8_t>(v >> 8));
+    };
+    auto writeU32 = [&header, &writeU16](uint32_t v)
+    {
+        writeU16(static_cast<uint16_t>(v & 0xFFFF));
+        writeU16(static_cast<uint16_t>(v >> 16));
+    };
+    auto writeTag = [&header](const char *tag)
+    {
+        header.insert(header.end(), tag, tag + 4);
+    };
+    uint32_t dataSize = static_cast<uint32_t>(samples.size() * sizeof(int16_t));
+    writeTag("RIFF");
+    writeU32(36 + dataSize);
+    writeTag("WAVE");
+    writeTag("fmt ");
+    writeU32(16);
+    writeU16(1); // PCM
+    writeU16(static_cast<uint16_t>(channels));
+    writeU32(sampleRate);
+    writeU32(sampleRate * channels * sizeof(int16_t)); // bytes per second
+    writeU16(static_cast<uint16_t>(channels * sizeof(int16_t))); // bytes per sample
+    writeU16(16); // bits per value
+    writeTag("data");
+    writeU32(dataSize);
+    writer.writeBytes(header.data(), header.size());
+    vector<uint8_t> buffer;
+    constexpr size_t bufferValueCount = 8192;
+    for(size_t start = 0; start < samples.size(); start += bufferValueCount)
+    {
+        size_t count = std::min(bufferValueCount, samples.size() - start);
+        buffer.resize(count * sizeof(int16_t));
+        for(size_t i = 0; i < count; i++)
+        {
+            uint16_t value = static_cast<uint16_t>(samples[start + i]);
+            buffer[2 * i] = static_cast<uint8_t>(value & 0xFF);
+            buffer[2 * i + 1] = static_cast<uint8_t>(value >> 8);
+        }
+        writer.writeBytes(buffer.data(), buffer.size());
+    }
+}
+
+#if 0
+namespace
+{
+initializer init1([]()
+{
+    // regression test and benchmark for the mixer; doesn't need an audio device
+    const uint64_t goldenHash = 0x2A1346815310E267ULL;
+    vector<float> tone(44100), chord(48000 * 2);
+    for(size_t i = 0; i < tone.size(); i++)
+        tone[i] = 0.5f * static_cast<float>(std::sin(i * 2 * M_PI * 440 / 44100));
+    for(size_t i = 0; i < chord.size() / 2; i++)
+    {
+        chord[2 * i] = 0.25f * static_cast<float>(std::sin(i * 2 * M_PI * 262 / 48000));
+        chord[2 * i + 1] = 0.25f * static_cast<float>(std::sin(i * 2 * M_PI * 330 / 48000));
+    }
+    Audio toneAudio(tone, 44100, 1), chordAudio(chord, 48000, 2);
+    OfflineAudioRenderer renderer;
+    renderer.play(0, chordAudio, 1, true);
+    auto toneVoice = renderer.play(0.25, toneAudio);
+    renderer.setVolume(0.5, toneVoice, 0.25f);
+    for(int i = 0; i < 64; i++)
+        renderer.play(1 + i * 0.01, toneAudio, 0.02f);
+    auto loopedTone = renderer.play(2, toneAudio, 0.5f, true);
+    renderer.stop(4.5, loopedTone);
+    vector<int16_t> output = renderer.render(5);
+    double decodeSeconds = 0, mixSeconds = 0, maxMixSeconds = 0;
+    for(const OfflineAudioRenderer::BlockCost &blockCost : renderer.getBlockCosts())
+    {
+        decodeSeconds += blockCost.decodeSeconds;
+        mixSeconds += blockCost.mixSeconds;
+        maxMixSeconds = std::max(maxMixSeconds, blockCost.mixSeconds);
+    }
+    size_t blockCount = renderer.getBlockCosts().size();
+    cout << blockCount << " blocks: decode " << decodeSeconds * 1e6 / blockCount
+         << "us/block, mix " << mixSeconds * 1e6 / blockCount << "us/block (max "
+         << maxMixSeconds * 1e6 << "us), " << 5 / (decodeSeconds + mixSeconds)
+         << "x real time, " << renderer.getUnderrunCount() << " underruns" << endl;
+    uint64_t hash = OfflineAudioRenderer::hash(output);
+    cout << "hash 0x" << hex << hash << dec << (hash == goldenHash ? " matches" : " MISMATCH")
+         << endl;
+    stream::FileWriter writer(L"offline_render.wav");
+    OfflineAudioRenderer::writeWAV(writer, output, 48000, 2);
+    exit(0);
+});
+}
+#endif
+
 #if 0
 namespace
 {
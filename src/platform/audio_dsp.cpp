@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "platform/audio_dsp.h"
+#include <cmath>
+#include <cassert>
+#include <initializer_list>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUDIO_DSP_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define AUDIO_DSP_HAVE_X86 0
+#endif
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+constexpr float int16Scale = 0x8000;
+constexpr float int16Min = -0x8000, int16Max = 0x7FFF;
+
+void scalarMixAccumulate(float *dest, const float *source, size_t count, float gain)
+{
+    for(size_t i = 0; i < count; i++)
+        dest[i] += source[i] * gain;
+}
+
+void scalarMixAccumulateWithChannelGains(float *dest,
+                                         const float *source,
+                                         size_t count,
+                                         const float *gains,
+                                         unsigned channels,
+                                         unsigned firstChannel)
+{
+    assert(firstChannel < channels);
+    unsigned channel = firstChannel;
+    for(size_t i = 0; i < count; i++)
+    {
+        dest[i] += source[i] * gains[channel];
+        if(++channel == channels)
+            channel = 0;
+    }
+}
+
+inline int16_t scalarConvertToInt16(float value)
+{
+    // written the same way as the SSE max and min instructions so NaNs are handled the same
+    value *= int16Scale;
+    value = value > int16Min ? value : int16Min;
+    value = value < int16Max ? value : int16Max;
+    return static_cast<int16_t>(lrintf(value));
+}
+
+void scalarConvertToInt16(int16_t *dest, const float *source, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+        dest[i] = scalarConvertToInt16(source[i]);
+}
+
+template <unsigned SourceChannels, unsigned DestChannels>
+void applyChannelMatrix(float *dest, const float *source, const float *matrix, size_t sampleCount)
+{
+    for(size_t sample = 0; sample < sampleCount; sample++)
+    {
+        for(unsigned destChannel = 0; destChannel < DestChannels; destChannel++)
+        {
+            float sum = 0;
+            for(unsigned sourceChannel = 0; sourceChannel < SourceChannels; sourceChannel++)
+                sum += source[sourceChannel] * matrix[destChannel * SourceChannels + sourceChannel];
+            dest[destChannel] = sum;
+        }
+        source += SourceChannels;
+        dest += DestChannels;
+    }
+}
+
+/** apply a channel matrix
+ *
+ * The common conversions have the channel counts as constants so that the compiler can unroll
+ * and vectorize them, so all the kernel sets share this.
+ */
+void applyChannelMatrix(float *dest,
+                        unsigned destChannels,
+                        const float *source,
+                        unsigned sourceChannels,
+                        const float *matrix,
+                        size_t sampleCount)
+{
+    if(sourceChannels == 1 && destChannels == 2)
+        return applyChannelMatrix<1, 2>(dest, source, matrix, sampleCount);
+    if(sourceChannels == 2 && destChannels == 1)
+        return applyChannelMatrix<2, 1>(dest, source, matrix, sampleCount);
+    if(sourceChannels == 6 && destChannels == 2)
+        return applyChannelMatrix<6, 2>(dest, source, matrix, sampleCount);
+    for(size_t sample = 0; sample < sampleCount; sample++)
+    {
+        for(unsigned destChannel = 0; destChannel < destChannels; destChannel++)
+        {
+            float sum = 0;
+            for(unsigned sourceChannel = 0; sourceChannel < sourceChannels; sourceChannel++)
+                sum += source[sourceChannel] * matrix[destChannel * sourceChannels + sourceChannel];
+            dest[destChannel] = sum;
+        }
+        source += sourceChannels;
+        dest += destChannels;
+    }
+}
+
+#if AUDIO_DSP_HAVE_X86
+__attribute__((target("sse2"))) void sse2MixAccumulate(float *dest,
+                                                        const float *source,
+                                                        size_t count,
+                                                        float gain)
+{
+    __m128 gainVector = _mm_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 product = _mm_mul_ps(_mm_loadu_ps(source + i), gainVector);
+        _mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), product));
+    }
+    scalarMixAccumulate(dest + i, source + i, count - i, gain);
+}
+
+__attribute__((target("sse2"))) void sse2ConvertToInt16(int16_t *dest,
+                                                         const float *source,
+                                                         size_t count)
+{
+    const __m128 scale = _mm_set1_ps(int16Scale);
+    const __m128 minimum = _mm_set1_ps(int16Min), maximum = _mm_set1_ps(int16Max);
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m128 low = _mm_mul_ps(_mm_loadu_ps(source + i), scale);
+        __m128 high = _mm_mul_ps(_mm_loadu_ps(source + i + 4), scale);
+        low = _mm_min_ps(_mm_max_ps(low, minimum), maximum);
+        high = _mm_min_ps(_mm_max_ps(high, minimum), maximum);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), packed);
+    }
+    scalarConvertToInt16(dest + i, source + i, count - i);
+}
+
+__attribute__((target("avx"))) void avxMixAccumulate(float *dest,
+                                                      const float *source,
+                                                      size_t count,
+                                                      float gain)
+{
+    __m256 gainVector = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256 product = _mm256_mul_ps(_mm256_loadu_ps(source + i), gainVector);
+        _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_loadu_ps(dest + i), product));
+    }
+    scalarMixAccumulate(dest + i, source + i, count - i, gain);
+}
+
+__attribute__((target("avx2"))) void avx2ConvertToInt16(int16_t *dest,
+                                                         const float *source,
+                                                         size_t count)
+{
+    const __m256 scale = _mm256_set1_ps(int16Scale);
+    const __m256 minimum = _mm256_set1_ps(int16Min), maximum = _mm256_set1_ps(int16Max);
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        __m256 low = _mm256_mul_ps(_mm256_loadu_ps(source + i), scale);
+        __m256 high = _mm256_mul_ps(_mm256_loadu_ps(source + i + 8), scale);
+        low = _mm256_min_ps(_mm256_max_ps(low, minimum), maximum);
+        high = _mm256_min_ps(_mm256_max_ps(high, minimum), maximum);
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(low), _mm256_cvtps_epi32(high));
+        // packs works on each 128-bit half separately, so put the 64-bit groups back in order
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), packed);
+    }
+    scalarConvertToInt16(dest + i, source + i, count - i);
+}
+#endif
+
+AudioDSPKernels selectKernels()
+{
+    AudioDSPKernels retval = getScalarAudioDSPKernels();
+#if AUDIO_DSP_HAVE_X86
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("sse2"))
+        return retval;
+    retval.name = "SSE2";
+    retval.mixAccumulate = sse2MixAccumulate;
+    retval.convertToInt16 = sse2ConvertToInt16;
+    if(!__builtin_cpu_supports("avx"))
+        return retval;
+    retval.name = "AVX";
+    retval.mixAccumulate = avxMixAccumulate;
+    if(!__builtin_cpu_supports("avx2"))
+        return retval;
+    retval.name = "AVX2";
+    retval.convertToInt16 = avx2ConvertToInt16;
+#endif
+    return retval;
+}
+}
+
+const AudioDSPKernels &getScalarAudioDSPKernels()
+{
+    static const AudioDSPKernels retval = {
+        "scalar",
+        scalarMixAccumulate,
+        scalarMixAccumulateWithChannelGains,
+        scalarConvertToInt16,
+        applyChannelMatrix,
+    };
+    return retval;
+}
+
+const AudioDSPKernels &getAudioDSPKernels()
+{
+    static const AudioDSPKernels retval = selectKernels();
+    return retval;
+}
+
+vector<float> makeChannelMatrix(unsigned sourceChannels, unsigned destChannels)
+{
+    assert(sourceChannels > 0 && destChannels > 0);
+    vector<float> retval(static_cast<size_t>(sourceChannels) * destChannels, 0.0f);
+    unsigned destChannel = 0;
+    auto addRow = [&](initializer_list<float> row)
+    {
+        assert(row.size() == sourceChannels && destChannel < destChannels);
+        unsigned sourceChannel = 0;
+        for(float coefficient : row)
+            retval[destChannel * sourceChannels + sourceChannel++] = coefficient;
+        destChannel++;
+    };
+    if(sourceChannels == destChannels)
+    {
+        for(unsigned i = 0; i < destChannels; i++)
+            retval[i * sourceChannels + i] = 1;
+        return retval;
+    }
+    if(sourceChannels == 1)
+    {
+        for(float &coefficient : retval)
+            coefficient = 1;
+        return retval;
+    }
+    switch(destChannels)
+    {
+    case 2:
+        switch(sourceChannels)
+        {
+        case 3:
+            addRow({2.0f / 3, 1.0f / 3, 0});
+            addRow({0, 1.0f / 3, 2.0f / 3});
+            return retval;
+        case 4:
+            addRow({0.5f, 0, 0.5f, 0});
+            addRow({0, 0.5f, 0, 0.5f});
+            return retval;
+        case 5:
+            addRow({0.4f, 0.2f, 0, 0.4f, 0});
+            addRow({0, 0.2f, 0.4f, 0, 0.4f});
+            return retval;
+        case 6:
+            addRow({0.4f, 0.2f, 0, 0.4f, 0, 1});
+            addRow({0, 0.2f, 0.4f, 0, 0.4f, 1});
+            return retval;
+        }
+        break;
+    case 3:
+        switch(sourceChannels)
+        {
+        case 2:
+            addRow({1.25f, -0.25f});
+            addRow({0.5f, 0.5f});
+            addRow({-0.25f, 1.25f});
+            return retval;
+        case 4:
+            addRow({0.625f, -0.125f, 0.625f, -0.125f});
+            addRow({0.25f, 0.25f, 0.25f, 0.25f});
+            addRow({-0.125f, 0.625f, -0.125f, 0.625f});
+            return retval;
+        case 5:
+            addRow({0.5f, 0, 0, 0.5f, 0});
+            addRow({0, 1, 0, 0, 0});
+            addRow({0, 0, 0.5f, 0, 0.5f});
+            return retval;
+        case 6:
+            addRow({0.5f, 0, 0, 0.5f, 0, 1});
+            addRow({0, 1, 0, 0, 0, 1});
+            addRow({0, 0, 0.5f, 0, 0.5f, 1});
+            return retval;
+        }
+        break;
+    case 4:
+        switch(sourceChannels)
+        {
+        case 2:
+            addRow({1, 0});
+            addRow({0, 1});
+            addRow({1, 0});
+            addRow({0, 1});
+            return retval;
+        case 3:
+            addRow({2.0f / 3, 1.0f / 3, 0});
+            addRow({0, 1.0f / 3, 2.0f / 3});
+            addRow({2.0f / 3, 1.0f / 3, 0});
+            addRow({0, 1.0f / 3, 2.0f / 3});
+            return retval;
+        case 5:
+            addRow({2.0f / 3, 1.0f / 3, 0, 0, 0});
+            addRow({0, 1.0f / 3, 2.0f / 3, 0, 0});
+            addRow({0, 0, 0, 1, 0});
+            addRow({0, 0, 0, 0, 1});
+            return retval;
+        case 6:
+            addRow({2.0f / 3, 1.0f / 3, 0, 0, 0, 1});
+            addRow({0, 1.0f / 3, 2.0f / 3, 0, 0, 1});
+            addRow({0, 0, 0, 1, 0, 1});
+            addRow({0, 0, 0, 0, 1, 1});
+            return retval;
+        }
+        break;
+    case 5:
+    case 6:
+        switch(sourceChannels)
+        {
+        case 2:
+            addRow({1.25f, -0.25f});
+            addRow({0.5f, 0.5f});
+            addRow({-0.25f, 1.25f});
+            addRow({1.25f, -0.25f});
+            addRow({-0.25f, 1.25f});
+            if(destChannels == 6)
+                addRow({0.5f, 0.5f});
+            return retval;
+        case 3:
+            addRow({1, 0, 0});
+            addRow({0, 1, 0});
+            addRow({0, 0, 1});
+            addRow({1, 0, 0});
+            addRow({0, 0, 1});
+            if(destChannels == 6)
+                addRow({1.0f / 3, 1.0f / 3, 1.0f / 3});
+            return retval;
+        case 4:
+            addRow({1.25f, -0.25f, 0, 0});
+            addRow({0.25f, 0.25f, 0.25f, 0.25f});
+            addRow({-0.25f, 1.25f, 0, 0});
+            addRow({1.25f, -0.25f, 0, 0});
+            addRow({-0.25f, 1.25f, 0, 0});
+            if(destChannels == 6)
+                addRow({0.25f, 0.25f, 0.25f, 0.25f});
+            return retval;
+        case 5:
+            if(destChannels == 6)
+            {
+                addRow({1, 0, 0, 0, 0});
+                addRow({0, 1, 0, 0, 0});
+                addRow({0, 0, 1, 0, 0});
+                addRow({0, 0, 0, 1, 0});
+                addRow({0, 0, 0, 0, 1});
+                addRow({0.2f, 0.2f, 0.2f, 0.2f, 0.2f});
+                return retval;
+            }
+            break;
+        case 6:
+            if(destChannels == 5)
+            {
+                addRow({1, 0, 0, 0, 0, 1});
+                addRow({0, 1, 0, 0, 0, 1});
+                addRow({0, 0, 1, 0, 0, 1});
+                addRow({0, 0, 0, 1, 0, 1});
+                addRow({0, 0, 0, 0, 1, 1});
+                return retval;
+            }
+            break;
+        }
+        break;
+    }
+    // otherwise every output channel is the average of the input channels
+    for(float &coefficient : retval)
+        coefficient = 1.0f / sourceChannels;
+    return retval;
+}
+
+void addAudioDither(float *values, size_t count, uint32_t &state)
+{
+    assert(state != 0);
+    constexpr float scale = 1.0f / (static_cast<float>(0x100000000ULL) * int16Scale);
+    uint32_t x = state;
+    for(size_t i = 0; i < count; i++)
+    {
+        // xorshift32; the difference of two uniform values has a triangular distribution
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        uint32_t a = x;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        values[i] += (static_cast<float>(a) - static_cast<float>(x)) * scale;
+    }
+    state = x;
+}
+}
+}
@@ -48,6 +48,7 @@
 #include <condition_variable>
 #include <cctype>
 #include "platform/audio.h"
+#include "platform/asset_archive.h"
 #include "platform/thread_priority.h"
 #include "util/logging.h"
 #include "render/generate.h"
@@ -371,9 +372,49 @@ static void calcResourcePrefix()
     pResourcePrefix = new wstring(p + L"res/");
 }
 
+/// @return the packed resources or nullptr if there's no archive
+static shared_ptr<AssetArchive> getAssetArchive()
+{
+    static shared_ptr<AssetArchive> retval = []() -> shared_ptr<AssetArchive>
+    {
+        for(bool useFallbackPath : {false, true})
+        {
+            try
+            {
+                wstring fileName = getResourceFileName(AssetArchive::fileName, useFallbackPath);
+                shared_ptr<AssetArchive> archive = AssetArchive::open(fileName);
+                if(archive != nullptr)
+                    return archive;
+            }
+            catch(stream::IOException &e)
+            {
+                getDebugLog() << L"can't open asset archive: " << string_cast<wstring>(e.what())
+                              << postnl;
+            }
+        }
+        return nullptr;
+    }();
+    return retval;
+}
+
 shared_ptr<stream::Reader> getResourceReader(wstring resource)
 {
     startSDL();
+    shared_ptr<AssetArchive> archive = getAssetArchive();
+    if(archive != nullptr)
+    {
+        shared_ptr<stream::Reader> retval = archive->openEntry(resource);
+        if(retval != nullptr)
+            return retval;
+    }
+    // map regular files so decoders can read them without copying
+    for(bool useFallbackPath : {false, true})
+    {
+        shared_ptr<stream::Reader> retval =
+            stream::MmapReader::open(getResourceFileName(resource, useFallbackPath));
+        if(retval != nullptr)
+            return retval;
+    }
     string fname = string_cast<string>(getResourceFileName(resource, false));
     try
     {
@@ -423,6 +464,7 @@ std::string *getPreferencesPath()
         return new std::string(retval);
     return nullptr;
 }
+}
 
 std::wstring makeUserSpecificFilePath(std::wstring name)
 {
@@ -431,7 +473,6 @@ std::wstring makeUserSpecificFilePath(std::wstring name)
         return name;
     return string_cast<std::wstring>(*preferencesPath) + name;
 }
-}
 
 std::shared_ptr<stream::Reader> readUserSpecificFile(std::wstring name)
 {
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "platform/audio.h"
+#include "util/math_constants.h"
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+struct ResampleAudioDecoder::FilterBank final
+{
+    unsigned upFactor, downFactor; // output rate : input rate, reduced
+    unsigned phaseCount; // equal to upFactor unless that's more than maxPhaseCount
+    unsigned tapCount; // always a multiple of tapBlockSize
+    vector<float> coefficients; // tapCount coefficients for each phase
+    static constexpr unsigned maxPhaseCount = 1024;
+    static constexpr unsigned tapBlockSize = 4;
+    const float *getPhase(uint64_t phase) const
+    {
+        return &coefficients[static_cast<size_t>(phase * phaseCount / upFactor) * tapCount];
+    }
+    FilterBank(unsigned upFactor, unsigned downFactor, ResampleQuality quality);
+    static shared_ptr<const FilterBank> get(unsigned sourceRate,
+                                            unsigned destRate,
+                                            ResampleQuality quality);
+};
+
+constexpr unsigned ResampleAudioDecoder::FilterBank::maxPhaseCount;
+constexpr unsigned ResampleAudioDecoder::FilterBank::tapBlockSize;
+
+namespace
+{
+unsigned gcd(unsigned a, unsigned b)
+{
+    while(b != 0)
+    {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+double besselI0(double x)
+{
+    double sum = 1, term = 1;
+    for(int k = 1; k < 50; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if(term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+struct QualityParameters final
+{
+    unsigned tapCount; // when not downsampling
+    double passband; // the fraction of the Nyquist frequency that is kept
+    double kaiserBeta;
+};
+
+QualityParameters getQualityParameters(ResampleQuality quality)
+{
+    switch(quality)
+    {
+    case ResampleQuality::Fast:
+        return QualityParameters{8, 0.8, 5};
+    case ResampleQuality::Medium:
+        return QualityParameters{16, 0.9, 7};
+    case ResampleQuality::Best:
+        break;
+    }
+    return QualityParameters{32, 0.95, 9};
+}
+
+/** compute some output samples
+ *
+ * The accumulators are split into tapBlockSize interleaved partial sums so that the taps and
+ * channels are independent and the compiler can vectorize the inner loop without reordering
+ * floating point additions.
+ * @param channelsIn the number of channels; only used when ChannelsTemplate is 0
+ * @param accumulators storage for tapBlockSize * channels partial sums
+ * @return the number of output samples written
+ */
+template <unsigned ChannelsTemplate>
+size_t resampleBlock(const ResampleAudioDecoder::FilterBank &filterBank,
+                     unsigned channelsIn,
+                     float *accumulators,
+                     const float *source,
+                     size_t &sourceIndex,
+                     size_t sourceEnd,
+                     uint64_t &phase,
+                     float *output,
+                     size_t outputCount)
+{
+    constexpr unsigned tapBlockSize = ResampleAudioDecoder::FilterBank::tapBlockSize;
+    const unsigned channels = ChannelsTemplate == 0 ? channelsIn : ChannelsTemplate;
+    const unsigned tapCount = filterBank.tapCount;
+    const uint64_t upFactor = filterBank.upFactor, downFactor = filterBank.downFactor;
+    size_t retval = 0;
+    while(retval < outputCount && sourceIndex + tapCount <= sourceEnd)
+    {
+        const float *coefficients = filterBank.getPhase(phase);
+        const float *input = &source[sourceIndex * channels];
+        for(unsigned i = 0; i < tapBlockSize * channels; i++)
+            accumulators[i] = 0;
+        for(unsigned tap = 0; tap < tapCount; tap += tapBlockSize)
+        {
+            for(unsigned i = 0; i < tapBlockSize * channels; i++)
+                accumulators[i] += input[i] * coefficients[i / channels];
+            input += tapBlockSize * channels;
+            coefficients += tapBlockSize;
+        }
+        for(unsigned channel = 0; channel < channels; channel++)
+        {
+            float sum = 0;
+            for(unsigned i = 0; i < tapBlockSize; i++)
+                sum += accumulators[i * channels + channel];
+            *output++ = sum;
+        }
+        retval++;
+        phase += downFactor;
+        sourceIndex += static_cast<size_t>(phase / upFactor);
+        phase %= upFactor;
+    }
+    return retval;
+}
+
+/** resample with the channel count as a constant when it's common
+ * @see resampleBlock
+ */
+size_t resampleBlockDispatch(const ResampleAudioDecoder::FilterBank &filterBank,
+                             unsigned channels,
+                             const float *source,
+                             size_t &sourceIndex,
+                             size_t sourceEnd,
+                             uint64_t &phase,
+                             float *output,
+                             size_t outputCount)
+{
+    constexpr unsigned tapBlockSize = ResampleAudioDecoder::FilterBank::tapBlockSize;
+    switch(channels)
+    {
+    case 1:
+    {
+        float accumulators[tapBlockSize * 1];
+        return resampleBlock<1>(filterBank,
+                                channels,
+                                accumulators,
+                                source,
+                                sourceIndex,
+                                sourceEnd,
+                                phase,
+                                output,
+                                outputCount);
+    }
+    case 2:
+    {
+        float accumulators[tapBlockSize * 2];
+        return resampleBlock<2>(filterBank,
+                                channels,
+                                accumulators,
+                                source,
+                                sourceIndex,
+                                sourceEnd,
+                                phase,
+                                output,
+                                outputCount);
+    }
+    default:
+    {
+        vector<float> accumulators(tapBlockSize * channels);
+        return resampleBlock<0>(filterBank,
+                                channels,
+                                accumulators.data(),
+                                source,
+                                sourceIndex,
+                                sourceEnd,
+                                phase,
+                                output,
+                                outputCount);
+    }
+    }
+}
+}
+
+ResampleAudioDecoder::FilterBank::FilterBank(unsigned upFactor,
+                                             unsigned downFactor,
+                                             ResampleQuality quality)
+    : upFactor(upFactor),
+      downFactor(downFactor),
+      phaseCount(min(upFactor, maxPhaseCount)),
+      tapCount(),
+      coefficients()
+{
+    QualityParameters parameters = getQualityParameters(quality);
+    double cutoff = parameters.passband; // relative to the source Nyquist frequency
+    double widthScale = 1;
+    if(downFactor > upFactor) // lower the cutoff to the destination Nyquist frequency
+    {
+        widthScale = min<double>(static_cast<double>(downFactor) / upFactor, 4);
+        cutoff /= static_cast<double>(downFactor) / upFactor;
+    }
+    tapCount = static_cast<unsigned>(std::ceil(parameters.tapCount * widthScale / tapBlockSize))
+               * tapBlockSize;
+    coefficients.resize(static_cast<size_t>(phaseCount) * tapCount);
+    double halfWidth = tapCount / 2;
+    double windowScale = 1 / besselI0(parameters.kaiserBeta);
+    for(unsigned phase = 0; phase < phaseCount; phase++)
+    {
+        double fraction = static_cast<double>(phase) / phaseCount;
+        float *phaseCoefficients = &coefficients[static_cast<size_t>(phase) * tapCount];
+        double sum = 0;
+        for(unsigned tap = 0; tap < tapCount; tap++)
+        {
+            // distance in source samples from the output sample to this tap
+            double distance = (static_cast<double>(tap) - (halfWidth - 1)) - fraction;
+            double x = distance / halfWidth;
+            double window = 0;
+            if(x > -1 && x < 1)
+                window = besselI0(parameters.kaiserBeta * std::sqrt(1 - x * x)) * windowScale;
+            double sinc = 1;
+            if(distance != 0)
+                sinc = std::sin(M_PI * cutoff * distance) / (M_PI * cutoff * distance);
+            double value = cutoff * sinc * window;
+            phaseCoefficients[tap] = static_cast<float>(value);
+            sum += value;
+        }
+        for(unsigned tap = 0; tap < tapCount; tap++) // normalize to unity gain
+            phaseCoefficients[tap] = static_cast<float>(phaseCoefficients[tap] / sum);
+    }
+}
+
+shared_ptr<const ResampleAudioDecoder::FilterBank> ResampleAudioDecoder::FilterBank::get(
+    unsigned sourceRate, unsigned destRate, ResampleQuality quality)
+{
+    unsigned divisor = gcd(sourceRate, destRate);
+    unsigned upFactor = destRate / divisor, downFactor = sourceRate / divisor;
+    typedef tuple<unsigned, unsigned, ResampleQuality> KeyType;
+    static mutex cacheLock;
+    static map<KeyType, shared_ptr<const FilterBank>> cache;
+    lock_guard<mutex> lockIt(cacheLock);
+    shared_ptr<const FilterBank> &retval = cache[KeyType(upFactor, downFactor, quality)];
+    if(retval == nullptr)
+        retval = make_shared<FilterBank>(upFactor, downFactor, quality);
+    return retval;
+}
+
+ResampleAudioDecoder::ResampleAudioDecoder(shared_ptr<AudioDecoder> decoder,
+                                           unsigned sampleRate,
+                                           ResampleQuality quality)
+    : decoder(decoder),
+      filterBank(FilterBank::get(decoder->samplesPerSecond(), sampleRate, quality)),
+      sampleRate(sampleRate),
+      channels(decoder->channelCount()),
+      buffer()
+{
+    constexpr size_t blockSize = 4096;
+    buffer.resize((blockSize + filterBank->tapCount) * channels);
+    // start with silence before the first source sample so the filter is centered on it
+    bufferEnd = filterBank->tapCount / 2 - 1;
+    std::fill(buffer.begin(), buffer.begin() + bufferEnd * channels, 0.0f);
+}
+
+uint64_t ResampleAudioDecoder::numSamples()
+{
+    if(outputSampleCount != Unknown)
+        return outputSampleCount;
+    uint64_t count = decoder->numSamples();
+    if(count == Unknown)
+        return Unknown;
+    return (count * filterBank->upFactor + filterBank->downFactor - 1) / filterBank->downFactor;
+}
+
+void ResampleAudioDecoder::fillBuffer()
+{
+    size_t capacity = buffer.size() / channels;
+    size_t skipCount = 0; // when downsampling a lot, the next filter can start past bufferEnd
+    if(bufferStart > bufferEnd)
+    {
+        skipCount = bufferStart - bufferEnd;
+        bufferStart = bufferEnd;
+    }
+    if(bufferStart > 0)
+    {
+        memmove(buffer.data(),
+                &buffer[bufferStart * channels],
+                (bufferEnd - bufferStart) * channels * sizeof(float));
+        bufferEnd -= bufferStart;
+        bufferStart = 0;
+    }
+    while(!gotEOF && bufferEnd < capacity)
+    {
+        size_t requestedCount = capacity - bufferEnd;
+        if(skipCount > 0)
+            requestedCount = min(skipCount, capacity);
+        size_t count = static_cast<size_t>(
+            decoder->decodeAudioBlock(&buffer[bufferEnd * channels], requestedCount));
+        if(count == 0)
+        {
+            gotEOF = true;
+            const FilterBank &filterBank = *this->filterBank;
+            outputSampleCount = (sourceSamplesRead * filterBank.upFactor + filterBank.downFactor
+                                 - 1) / filterBank.downFactor;
+            break;
+        }
+        sourceSamplesRead += count;
+        if(skipCount > 0)
+            skipCount -= count;
+        else
+            bufferEnd += count;
+    }
+    if(gotEOF) // pad with silence so the filter can run past the end
+    {
+        std::fill(buffer.begin() + bufferEnd * channels, buffer.end(), 0.0f);
+        bufferEnd = capacity;
+    }
+}
+
+bool ResampleAudioDecoder::seek(uint64_t sample)
+{
+    if(outputSampleCount != Unknown)
+        sample = min(sample, outputSampleCount);
+    const FilterBank &filterBank = *this->filterBank;
+    uint64_t sourcePosition = sample * filterBank.downFactor; // in 1/upFactor source samples
+    uint64_t center = sourcePosition / filterBank.upFactor;
+    size_t historySize = filterBank.tapCount / 2 - 1;
+    uint64_t start = center - min<uint64_t>(center, historySize);
+    if(!decoder->seek(start))
+        return false;
+    phase = sourcePosition % filterBank.upFactor;
+    position = sample;
+    sourceSamplesRead = start;
+    gotEOF = false;
+    bufferStart = 0;
+    // use silence for the part of the filter before the first source sample
+    bufferEnd = static_cast<size_t>(historySize - (center - start));
+    std::fill(buffer.begin(), buffer.begin() + bufferEnd * channels, 0.0f);
+    return true;
+}
+
+uint64_t ResampleAudioDecoder::decodeAudioBlock(float *data, uint64_t sampleCount)
+{
+    uint64_t retval = 0;
+    for(;;)
+    {
+        if(bufferStart + filterBank->tapCount > bufferEnd)
+            fillBuffer();
+        if(outputSampleCount != Unknown)
+            sampleCount = min(sampleCount, outputSampleCount - position);
+        if(retval >= sampleCount)
+            return retval;
+        size_t count = resampleBlockDispatch(*filterBank,
+                                             channels,
+                                             buffer.data(),
+                                             bufferStart,
+                                             bufferEnd,
+                                             phase,
+                                             data + retval * channels,
+                                             static_cast<size_t>(sampleCount - retval));
+        retval += count;
+        position += count;
+    }
+}
+}
+}
+
+#if 0 // benchmark
+#include "util/util.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+initializer init1([]()
+{
+    const unsigned sourceRate = 44100, destRate = 48000, channels = 2;
+    vector<float> samples(static_cast<size_t>(sourceRate) * 10 * channels);
+    for(float &sample : samples)
+        sample = static_cast<float>(rand()) / RAND_MAX * 2 - 1;
+    auto source = make_shared<const vector<float>>(std::move(samples));
+    const ResampleQuality qualities[] = {
+        ResampleQuality::Fast, ResampleQuality::Medium, ResampleQuality::Best};
+    const char *qualityNames[] = {"Fast", "Medium", "Best"};
+    for(size_t i = 0; i < sizeof(qualities) / sizeof(qualities[0]); i++)
+    {
+        ResampleAudioDecoder decoder(
+            make_shared<MemoryAudioDecoder>(source, sourceRate, channels), destRate, qualities[i]);
+        vector<float> output(1024 * channels);
+        uint64_t total = 0;
+        auto startTime = chrono::steady_clock::now();
+        for(;;)
+        {
+            uint64_t count = decoder.decodeAudioBlock(output.data(), 1024);
+            if(count == 0)
+                break;
+            total += count;
+        }
+        double elapsed =
+            chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        cout << qualityNames[i] << ": " << total << " samples (expected " << decoder.numSamples()
+             << ") at " << total / elapsed << " samples per second" << endl;
+    }
+    exit(0);
+});
+}
+}
+}
+#endif
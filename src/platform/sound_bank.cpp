@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "platform/sound_bank.h"
+#include "platform/audio_dsp.h"
+#include "platform/platform.h"
+#include "decoder/ogg_vorbis_decoder.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+uint64_t SoundBufferAudioDecoder::decodeAudioBlock(float *data, uint64_t sampleCount)
+{
+    sampleCount = std::min(sampleCount, buffer->sampleCount - position);
+    size_t start = static_cast<size_t>(position * buffer->channels);
+    size_t count = static_cast<size_t>(sampleCount * buffer->channels);
+    if(buffer->int16Samples.empty())
+    {
+        const float *source = buffer->floatSamples.data() + start;
+        std::copy(source, source + count, data);
+    }
+    else
+    {
+        const int16_t *source = buffer->int16Samples.data() + start;
+        for(size_t i = 0; i < count; i++)
+            data[i] = source[i] * (1.0f / 0x8000);
+    }
+    position += sampleCount;
+    return sampleCount;
+}
+
+SoundBank &SoundBank::get()
+{
+    static SoundBank retval;
+    return retval;
+}
+
+shared_ptr<const SoundBuffer> SoundBank::decode(const wstring &resourceName, bool useInt16Samples)
+{
+    shared_ptr<stream::Reader> preader = getResourceReader(resourceName);
+    OggVorbisDecoder decoder(preader);
+    shared_ptr<SoundBuffer> retval = make_shared<SoundBuffer>();
+    retval->sampleRate = decoder.samplesPerSecond();
+    retval->channels = decoder.channelCount();
+    constexpr size_t blockSize = 8192;
+    vector<float> &samples = retval->floatSamples;
+    size_t finalSize = 0;
+    for(;;)
+    {
+        samples.resize(finalSize + retval->channels * blockSize);
+        size_t currentSize =
+            retval->channels
+            * static_cast<size_t>(decoder.decodeAudioBlock(&samples[finalSize], blockSize));
+        if(currentSize == 0)
+            break;
+        finalSize += currentSize;
+    }
+    samples.resize(finalSize);
+    samples.shrink_to_fit();
+    retval->sampleCount = finalSize / retval->channels;
+    if(useInt16Samples && finalSize > 0)
+    {
+        retval->int16Samples.resize(finalSize);
+        getAudioDSPKernels().convertToInt16(retval->int16Samples.data(), samples.data(), finalSize);
+        samples = vector<float>();
+    }
+    return retval;
+}
+
+void SoundBank::evictIdleEntries()
+{
+    while(memoryUsage > memoryBudget)
+    {
+        auto leastRecentlyUsed = entries.end();
+        for(auto i = entries.begin(); i != entries.end(); ++i)
+        {
+            // only the bank hands out references, so this can't change while we hold lock
+            if(!i->second.buffer.unique())
+                continue;
+            if(leastRecentlyUsed == entries.end()
+               || i->second.lastUsed < leastRecentlyUsed->second.lastUsed)
+                leastRecentlyUsed = i;
+        }
+        if(leastRecentlyUsed == entries.end())
+            return;
+        memoryUsage -= leastRecentlyUsed->second.buffer->memoryUsage();
+        entries.erase(leastRecentlyUsed);
+    }
+}
+
+shared_ptr<const SoundBuffer> SoundBank::load(const wstring &resourceName)
+{
+    unique_lock<mutex> lockIt(lock);
+    auto iter = entries.find(resourceName);
+    if(iter != entries.end())
+    {
+        iter->second.lastUsed = ++useCounter;
+        return iter->second.buffer;
+    }
+    bool useInt16Samples = this->useInt16Samples;
+    lockIt.unlock(); // don't block loading other sounds while decoding
+    shared_ptr<const SoundBuffer> buffer = decode(resourceName, useInt16Samples);
+    lockIt.lock();
+    Entry &entry = entries[resourceName];
+    if(entry.buffer == nullptr) // another thread could have loaded it while we were decoding
+    {
+        entry.buffer = buffer;
+        memoryUsage += buffer->memoryUsage();
+    }
+    entry.lastUsed = ++useCounter;
+    buffer = entry.buffer;
+    evictIdleEntries();
+    return buffer;
+}
+
+void SoundBank::setMemoryBudget(size_t bytes)
+{
+    lock_guard<mutex> lockIt(lock);
+    memoryBudget = bytes;
+    evictIdleEntries();
+}
+
+size_t SoundBank::getMemoryBudget() const
+{
+    lock_guard<mutex> lockIt(lock);
+    return memoryBudget;
+}
+
+size_t SoundBank::getMemoryUsage() const
+{
+    lock_guard<mutex> lockIt(lock);
+    return memoryUsage;
+}
+
+void SoundBank::setUseInt16Samples(bool enabled)
+{
+    lock_guard<mutex> lockIt(lock);
+    useInt16Samples = enabled;
+}
+}
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "platform/track_prefetcher.h"
+#include "platform/audio_dsp.h"
+#include "platform/platform.h"
+#include "platform/thread_name.h"
+#include "platform/thread_priority.h"
+#include "decoder/ogg_vorbis_decoder.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+/// plays the prefetched start of a track, then streams the rest from the resource
+class PrefetchedTrackDecoder final : public AudioDecoder
+{
+    const wstring resourceName;
+    const shared_ptr<const SoundBuffer> head;
+    SoundBufferAudioDecoder headDecoder;
+    const uint64_t trackSampleCount;
+    uint64_t position = 0;
+    shared_ptr<AudioDecoder> tail; // opened once head runs out
+    uint64_t tailPosition = Unknown; // the next sample that tail returns
+    bool tailFailed = false;
+    shared_ptr<AudioDecoder> openTail()
+    {
+        shared_ptr<AudioDecoder> retval =
+            make_shared<OggVorbisDecoder>(getResourceReader(resourceName));
+        if(retval->samplesPerSecond() != head->sampleRate
+           || retval->channelCount() != head->channels)
+            throw stream::IOException("resource changed while playing");
+        return retval;
+    }
+    /// @return true if tail's next sample is position
+    bool positionTail()
+    {
+        if(tail && tailPosition == position)
+            return true;
+        if(tailFailed)
+            return false;
+        try
+        {
+            if(tail && tail->seek(position))
+            {
+                tailPosition = position;
+                return true;
+            }
+            tail = nullptr; // free it first to save memory
+            tail = openTail();
+            tailPosition = 0;
+            if(position == 0 || tail->seek(position))
+            {
+                tailPosition = position;
+                return true;
+            }
+            // can't seek, so decode up to position
+            tail = nullptr;
+            tail = openTail();
+            tailPosition = 0;
+            vector<float> discardBuffer(4096 * head->channels);
+            while(tailPosition < position)
+            {
+                uint64_t count = tail->decodeAudioBlock(
+                    discardBuffer.data(), std::min<uint64_t>(position - tailPosition, 4096));
+                if(count == 0)
+                    break;
+                tailPosition += count;
+            }
+            return tailPosition == position;
+        }
+        catch(stream::IOException &)
+        {
+            tail = nullptr;
+            tailFailed = true;
+            return false;
+        }
+    }
+
+public:
+    PrefetchedTrackDecoder(wstring resourceName,
+                           shared_ptr<const SoundBuffer> head,
+                           uint64_t trackSampleCount)
+        : resourceName(std::move(resourceName)),
+          head(head),
+          headDecoder(head),
+          trackSampleCount(trackSampleCount)
+    {
+    }
+    virtual unsigned samplesPerSecond() override
+    {
+        return head->sampleRate;
+    }
+    virtual uint64_t numSamples() override
+    {
+        return trackSampleCount;
+    }
+    virtual unsigned channelCount() override
+    {
+        return head->channels;
+    }
+    virtual uint64_t decodeAudioBlock(float *data, uint64_t sampleCount) override
+    {
+        if(position < head->sampleCount)
+        {
+            headDecoder.seek(position);
+            uint64_t retval = headDecoder.decodeAudioBlock(
+                data, std::min(sampleCount, head->sampleCount - position));
+            position += retval;
+            return retval;
+        }
+        if(position == trackSampleCount || !positionTail())
+            return 0;
+        uint64_t retval = tail->decodeAudioBlock(data, sampleCount);
+        position += retval;
+        tailPosition += retval;
+        return retval;
+    }
+    virtual bool isHighLatencySource() const override
+    {
+        return true;
+    }
+    virtual bool seek(uint64_t sample) override
+    {
+        // tail is moved when it's needed, so seeking back to the start doesn't do any I/O
+        position = std::min(sample, trackSampleCount);
+        return true;
+    }
+};
+
+/** decode the start of a track
+ * @param trackSampleCount set to the length of the whole track
+ */
+shared_ptr<const SoundBuffer> decodeTrackHead(const wstring &resourceName,
+                                              double duration,
+                                              uint64_t &trackSampleCount)
+{
+    OggVorbisDecoder decoder(getResourceReader(resourceName));
+    shared_ptr<SoundBuffer> retval = make_shared<SoundBuffer>();
+    retval->sampleRate = decoder.samplesPerSecond();
+    retval->channels = decoder.channelCount();
+    trackSampleCount = decoder.numSamples();
+    uint64_t headSampleCount = static_cast<uint64_t>(duration * retval->sampleRate);
+    if(trackSampleCount != AudioDecoder::Unknown)
+        headSampleCount = std::min(headSampleCount, trackSampleCount);
+    vector<float> samples(static_cast<size_t>(headSampleCount * retval->channels));
+    uint64_t decodedCount = 0;
+    while(decodedCount < headSampleCount)
+    {
+        uint64_t count = decoder.decodeAudioBlock(
+            &samples[static_cast<size_t>(decodedCount * retval->channels)],
+            headSampleCount - decodedCount);
+        if(count == 0)
+        {
+            trackSampleCount = decodedCount; // the whole track fits
+            break;
+        }
+        decodedCount += count;
+    }
+    retval->sampleCount = decodedCount;
+    retval->int16Samples.resize(static_cast<size_t>(decodedCount * retval->channels));
+    getAudioDSPKernels().convertToInt16(
+        retval->int16Samples.data(), samples.data(), retval->int16Samples.size());
+    return retval;
+}
+}
+
+TrackPrefetcher::TrackPrefetcher() : lock(), cond(), queue(), entries(), worker()
+{
+    worker = thread([this]()
+                    {
+                        threadFn();
+                    });
+}
+
+TrackPrefetcher::~TrackPrefetcher()
+{
+    unique_lock<mutex> lockIt(lock);
+    done = true;
+    cond.notify_all();
+    lockIt.unlock();
+    worker.join();
+}
+
+TrackPrefetcher &TrackPrefetcher::get()
+{
+    static TrackPrefetcher retval;
+    return retval;
+}
+
+void TrackPrefetcher::threadFn()
+{
+    setThreadName(L"track prefetch");
+    // only decodes ahead, so don't take time from the game or the audio decoders
+    setThreadPriority(ThreadPriority::Low);
+    unique_lock<mutex> lockIt(lock);
+    while(!done)
+    {
+        if(queue.empty())
+        {
+            cond.wait(lockIt);
+            continue;
+        }
+        wstring resourceName = std::move(queue.front());
+        queue.pop_front();
+        double duration = prefetchDuration;
+        lockIt.unlock();
+        shared_ptr<const SoundBuffer> head;
+        uint64_t trackSampleCount = 0;
+        try
+        {
+            head = decodeTrackHead(resourceName, duration, trackSampleCount);
+        }
+        catch(stream::IOException &)
+        {
+            // leave it to be streamed like it would be without prefetching
+        }
+        lockIt.lock();
+        auto iter = entries.find(resourceName);
+        if(iter == entries.end())
+            continue;
+        if(head == nullptr)
+        {
+            entries.erase(iter);
+            continue;
+        }
+        iter->second.head = std::move(head);
+        iter->second.trackSampleCount = trackSampleCount;
+        evictOldEntries();
+    }
+}
+
+void TrackPrefetcher::evictOldEntries()
+{
+    for(;;)
+    {
+        size_t trackCount = 0;
+        auto oldest = entries.end();
+        for(auto iter = entries.begin(); iter != entries.end(); ++iter)
+        {
+            if(iter->second.head == nullptr)
+                continue;
+            trackCount++;
+            if(oldest == entries.end() || iter->second.lastUsed < oldest->second.lastUsed)
+                oldest = iter;
+        }
+        if(trackCount <= maxTrackCount)
+            return;
+        entries.erase(oldest);
+    }
+}
+
+void TrackPrefetcher::prefetch(const wstring &resourceName)
+{
+    unique_lock<mutex> lockIt(lock);
+    auto iter = entries.find(resourceName);
+    if(iter != entries.end())
+    {
+        iter->second.lastUsed = ++useCounter;
+        return;
+    }
+    entries.emplace(resourceName, Entry{nullptr, 0, ++useCounter});
+    queue.push_back(resourceName);
+    cond.notify_all();
+}
+
+shared_ptr<AudioDecoder> TrackPrefetcher::makeDecoder(const wstring &resourceName)
+{
+    unique_lock<mutex> lockIt(lock);
+    auto iter = entries.find(resourceName);
+    if(iter == entries.end() || iter->second.head == nullptr)
+        return nullptr;
+    iter->second.lastUsed = ++useCounter;
+    shared_ptr<const SoundBuffer> head = iter->second.head;
+    uint64_t trackSampleCount = iter->second.trackSampleCount;
+    lockIt.unlock();
+    return make_shared<PrefetchedTrackDecoder>(resourceName, std::move(head), trackSampleCount);
+}
+
+void TrackPrefetcher::setPrefetchDuration(double seconds)
+{
+    unique_lock<mutex> lockIt(lock);
+    prefetchDuration = std::max(0.0, seconds);
+}
+
+void TrackPrefetcher::setMaxTrackCount(size_t count)
+{
+    unique_lock<mutex> lockIt(lock);
+    maxTrackCount = count;
+    evictOldEntries();
+}
+}
+}
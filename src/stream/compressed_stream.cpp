@@ -19,7 +19,14 @@
  *
  */
 #include "stream/compressed_stream.h"
+#include "stream/fast_lz.h"
+#include "stream/worker_pool.h"
 #include <new>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <iterator>
 #include <zlib.h>
 
 namespace programmerjake
@@ -59,13 +66,18 @@ z_streamp getStream(const std::shared_ptr<void> &ptr)
 {
     return (z_streamp)ptr.get();
 }
-z_streamp makeDeflateStream()
+/** make a deflate stream
+ * @param raw if the stream should have no zlib header or trailer
+ */
+z_streamp makeDeflateStream(bool raw = false)
 {
     z_streamp retval = new z_stream;
     retval->zalloc = &myalloc;
     retval->zfree = &myfree;
     retval->opaque = nullptr;
-    if(deflateInit(retval, 2) != Z_OK)
+    int result = raw ? deflateInit2(retval, 2, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) :
+                       deflateInit(retval, 2);
+    if(result != Z_OK)
     {
         std::string msg = "zlib error";
         if(retval->msg != nullptr)
@@ -84,13 +96,14 @@ void deflateDeleter(void *stream)
 {
     freeDeflateStream((z_streamp)stream);
 }
-z_streamp makeInflateStream()
+z_streamp makeInflateStream(bool raw = false)
 {
     z_streamp retval = new z_stream;
     retval->zalloc = &myalloc;
     retval->zfree = &myfree;
     retval->opaque = nullptr;
-    if(inflateInit(retval) != Z_OK)
+    int result = raw ? inflateInit2(retval, -MAX_WBITS) : inflateInit(retval);
+    if(result != Z_OK)
     {
         std::string msg = "zlib error";
         if(retval->msg != nullptr)
@@ -109,18 +122,292 @@ void inflateDeleter(void *stream)
 {
     freeInflateStream((z_streamp)stream);
 }
+
+void throwZLibError(z_streamp s)
+{
+    std::string msg = "zlib error";
+    if(s->msg != nullptr)
+        msg = s->msg;
+    throw stream::ZLibFormatException(msg);
+}
+
+/// the zlib header that deflateInit(stream, 2) writes
+constexpr std::uint8_t zlibHeader[] = {0x78, 0x5E};
+/// starts block format data; a Serial stream can't start with this because its first chunk
+/// starts with the zlib header
+constexpr std::uint8_t blockFormatMagic[] = {0x00, 0x00, 'G', 'P', 'B'};
+/// the magic is followed by one byte recording the codec
+constexpr std::size_t blockFormatHeaderSize = sizeof(blockFormatMagic) + 1;
+
+std::uint8_t getCodecId(stream::CompressionCodec codec)
+{
+    switch(codec)
+    {
+    case stream::CompressionCodec::Deflate:
+        return 'Z';
+    case stream::CompressionCodec::FastLZ:
+        return 'L';
+    }
+    UNREACHABLE();
+    return 0;
+}
+
+stream::CompressionCodec getCodecFromId(std::uint8_t codecId)
+{
+    switch(codecId)
+    {
+    case 'Z':
+        return stream::CompressionCodec::Deflate;
+    case 'L':
+        return stream::CompressionCodec::FastLZ;
+    }
+    throw stream::IOException("unknown codec in block format header");
+}
+
+/// stored instead of the uncompressed size of a block to start a block index
+constexpr std::uint32_t blockIndexMarker = 0;
+constexpr std::uint64_t noBlockIndex = ~static_cast<std::uint64_t>(0);
+/// the size of a block index without the entries
+constexpr std::size_t blockIndexFixedSize = 4 + 4 + 8 + 8 + 8;
+constexpr std::size_t blockIndexEntrySize = 8 + 8;
+/// bigger blocks are rejected as corrupt instead of allocating the memory for them
+constexpr std::uint32_t maxBlockSize = 1 << 26;
+
+/** deflate a block independently of the other blocks
+ *
+ * The output ends with a sync flush and not the final block, so the outputs of consecutive
+ * blocks can be joined into a single deflate stream.
+ */
+std::vector<std::uint8_t> deflateBlock(const std::vector<std::uint8_t> &input)
+{
+    std::unique_ptr<z_stream, void (*)(z_streamp)> s(makeDeflateStream(true), freeDeflateStream);
+    // the sync flush adds an empty stored block after the compressed data
+    std::vector<std::uint8_t> retval(deflateBound(s.get(), input.size()) + 16);
+    s->next_in = const_cast<std::uint8_t *>(input.data());
+    s->avail_in = input.size();
+    s->next_out = retval.data();
+    s->avail_out = retval.size();
+    if(deflate(s.get(), Z_SYNC_FLUSH) != Z_OK || s->avail_in != 0 || s->avail_out == 0)
+        throwZLibError(s.get());
+    retval.resize(retval.size() - s->avail_out);
+    return retval;
+}
+
+std::vector<std::uint8_t> inflateBlock(const std::vector<std::uint8_t> &input,
+                                       std::size_t uncompressedSize)
+{
+    std::unique_ptr<z_stream, void (*)(z_streamp)> s(makeInflateStream(true), freeInflateStream);
+    std::vector<std::uint8_t> retval(uncompressedSize);
+    s->next_in = const_cast<std::uint8_t *>(input.data());
+    s->avail_in = input.size();
+    s->next_out = retval.data();
+    s->avail_out = retval.size();
+    switch(inflate(s.get(), Z_SYNC_FLUSH))
+    {
+    case Z_OK:
+    case Z_STREAM_END:
+    case Z_BUF_ERROR:
+        break;
+    default:
+        throwZLibError(s.get());
+    }
+    if(s->avail_out != 0)
+        throw stream::ZLibFormatException("block is shorter than its uncompressed size");
+    return retval;
+}
+
+std::vector<std::uint8_t> compressBlock(stream::CompressionCodec codec,
+                                        const std::vector<std::uint8_t> &input)
+{
+    if(codec == stream::CompressionCodec::Deflate)
+        return deflateBlock(input);
+    std::vector<std::uint8_t> retval(stream::FastLZ::compressBound(input.size()));
+    retval.resize(stream::FastLZ::compress(input.data(), input.size(), retval.data()));
+    return retval;
+}
+
+std::vector<std::uint8_t> expandBlock(stream::CompressionCodec codec,
+                                      const std::vector<std::uint8_t> &input,
+                                      std::size_t uncompressedSize)
+{
+    if(codec == stream::CompressionCodec::Deflate)
+        return inflateBlock(input, uncompressedSize);
+    std::vector<std::uint8_t> retval(uncompressedSize);
+    if(!stream::FastLZ::decompress(input.data(), input.size(), retval.data(), retval.size()))
+        throw stream::FastLZFormatException("invalid block");
+    return retval;
+}
 }
 
 namespace stream
 {
-CompressWriter::CompressWriter(Writer &writer)
+constexpr std::size_t CompressWriter::bufferSize;
+constexpr std::size_t CompressWriter::parallelBlockSize;
+
+struct CompressWriter::BlockCompressor final
+{
+    struct PendingBlock final
+    {
+        std::future<std::vector<std::uint8_t>> compressed;
+        std::uint32_t uncompressedSize;
+    };
+    struct IndexEntry final
+    {
+        std::uint64_t uncompressedOffset;
+        std::uint64_t compressedOffset;
+    };
+    const CompressionMode mode;
+    const CompressionCodec codec;
+    /// CompressionMode::Serial compresses the blocks on the calling thread
+    const bool useWorkers;
+    const std::size_t maxPendingBlocks;
+    std::deque<PendingBlock> pendingBlocks;
+    /// offsets from the start of the compressed data
+    std::uint64_t compressedOffset = 0, uncompressedOffset = 0;
+    /// the blocks written since the last block index
+    std::vector<IndexEntry> indexEntries;
+    std::uint64_t previousIndexOffset = noBlockIndex;
+    BlockCompressor(CompressionMode mode, CompressionCodec codec)
+        : mode(mode),
+          codec(codec),
+          useWorkers(mode != CompressionMode::Serial),
+          maxPendingBlocks(useWorkers ? 2 * WorkerPool::compute().getThreadCount() : 1),
+          pendingBlocks(),
+          indexEntries()
+    {
+    }
+    bool isBlockFormat() const
+    {
+        return mode != CompressionMode::ParallelCompatible;
+    }
+    void writeCompressed(Writer &writer, const std::uint8_t *data, std::size_t size)
+    {
+        if(isBlockFormat())
+        {
+            writer.writeBytes(data, size);
+            compressedOffset += size;
+            return;
+        }
+        // split into the same chunks as CompressWriter::writeCompressedBuffer
+        while(size > 0)
+        {
+            std::size_t chunkSize = std::min(size, CompressWriter::bufferSize);
+            stream::write<std::uint16_t>(writer, static_cast<std::uint16_t>(chunkSize & 0xFFFF));
+            writer.writeBytes(data, chunkSize);
+            data += chunkSize;
+            size -= chunkSize;
+        }
+    }
+    void writeHeader(Writer &writer)
+    {
+        if(isBlockFormat())
+        {
+            std::uint8_t header[blockFormatHeaderSize];
+            std::copy(std::begin(blockFormatMagic), std::end(blockFormatMagic), header);
+            header[sizeof(blockFormatMagic)] = getCodecId(codec);
+            writeCompressed(writer, header, sizeof(header));
+        }
+        else
+            writeCompressed(writer, zlibHeader, sizeof(zlibHeader));
+    }
+    void submit(std::vector<std::uint8_t> block)
+    {
+        assert(!block.empty() && block.size() <= maxBlockSize);
+        auto input = std::make_shared<std::vector<std::uint8_t>>(std::move(block));
+        std::uint32_t uncompressedSize = input->size();
+        CompressionCodec codec = this->codec;
+        std::function<std::vector<std::uint8_t>()> fn = [input, codec]()
+        {
+            return compressBlock(codec, *input);
+        };
+        if(useWorkers)
+        {
+            pendingBlocks.push_back(PendingBlock{
+                WorkerPool::compute().submitTask<std::vector<std::uint8_t>>(std::move(fn)),
+                uncompressedSize});
+            return;
+        }
+        std::packaged_task<std::vector<std::uint8_t>()> task(std::move(fn));
+        pendingBlocks.push_back(PendingBlock{task.get_future(), uncompressedSize});
+        task();
+    }
+    void writeFirstBlock(Writer &writer)
+    {
+        PendingBlock block = std::move(pendingBlocks.front());
+        pendingBlocks.pop_front();
+        std::vector<std::uint8_t> compressed = block.compressed.get();
+        if(isBlockFormat())
+        {
+            indexEntries.push_back(IndexEntry{uncompressedOffset, compressedOffset});
+            MemoryWriter headerWriter(8);
+            stream::write<std::uint32_t>(headerWriter, block.uncompressedSize);
+            stream::write<std::uint32_t>(headerWriter, compressed.size());
+            const std::vector<std::uint8_t> &header = headerWriter.getBuffer();
+            writeCompressed(writer, header.data(), header.size());
+        }
+        writeCompressed(writer, compressed.data(), compressed.size());
+        uncompressedOffset += block.uncompressedSize;
+    }
+    /// write the finished blocks, waiting for the first block if too many are pending
+    void writeFinishedBlocks(Writer &writer)
+    {
+        while(!pendingBlocks.empty())
+        {
+            if(pendingBlocks.size() < maxPendingBlocks
+               && pendingBlocks.front().compressed.wait_for(std::chrono::seconds(0))
+                      != std::future_status::ready)
+                return;
+            writeFirstBlock(writer);
+        }
+    }
+    void writeAllBlocks(Writer &writer)
+    {
+        while(!pendingBlocks.empty())
+            writeFirstBlock(writer);
+    }
+    void writeIndex(Writer &writer)
+    {
+        if(indexEntries.empty() && previousIndexOffset != noBlockIndex)
+            return;
+        std::uint64_t indexOffset = compressedOffset;
+        MemoryWriter indexWriter(blockIndexFixedSize + blockIndexEntrySize * indexEntries.size());
+        stream::write<std::uint32_t>(indexWriter, blockIndexMarker);
+        stream::write<std::uint32_t>(indexWriter, indexEntries.size());
+        for(const IndexEntry &entry : indexEntries)
+        {
+            stream::write<std::uint64_t>(indexWriter, entry.uncompressedOffset);
+            stream::write<std::uint64_t>(indexWriter, entry.compressedOffset);
+        }
+        stream::write<std::uint64_t>(indexWriter, uncompressedOffset);
+        stream::write<std::uint64_t>(indexWriter, previousIndexOffset);
+        // last so a reader can find the index from the end of the data
+        stream::write<std::uint64_t>(indexWriter, indexOffset);
+        const std::vector<std::uint8_t> &index = indexWriter.getBuffer();
+        writeCompressed(writer, index.data(), index.size());
+        indexEntries.clear();
+        previousIndexOffset = indexOffset;
+    }
+};
+
+CompressWriter::CompressWriter(Writer &writer, CompressionMode mode, CompressionCodec codec)
     : pwriter(),
       writer(writer),
-      state(std::shared_ptr<void>((void *)makeDeflateStream(), deflateDeleter)),
+      state(mode == CompressionMode::Serial && codec == CompressionCodec::Deflate ?
+                std::shared_ptr<void>((void *)makeDeflateStream(), deflateDeleter) :
+                nullptr),
+      blockSize(mode == CompressionMode::Serial ? bufferSize : parallelBlockSize),
       buffer(),
-      compressedBuffer()
+      compressedBuffer(),
+      blockCompressor()
 {
-    buffer.reserve(bufferSize);
+    assert(mode != CompressionMode::ParallelCompatible || codec == CompressionCodec::Deflate);
+    buffer.reserve(blockSize);
+    if(state == nullptr)
+    {
+        blockCompressor = std::make_shared<BlockCompressor>(mode, codec);
+        blockCompressor->writeHeader(writer);
+        return;
+    }
     compressedBuffer.resize(bufferSize);
     z_streamp s = getStream(state);
     s->next_out = &compressedBuffer[0];
@@ -143,6 +430,16 @@ void CompressWriter::writeCompressedBuffer()
 
 void CompressWriter::finish()
 {
+    if(blockCompressor != nullptr)
+    {
+        if(!buffer.empty())
+            blockCompressor->submit(std::move(buffer));
+        buffer.clear();
+        blockCompressor->writeAllBlocks(writer);
+        if(blockCompressor->isBlockFormat())
+            blockCompressor->writeIndex(writer);
+        return;
+    }
     z_streamp s = getStream(state);
     s->next_in = &buffer[0];
     s->avail_in = buffer.size();
@@ -171,6 +468,14 @@ void CompressWriter::writeBuffer()
 {
     if(buffer.size() == 0)
         return;
+    if(blockCompressor != nullptr)
+    {
+        blockCompressor->submit(std::move(buffer));
+        buffer.clear();
+        buffer.reserve(blockSize);
+        blockCompressor->writeFinishedBlocks(writer);
+        return;
+    }
     z_streamp s = getStream(state);
     s->next_in = &buffer[0];
     s->avail_in = buffer.size();
@@ -196,12 +501,186 @@ void CompressWriter::writeBuffer()
     }
 }
 
+struct ExpandReader::BlockExpander final
+{
+    struct PendingBlock final
+    {
+        std::future<std::vector<std::uint8_t>> data;
+        std::uint64_t uncompressedOffset;
+    };
+    struct IndexEntry final
+    {
+        std::uint64_t uncompressedOffset;
+        std::uint64_t compressedOffset;
+    };
+    /// where the compressed data starts in the underlying reader or -1 if it can't seek
+    const std::int64_t streamStart;
+    const CompressionCodec codec;
+    /// only read ahead if reading can't wait for another thread
+    const std::size_t maxPendingBlocks;
+    std::deque<PendingBlock> pendingBlocks;
+    /// the uncompressed offset of the next block to read
+    std::uint64_t nextUncompressedOffset = 0;
+    /// the uncompressed offset of the start of the buffer
+    std::uint64_t bufferOffset = 0;
+    bool readAllBlocks = false;
+    bool loadedIndex = false;
+    std::vector<IndexEntry> index;
+    std::uint64_t uncompressedSize = 0;
+    BlockExpander(std::int64_t streamStart, CompressionCodec codec)
+        : streamStart(streamStart),
+          codec(codec),
+          maxPendingBlocks(streamStart >= 0 ? WorkerPool::compute().getThreadCount() + 1 : 1),
+          pendingBlocks(),
+          index()
+    {
+    }
+    static void skip(Reader &reader, std::uint64_t count)
+    {
+        std::uint8_t skipBuffer[256];
+        while(count > 0)
+        {
+            std::size_t currentCount =
+                static_cast<std::size_t>(std::min<std::uint64_t>(count, sizeof(skipBuffer)));
+            reader.readAllBytes(skipBuffer, currentCount);
+            count -= currentCount;
+        }
+    }
+    /// read the next block and start decompressing it, skipping any block indexes
+    void readBlock(Reader &reader)
+    {
+        try
+        {
+            for(;;)
+            {
+                std::uint8_t sizeBytes[4];
+                std::size_t sizeByteCount = reader.readBytes(sizeBytes, sizeof(sizeBytes));
+                if(sizeByteCount == 0)
+                {
+                    readAllBlocks = true;
+                    return;
+                }
+                if(sizeByteCount < sizeof(sizeBytes))
+                    throw EOFException();
+                MemoryReader sizeReader(sizeBytes);
+                std::uint32_t size = stream::read<std::uint32_t>(sizeReader);
+                if(size == blockIndexMarker)
+                {
+                    std::uint32_t entryCount = stream::read<std::uint32_t>(reader);
+                    skip(reader,
+                         blockIndexFixedSize - 8
+                             + static_cast<std::uint64_t>(entryCount) * blockIndexEntrySize);
+                    continue;
+                }
+                std::uint32_t compressedSize = stream::read<std::uint32_t>(reader);
+                if(size > maxBlockSize || compressedSize > maxBlockSize)
+                    throw ZLibFormatException("block size out of range in ExpandReader");
+                auto compressed = std::make_shared<std::vector<std::uint8_t>>(compressedSize);
+                reader.readAllBytes(compressed->data(), compressedSize);
+                CompressionCodec codec = this->codec;
+                pendingBlocks.push_back(
+                    PendingBlock{WorkerPool::compute().submitTask<std::vector<std::uint8_t>>(
+                                     [compressed, size, codec]()
+                                     {
+                                         return expandBlock(codec, *compressed, size);
+                                     }),
+                                 nextUncompressedOffset});
+                nextUncompressedOffset += size;
+                return;
+            }
+        }
+        catch(EOFException &)
+        {
+            throw ZLibFormatException("eof reached");
+        }
+    }
+    void readAhead(Reader &reader)
+    {
+        while(!readAllBlocks && pendingBlocks.size() < maxPendingBlocks)
+            readBlock(reader);
+    }
+    /** load the block indexes by following them back from the end of the reader
+     * @throw NonSeekableException if the reader doesn't end with a block index
+     */
+    void loadIndex(Reader &reader)
+    {
+        if(loadedIndex)
+            return;
+        if(streamStart < 0)
+            throw NonSeekableException();
+        std::int64_t savedPosition = reader.tell();
+        std::vector<IndexEntry> entries;
+        bool valid = true;
+        try
+        {
+            reader.seek(0, SeekPosition::End);
+            std::uint64_t streamSize = reader.tell() - streamStart;
+            if(streamSize < blockFormatHeaderSize + blockIndexFixedSize)
+                throw NonSeekableException();
+            reader.seek(-8, SeekPosition::End);
+            std::uint64_t indexOffset = stream::read<std::uint64_t>(reader);
+            std::uint64_t indexEnd = streamSize;
+            bool isLastIndex = true;
+            while(indexOffset != noBlockIndex)
+            {
+                if(indexOffset < blockFormatHeaderSize || indexOffset >= indexEnd)
+                    throw NonSeekableException();
+                reader.seek(streamStart + indexOffset, SeekPosition::Start);
+                if(stream::read<std::uint32_t>(reader) != blockIndexMarker)
+                    throw NonSeekableException();
+                std::uint32_t entryCount = stream::read<std::uint32_t>(reader);
+                std::uint64_t indexSize = blockIndexFixedSize
+                                          + static_cast<std::uint64_t>(entryCount)
+                                                * blockIndexEntrySize;
+                if(indexSize > indexEnd - indexOffset
+                   || (isLastIndex && indexSize != indexEnd - indexOffset))
+                    throw NonSeekableException();
+                std::size_t firstNewEntry = entries.size();
+                for(std::uint32_t i = 0; i < entryCount; i++)
+                {
+                    IndexEntry entry;
+                    entry.uncompressedOffset = stream::read<std::uint64_t>(reader);
+                    entry.compressedOffset = stream::read<std::uint64_t>(reader);
+                    entries.push_back(entry);
+                }
+                // the indexes are read from last to first
+                std::reverse(entries.begin() + firstNewEntry, entries.end());
+                std::uint64_t indexUncompressedSize = stream::read<std::uint64_t>(reader);
+                if(isLastIndex)
+                    uncompressedSize = indexUncompressedSize;
+                std::uint64_t previousIndexOffset = stream::read<std::uint64_t>(reader);
+                if(stream::read<std::uint64_t>(reader) != indexOffset)
+                    throw NonSeekableException();
+                indexEnd = indexOffset;
+                indexOffset = previousIndexOffset;
+                isLastIndex = false;
+            }
+        }
+        catch(IOException &)
+        {
+            valid = false;
+        }
+        reader.seek(savedPosition, SeekPosition::Start);
+        if(!valid)
+            throw NonSeekableException();
+        std::reverse(entries.begin(), entries.end());
+        for(std::size_t i = 1; i < entries.size(); i++)
+        {
+            if(entries[i].uncompressedOffset <= entries[i - 1].uncompressedOffset)
+                throw NonSeekableException();
+        }
+        index = std::move(entries);
+        loadedIndex = true;
+    }
+};
+
 ExpandReader::ExpandReader(Reader &reader)
     : preader(),
       reader(reader),
       state(std::shared_ptr<void>(makeInflateStream(), inflateDeleter)),
       buffer(),
-      compressedBuffer()
+      compressedBuffer(),
+      blockExpander()
 {
     buffer.reserve(bufferSize);
     compressedBuffer.resize(bufferSize);
@@ -221,7 +700,39 @@ void ExpandReader::readCompressedBuffer()
             size = 0x10000;
         if(size <= 0 || size > bufferSize)
             throw ZLibFormatException("size out of range in ExpandReader::readCompressedBuffer");
-        reader.readAllBytes(&compressedBuffer[0], size);
+        size_t readCount = 0;
+        if(!checkedFormat)
+        {
+            checkedFormat = true;
+            static_assert(sizeof(blockFormatMagic) > bytesPerUint16, "");
+            if(size == 0x10000)
+            {
+                // either the block format or a Serial chunk of the maximum size
+                reader.readAllBytes(&compressedBuffer[0], 1);
+                readCount = 1;
+                if(compressedBuffer[0] == blockFormatMagic[bytesPerUint16])
+                {
+                    constexpr std::size_t headerRest = blockFormatHeaderSize - bytesPerUint16;
+                    reader.readAllBytes(&compressedBuffer[1], headerRest - 1);
+                    if(!std::equal(&compressedBuffer[0],
+                                   &compressedBuffer[headerRest - 1],
+                                   &blockFormatMagic[bytesPerUint16]))
+                        throw ZLibFormatException("invalid block format header");
+                    CompressionCodec codec = getCodecFromId(compressedBuffer[headerRest - 1]);
+                    std::int64_t streamStart = -1;
+                    try
+                    {
+                        streamStart = reader.tell() - blockFormatHeaderSize;
+                    }
+                    catch(NonSeekableException &)
+                    {
+                    }
+                    blockExpander = std::make_shared<BlockExpander>(streamStart, codec);
+                    return;
+                }
+            }
+        }
+        reader.readAllBytes(&compressedBuffer[readCount], size - readCount);
         z_streamp s = getStream(state);
         s->next_in = &compressedBuffer[0];
         s->avail_in = size;
@@ -233,17 +744,51 @@ void ExpandReader::readCompressedBuffer()
     }
 }
 
+void ExpandReader::readBlock()
+{
+    BlockExpander &e = *blockExpander;
+    e.readAhead(reader);
+    if(e.pendingBlocks.empty())
+    {
+        buffer.clear();
+        bufferPointer = 0;
+        gotEOF = true;
+        throw EOFException();
+    }
+    BlockExpander::PendingBlock block = std::move(e.pendingBlocks.front());
+    e.pendingBlocks.pop_front();
+    // keep the workers busy while this block is used
+    if(e.maxPendingBlocks > 1)
+        e.readAhead(reader);
+    buffer = block.data.get();
+    bufferPointer = 0;
+    e.bufferOffset = block.uncompressedOffset;
+}
+
 void ExpandReader::readBuffer()
 {
     if(gotEOF)
         throw EOFException();
+    if(blockExpander != nullptr)
+    {
+        readBlock();
+        return;
+    }
     bufferPointer = 0;
-    buffer.resize(bufferSize);
+    buffer.clear();
     z_streamp s = getStream(state);
     for(;;)
     {
         if(!moreAvailable)
+        {
             readCompressedBuffer();
+            if(blockExpander != nullptr)
+            {
+                readBlock();
+                return;
+            }
+        }
+        buffer.resize(bufferSize);
         s->next_out = &buffer[0];
         s->avail_out = bufferSize;
         switch(inflate(s, Z_FINISH))
@@ -266,6 +811,7 @@ void ExpandReader::readBuffer()
                 buffer.resize(bufferSize - s->avail_out);
                 return;
             }
+            buffer.clear();
             throw EOFException();
             break;
         default:
@@ -273,6 +819,81 @@ void ExpandReader::readBuffer()
         }
     }
 }
+
+std::int64_t ExpandReader::tell()
+{
+    if(!checkedFormat && !gotEOF && !dataAvailable())
+    {
+        // fill the buffer to find the format; this doesn't move the read position
+        try
+        {
+            readBuffer();
+        }
+        catch(EOFException &)
+        {
+        }
+    }
+    if(blockExpander == nullptr)
+        throw NonSeekableException();
+    return blockExpander->bufferOffset + bufferPointer;
+}
+
+void ExpandReader::seek(std::int64_t offset, SeekPosition seekPosition)
+{
+    std::int64_t currentPosition = tell();
+    BlockExpander &e = *blockExpander;
+    e.loadIndex(reader);
+    std::int64_t target;
+    switch(seekPosition)
+    {
+    case SeekPosition::Start:
+        target = offset;
+        break;
+    case SeekPosition::Current:
+        target = currentPosition + offset;
+        break;
+    case SeekPosition::End:
+        target = static_cast<std::int64_t>(e.uncompressedSize) + offset;
+        break;
+    default:
+        UNREACHABLE();
+    }
+    if(target < 0 || static_cast<std::uint64_t>(target) > e.uncompressedSize)
+        throw SeekOutOfRangeException();
+    std::uint64_t position = static_cast<std::uint64_t>(target);
+    if(position >= e.bufferOffset && position - e.bufferOffset <= buffer.size())
+    {
+        bufferPointer = static_cast<std::size_t>(position - e.bufferOffset);
+        return;
+    }
+    e.pendingBlocks.clear();
+    buffer.clear();
+    bufferPointer = 0;
+    gotEOF = false;
+    auto iter = std::upper_bound(e.index.begin(),
+                                 e.index.end(),
+                                 position,
+                                 [](std::uint64_t position, const BlockExpander::IndexEntry &entry)
+                                 {
+                                     return position < entry.uncompressedOffset;
+                                 });
+    if(iter == e.index.begin() || position == e.uncompressedSize)
+    {
+        // at the end of the data
+        e.bufferOffset = position;
+        e.nextUncompressedOffset = position;
+        e.readAllBlocks = true;
+        return;
+    }
+    --iter;
+    reader.seek(e.streamStart + iter->compressedOffset, SeekPosition::Start);
+    e.nextUncompressedOffset = iter->uncompressedOffset;
+    e.readAllBlocks = false;
+    readBlock();
+    if(position - e.bufferOffset > buffer.size())
+        throw ZLibFormatException("block index doesn't match the blocks");
+    bufferPointer = static_cast<std::size_t>(position - e.bufferOffset);
+}
 }
 }
 }
@@ -315,3 +936,196 @@ initializer init1([]()
 }
 }
 #endif // 1
+
+#if 0
+
+#include "util/util.h"
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+// compression throughput benchmark for each CompressionMode
+initializer init1([]()
+{
+    vector<uint8_t> data(64 << 20);
+    minstd_rand rg;
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = i % 1024 < 512 ? static_cast<uint8_t>(i / 7) : static_cast<uint8_t>(rg());
+    for(stream::CompressionMode mode : {stream::CompressionMode::Serial,
+                                        stream::CompressionMode::ParallelBlocks,
+                                        stream::CompressionMode::ParallelCompatible})
+    {
+        stream::MemoryWriter mwriter;
+        auto startTime = chrono::steady_clock::now();
+        {
+            stream::CompressWriter writer(mwriter, mode);
+            writer.writeBytes(data.data(), data.size());
+            writer.finish();
+        }
+        double compressTime =
+            chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        vector<uint8_t> expanded(data.size());
+        startTime = chrono::steady_clock::now();
+        stream::MemoryReader mreader(std::move(mwriter).getBuffer());
+        stream::ExpandReader reader(mreader);
+        reader.readAllBytes(expanded.data(), expanded.size());
+        double expandTime =
+            chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        cout << "mode " << static_cast<int>(mode) << ": compress "
+             << data.size() / compressTime / (1 << 20) << " MiB/s, expand "
+             << data.size() / expandTime / (1 << 20) << " MiB/s"
+             << (expanded == data ? "" : " MISMATCH") << endl;
+    }
+    exit(0);
+});
+}
+}
+}
+#endif
+
+#if 0
+
+#include "util/util.h"
+#include "decoder/png_decoder.h"
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <zlib.h>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+struct PixelDestination final : public PngDecoder::Destination
+{
+    unsigned w = 0;
+    vector<uint8_t> pixels;
+    virtual void setSize(unsigned w, unsigned h) override
+    {
+        this->w = w;
+        pixels.resize(static_cast<size_t>(w) * h * 4);
+    }
+    virtual uint8_t *getRow(unsigned y) override
+    {
+        return &pixels[static_cast<size_t>(y) * w * 4];
+    }
+};
+
+vector<uint8_t> getTextureData()
+{
+    vector<uint8_t> retval;
+    for(const wchar_t *fileName : {L"res/textures.png",
+                                   L"res/steel.png",
+                                   L"res/maze_screenshot.png",
+                                   L"res/platform_screenshot.png"})
+    {
+        stream::FileReader reader(fileName);
+        PixelDestination destination;
+        PngDecoder::decode(reader, destination);
+        retval.insert(retval.end(), destination.pixels.begin(), destination.pixels.end());
+    }
+    return retval;
+}
+
+/// typed records shaped like a saved level: a block grid followed by entities
+vector<uint8_t> getSaveData()
+{
+    stream::MemoryWriter writer;
+    minstd_rand rg;
+    for(int level = 0; level < 64; level++)
+    {
+        constexpr int size = 128;
+        writer.writeString(L"level " + to_wstring(level));
+        for(int i = 0; i < size * size; i++)
+            writer.writeU8(rg() % 8 == 0 ? rg() % 16 : (i / size + i % size) % 2);
+        stream::write<uint32_t>(writer, 256);
+        for(int i = 0; i < 256; i++)
+        {
+            writer.writeString(i % 3 == 0 ? L"enemy" : L"item");
+            stream::write<uint32_t>(writer, i);
+            writer.writeF32(static_cast<float>(rg() % size) + 0.5f);
+            writer.writeF32(0);
+            writer.writeF32(static_cast<float>(rg() % size) + 0.5f);
+            writer.writeU8(rg() % 4);
+        }
+    }
+    return std::move(writer).getBuffer();
+}
+
+// ratio and throughput of each codec compared to zlib levels
+initializer init1([]()
+{
+    for(auto &dataSet : {make_pair("texture", getTextureData()), make_pair("save", getSaveData())})
+    {
+        const vector<uint8_t> &data = dataSet.second;
+        cout << dataSet.first << " data: " << data.size() << " bytes" << endl;
+        for(int level : {1, 6, 9})
+        {
+            vector<uint8_t> compressed(compressBound(data.size()));
+            uLongf compressedSize = compressed.size();
+            auto startTime = chrono::steady_clock::now();
+            compress2(compressed.data(), &compressedSize, data.data(), data.size(), level);
+            double compressTime =
+                chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            vector<uint8_t> expanded(data.size());
+            uLongf expandedSize = expanded.size();
+            startTime = chrono::steady_clock::now();
+            uncompress(expanded.data(), &expandedSize, compressed.data(), compressedSize);
+            double expandTime =
+                chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            cout << "zlib level " << level << ": ratio "
+                 << static_cast<double>(data.size()) / compressedSize << ", compress "
+                 << data.size() / compressTime / (1 << 20) << " MiB/s, expand "
+                 << data.size() / expandTime / (1 << 20) << " MiB/s" << endl;
+        }
+        for(stream::CompressionCodec codec :
+            {stream::CompressionCodec::Deflate, stream::CompressionCodec::FastLZ})
+        {
+            for(stream::CompressionMode mode :
+                {stream::CompressionMode::Serial, stream::CompressionMode::ParallelBlocks})
+            {
+                stream::MemoryWriter mwriter;
+                auto startTime = chrono::steady_clock::now();
+                {
+                    stream::CompressWriter writer(mwriter, mode, codec);
+                    writer.writeBytes(data.data(), data.size());
+                    writer.finish();
+                }
+                double compressTime =
+                    chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+                size_t compressedSize = mwriter.getBuffer().size();
+                vector<uint8_t> expanded(data.size());
+                startTime = chrono::steady_clock::now();
+                stream::MemoryReader mreader(std::move(mwriter).getBuffer());
+                stream::ExpandReader reader(mreader);
+                reader.readAllBytes(expanded.data(), expanded.size());
+                double expandTime =
+                    chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+                cout << "codec " << static_cast<int>(codec) << " mode " << static_cast<int>(mode)
+                     << ": ratio " << static_cast<double>(data.size()) / compressedSize
+                     << ", compress " << data.size() / compressTime / (1 << 20)
+                     << " MiB/s, expand " << data.size() / expandTime / (1 << 20) << " MiB/s"
+                     << (expanded == data ? "" : " MISMATCH") << endl;
+            }
+        }
+    }
+    exit(0);
+});
+}
+}
+}
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "stream/fast_lz.h"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+namespace
+{
+constexpr size_t minMatch = 4;
+/// the format requires the last bytes to be literals
+constexpr size_t lastLiterals = 5;
+/// the last match must start this far from the end
+constexpr size_t matchFindLimit = 12;
+constexpr size_t maxOffset = 0xFFFF;
+constexpr unsigned hashLog = 14;
+constexpr unsigned runMask = 0xF;
+constexpr size_t shortCopySize = 16;
+
+uint32_t read32(const uint8_t *p)
+{
+    uint32_t retval;
+    memcpy(&retval, p, sizeof(retval));
+    return retval;
+}
+
+uint32_t hashPosition(const uint8_t *p)
+{
+    return (read32(p) * 2654435761U) >> (32 - hashLog);
+}
+
+uint8_t *writeLength(uint8_t *output, size_t length)
+{
+    while(length >= 0xFF)
+    {
+        *output++ = 0xFF;
+        length -= 0xFF;
+    }
+    *output++ = static_cast<uint8_t>(length);
+    return output;
+}
+
+uint8_t *writeLiterals(uint8_t *output, uint8_t *token, const uint8_t *literals, size_t length)
+{
+    if(length >= runMask)
+    {
+        *token = runMask << 4;
+        output = writeLength(output, length - runMask);
+    }
+    else
+        *token = static_cast<uint8_t>(length << 4);
+    if(length > 0)
+        memcpy(output, literals, length);
+    return output + length;
+}
+
+/// read the rest of a length after the 4 bits in the token
+bool readLength(const uint8_t *&input, const uint8_t *inputEnd, size_t &length)
+{
+    if(length != runMask)
+        return true;
+    for(;;)
+    {
+        if(input >= inputEnd)
+            return false;
+        uint8_t v = *input++;
+        length += v;
+        if(v != 0xFF)
+            return true;
+    }
+}
+}
+
+size_t FastLZ::compress(const uint8_t *input, size_t inputSize, uint8_t *output)
+{
+    uint8_t *const outputStart = output;
+    size_t anchor = 0;
+    if(inputSize >= matchFindLimit + 1)
+    {
+        vector<uint32_t> table(static_cast<size_t>(1) << hashLog, 0);
+        const size_t matchLimit = inputSize - lastLiterals;
+        const size_t inputLimit = inputSize - matchFindLimit;
+        size_t position = 1;
+        while(position <= inputLimit)
+        {
+            uint32_t &entry = table[hashPosition(input + position)];
+            size_t candidate = entry;
+            entry = static_cast<uint32_t>(position);
+            if(position - candidate > maxOffset
+               || read32(input + candidate) != read32(input + position))
+            {
+                // skip faster through data that doesn't compress
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+            while(position > anchor && candidate > 0
+                  && input[position - 1] == input[candidate - 1])
+            {
+                position--;
+                candidate--;
+            }
+            size_t matchLength = minMatch;
+            while(position + matchLength < matchLimit
+                  && input[position + matchLength] == input[candidate + matchLength])
+                matchLength++;
+            uint8_t *token = output++;
+            output = writeLiterals(output, token, input + anchor, position - anchor);
+            size_t offset = position - candidate;
+            *output++ = static_cast<uint8_t>(offset);
+            *output++ = static_cast<uint8_t>(offset >> 8);
+            size_t extraLength = matchLength - minMatch;
+            if(extraLength >= runMask)
+            {
+                *token |= runMask;
+                output = writeLength(output, extraLength - runMask);
+            }
+            else
+                *token |= static_cast<uint8_t>(extraLength);
+            position += matchLength;
+            anchor = position;
+            if(position - 2 <= inputLimit)
+                table[hashPosition(input + position - 2)] = static_cast<uint32_t>(position - 2);
+        }
+    }
+    uint8_t *token = output++;
+    output = writeLiterals(output, token, input + anchor, inputSize - anchor);
+    return output - outputStart;
+}
+
+bool FastLZ::decompress(const uint8_t *input,
+                        size_t inputSize,
+                        uint8_t *output,
+                        size_t outputSize)
+{
+    const uint8_t *const inputEnd = input + inputSize;
+    uint8_t *const outputStart = output;
+    uint8_t *const outputEnd = output + outputSize;
+    for(;;)
+    {
+        if(input >= inputEnd)
+            return false;
+        uint8_t token = *input++;
+        size_t literalLength = token >> 4;
+        if(!readLength(input, inputEnd, literalLength))
+            return false;
+        if(literalLength > static_cast<size_t>(inputEnd - input)
+           || literalLength > static_cast<size_t>(outputEnd - output))
+            return false;
+        // short runs are copied with a fixed size copy when there's room past their end
+        if(literalLength <= shortCopySize
+           && static_cast<size_t>(inputEnd - input) >= shortCopySize
+           && static_cast<size_t>(outputEnd - output) >= shortCopySize)
+            memcpy(output, input, shortCopySize);
+        else if(literalLength > 0)
+            memcpy(output, input, literalLength);
+        input += literalLength;
+        output += literalLength;
+        if(input == inputEnd) // the last sequence has no match
+            return output == outputEnd;
+        if(inputEnd - input < 2)
+            return false;
+        size_t offset = input[0] | static_cast<size_t>(input[1]) << 8;
+        input += 2;
+        if(offset == 0 || offset > static_cast<size_t>(output - outputStart))
+            return false;
+        size_t matchLength = token & runMask;
+        if(!readLength(input, inputEnd, matchLength))
+            return false;
+        matchLength += minMatch;
+        if(matchLength > static_cast<size_t>(outputEnd - output))
+            return false;
+        if(offset >= shortCopySize && matchLength <= shortCopySize
+           && static_cast<size_t>(outputEnd - output) >= shortCopySize)
+        {
+            memcpy(output, output - offset, shortCopySize);
+            output += matchLength;
+            continue;
+        }
+        if(offset == 1)
+        {
+            memset(output, output[-1], matchLength);
+            output += matchLength;
+            continue;
+        }
+        // overlapping matches repeat the last offset bytes; everything from the match start is
+        // a whole number of repeats, so the copied span doubles each time
+        const uint8_t *match = output - offset;
+        uint8_t *matchEnd = output + matchLength;
+        while(output < matchEnd)
+        {
+            size_t copyLength = output - match;
+            if(copyLength > static_cast<size_t>(matchEnd - output))
+                copyLength = matchEnd - output;
+            memcpy(output, match, copyLength);
+            output += copyLength;
+        }
+    }
+}
+}
+}
+}
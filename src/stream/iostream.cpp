@@ -23,6 +23,14 @@
 #include "util/util.h"
 #include <cwchar>
 #include <cstdlib>
+#include <cstring>
+#include <chrono>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IOSTREAM_HAVE_X86 1
+#include <emmintrin.h>
+#else
+#define IOSTREAM_HAVE_X86 0
+#endif
 
 namespace programmerjake
 {
@@ -30,6 +38,342 @@ namespace game_puzzle
 {
 namespace stream
 {
+namespace
+{
+/** the kernels for the ASCII fast paths
+ *
+ * Each copies characters from the start of its input until it finds one that isn't ASCII and
+ * returns how many it copied.
+ */
+struct ASCIIKernels final
+{
+    std::size_t (*widen)(wchar_t *dest, const std::uint8_t *source, std::size_t count);
+    std::size_t (*narrow)(std::uint8_t *dest, const wchar_t *source, std::size_t count);
+};
+
+std::size_t scalarWiden(wchar_t *dest, const std::uint8_t *source, std::size_t count)
+{
+    constexpr std::uint64_t highBits = 0x8080808080808080ULL;
+    std::size_t i = 0;
+    for(; i + sizeof(std::uint64_t) <= count; i += sizeof(std::uint64_t))
+    {
+        std::uint64_t v;
+        std::memcpy(&v, source + i, sizeof(v));
+        if(v & highBits)
+            break;
+        for(std::size_t j = 0; j < sizeof(std::uint64_t); j++)
+            dest[i + j] = static_cast<wchar_t>(source[i + j]);
+    }
+    for(; i < count && source[i] < 0x80; i++)
+        dest[i] = static_cast<wchar_t>(source[i]);
+    return i;
+}
+
+std::size_t scalarNarrow(std::uint8_t *dest, const wchar_t *source, std::size_t count)
+{
+    std::size_t i = 0;
+    // compare as unsigned so that negative characters aren't treated as ASCII
+    for(; i < count && static_cast<UNSIGNED_WCHAR>(source[i]) < 0x80U; i++)
+        dest[i] = static_cast<std::uint8_t>(source[i]);
+    return i;
+}
+
+#if IOSTREAM_HAVE_X86
+__attribute__((target("sse2"))) std::size_t sse2Widen(wchar_t *dest,
+                                                      const std::uint8_t *source,
+                                                      std::size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+        if(_mm_movemask_epi8(v) != 0)
+            break;
+        __m128i low = _mm_unpacklo_epi8(v, zero), high = _mm_unpackhi_epi8(v, zero);
+#if WCHAR_BITS == 16
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i + 8), high);
+#else
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i + 4), _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i + 8), _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i + 12),
+                         _mm_unpackhi_epi16(high, zero));
+#endif
+    }
+    return i + scalarWiden(dest + i, source + i, count - i);
+}
+
+__attribute__((target("sse2"))) std::size_t sse2Narrow(std::uint8_t *dest,
+                                                       const wchar_t *source,
+                                                       std::size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+#if WCHAR_BITS == 16
+    const __m128i nonASCIIBits = _mm_set1_epi16(static_cast<short>(0xFF80));
+    for(; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+        __m128i isASCII = _mm_cmpeq_epi16(_mm_and_si128(v, nonASCIIBits), zero);
+        if(_mm_movemask_epi8(isASCII) != 0xFFFF)
+            break;
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + i), _mm_packus_epi16(v, v));
+    }
+#else
+    const __m128i nonASCIIBits = _mm_set1_epi32(~0x7F);
+    for(; i + 8 <= count; i += 8)
+    {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i + 4));
+        __m128i isASCII =
+            _mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(low, high), nonASCIIBits), zero);
+        if(_mm_movemask_epi8(isASCII) != 0xFFFF)
+            break;
+        __m128i packed = _mm_packs_epi32(low, high);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + i), _mm_packus_epi16(packed, packed));
+    }
+#endif
+    return i + scalarNarrow(dest + i, source + i, count - i);
+}
+#endif
+
+ASCIIKernels selectKernels()
+{
+    ASCIIKernels retval = {scalarWiden, scalarNarrow};
+#if IOSTREAM_HAVE_X86
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("sse2"))
+        return retval;
+    retval.widen = sse2Widen;
+    retval.narrow = sse2Narrow;
+#endif
+    return retval;
+}
+
+const ASCIIKernels &getASCIIKernels()
+{
+    static const ASCIIKernels retval = selectKernels();
+    return retval;
+}
+
+std::size_t getSequenceLength(std::uint8_t leadByte)
+{
+    if(leadByte < 0x80)
+        return 1;
+    if(leadByte < 0xC0) // continuation byte
+        return 0;
+    if(leadByte < 0xE0)
+        return 2;
+    if(leadByte < 0xF0)
+        return 3;
+    if(leadByte < 0xF8)
+        return 4;
+    return 0;
+}
+
+std::uint8_t *encodeCodePoint(std::uint8_t *dest, std::uint_fast32_t ch)
+{
+    if(ch < 0x80U)
+    {
+        *dest++ = ch;
+        return dest;
+    }
+    if(ch < 0x800U)
+    {
+        *dest++ = ((ch >> 6) & 0x1F) | 0xC0;
+        *dest++ = (ch & 0x3F) | 0x80;
+        return dest;
+    }
+    if(ch < 0x10000U)
+    {
+        *dest++ = ((ch >> 12) & 0xF) | 0xE0;
+        *dest++ = ((ch >> 6) & 0x3F) | 0x80;
+        *dest++ = (ch & 0x3F) | 0x80;
+        return dest;
+    }
+    *dest++ = ((ch >> 18) & 0x7) | 0xF0;
+    *dest++ = ((ch >> 12) & 0x3F) | 0x80;
+    *dest++ = ((ch >> 6) & 0x3F) | 0x80;
+    *dest++ = (ch & 0x3F) | 0x80;
+    return dest;
+}
+}
+
+void ReaderStreamBuf::decode()
+{
+    const ASCIIKernels &kernels = getASCIIKernels();
+    const std::uint8_t *input = inputBuffer + inputStart;
+    const std::uint8_t *const inputLimit = inputBuffer + inputEnd;
+    wchar_t *output = outputBuffer;
+    wchar_t *const outputEnd = outputBuffer + bufferSize;
+    while(input < inputLimit && output < outputEnd)
+    {
+        std::size_t count = std::min<std::size_t>(inputLimit - input, outputEnd - output);
+        std::size_t asciiCount = kernels.widen(output, input, count);
+        input += asciiCount;
+        output += asciiCount;
+        if(asciiCount == count)
+            continue;
+        std::size_t sequenceLength = getSequenceLength(*input);
+        if(sequenceLength == 0)
+        {
+            gotEOFOrError = true;
+            break;
+        }
+        if(static_cast<std::size_t>(inputLimit - input) < sequenceLength)
+        {
+            // check the continuation bytes that we have so errors aren't delayed
+            for(const std::uint8_t *p = input + 1; p < inputLimit; p++)
+            {
+                if((*p & 0xC0) != 0x80)
+                    gotEOFOrError = true;
+            }
+            break;
+        }
+        std::uint_fast32_t v = *input & (0x7F >> sequenceLength);
+        bool valid = true;
+        for(std::size_t i = 1; i < sequenceLength; i++)
+        {
+            if((input[i] & 0xC0) != 0x80) // expected continuation byte
+                valid = false;
+            v = (v << 6) | (input[i] & 0x3F);
+        }
+        if(!valid || v > 0x10FFFF || (v >= 0xD800 && v <= 0xDFFF))
+        {
+            gotEOFOrError = true;
+            break;
+        }
+#if WCHAR_BITS == 16
+        if(v >= 0x10000U)
+        {
+            if(outputEnd - output < 2)
+                break;
+            v -= 0x10000U;
+            *output++ = static_cast<wchar_t>((v >> 10) + 0xD800U);
+            *output++ = static_cast<wchar_t>((v & 0x3FF) + 0xDC00U);
+        }
+        else
+#endif
+        {
+            *output++ = static_cast<wchar_t>(v);
+        }
+        input += sequenceLength;
+    }
+    inputStart = input - inputBuffer;
+    setg(outputBuffer, outputBuffer, output);
+}
+
+void ReaderStreamBuf::readAhead(bool wait)
+{
+    if(gptr() != egptr())
+        return;
+    for(;;)
+    {
+        if(gotEOFOrError)
+            return;
+        decode();
+        if(gptr() != egptr())
+            return;
+        if(gotEOF) // an incomplete sequence at the end
+        {
+            gotEOFOrError = true;
+            return;
+        }
+        // keep the start of an incomplete sequence and read the rest after it
+        std::memmove(inputBuffer, inputBuffer + inputStart, inputEnd - inputStart);
+        inputEnd -= inputStart;
+        inputStart = 0;
+        try
+        {
+            std::size_t readCount =
+                reader.readAvailableBytes(inputBuffer + inputEnd, bufferSize - inputEnd);
+            if(readCount == 0)
+            {
+                if(!wait)
+                    return;
+                readCount = reader.readBytes(inputBuffer + inputEnd, 1);
+                if(readCount == 0)
+                    gotEOF = true;
+            }
+            inputEnd += readCount;
+        }
+        catch(IOException &)
+        {
+            gotEOFOrError = true;
+            return;
+        }
+    }
+}
+
+bool WriterStreamBuf::writeBuffer()
+{
+    const ASCIIKernels &kernels = getASCIIKernels();
+    // the most bytes that one character can add : a pending high surrogate and the character
+    constexpr std::size_t maxBytesPerChar = 6;
+    const wchar_t *input = pbase();
+    const wchar_t *const inputEnd = pptr();
+    setp(inputBuffer, inputBuffer + bufferSize);
+    try
+    {
+        while(input < inputEnd)
+        {
+            std::uint8_t *output = outputBuffer;
+            std::uint8_t *const outputEnd = outputBuffer + bufferSize;
+            while(input < inputEnd
+                  && static_cast<std::size_t>(outputEnd - output) >= maxBytesPerChar)
+            {
+#if WCHAR_BITS == 16
+                if(charBuffer == emptyCharBuffer)
+#endif
+                {
+                    std::size_t count =
+                        std::min<std::size_t>(inputEnd - input, outputEnd - output);
+                    std::size_t asciiCount = kernels.narrow(output, input, count);
+                    input += asciiCount;
+                    output += asciiCount;
+                    if(asciiCount > 0) // check the space left before encoding the next character
+                        continue;
+                }
+#if WCHAR_BITS == 16
+                std::uint_fast32_t v = *input++;
+                v &= 0xFFFFU;
+                if(charBuffer != emptyCharBuffer)
+                {
+                    if(v < 0xDC00U || v > 0xDFFFU)
+                    {
+                        output = encodeCodePoint(output, charBuffer);
+                        charBuffer = emptyCharBuffer;
+                    }
+                    else
+                    {
+                        v &= 0x3FFU;
+                        v |= (charBuffer & 0x3FFU) << 10;
+                        v += 0x10000U;
+                        charBuffer = emptyCharBuffer;
+                        output = encodeCodePoint(output, v);
+                        continue;
+                    }
+                }
+                if(v >= 0xD800U && v <= 0xDBFFU)
+                    charBuffer = v;
+                else
+                    output = encodeCodePoint(output, v);
+#else
+                output = encodeCodePoint(output, static_cast<std::uint_fast32_t>(*input++));
+#endif // WCHAR_BITS == 16
+            }
+            writer.writeBytes(outputBuffer, output - outputBuffer);
+        }
+    }
+    catch(IOException &)
+    {
+        return false;
+    }
+    return true;
+}
+
 #if 0
 namespace
 {
@@ -47,6 +391,57 @@ initializer init1([]()
 });
 }
 #endif
+#if 0
+namespace
+{
+initializer init2([]()
+{
+    // ASCII-only text and text with short ASCII runs between CJK characters, like save files
+    // and translated strings
+    for(bool mixed : {false, true})
+    {
+        std::wstring text;
+        std::uint32_t seed = 1;
+        while(text.size() < (1 << 23))
+        {
+            text += L"some_setting = ";
+            for(int i = 0; i < 30; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                if(mixed && (seed >> 16) % 8 == 0)
+                    text += static_cast<wchar_t>(0x4E00 + (seed >> 16) % 500);
+                else
+                    text += static_cast<wchar_t>(L'a' + (seed >> 16) % 26);
+            }
+            text += L'\n';
+        }
+        auto startTime = std::chrono::steady_clock::now();
+        MemoryWriter writer;
+        {
+            WriterOStream os(writer);
+            os << text;
+            os.flush();
+        }
+        double encodeTime =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        auto encoded = std::make_shared<const std::vector<std::uint8_t>>(writer.getBuffer());
+        startTime = std::chrono::steady_clock::now();
+        ReaderIStream is(std::make_shared<MemoryReader>(encoded));
+        std::wstring line;
+        std::size_t charCount = 0;
+        while(std::getline(is, line))
+            charCount += line.size() + 1;
+        double decodeTime =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        double megabytes = encoded->size() / 1048576.0;
+        std::cout << (mixed ? "mixed" : "ASCII") << " text: encode " << megabytes / encodeTime
+                  << " MiB/s, decode " << megabytes / decodeTime << " MiB/s"
+                  << (charCount == text.size() ? "" : " (mismatch)") << std::endl;
+    }
+    std::exit(0);
+});
+}
+#endif
 }
 }
 }
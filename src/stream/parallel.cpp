@@ -0,0 +1,768 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "stream/parallel.h"
+#include <limits>
+#if defined(_WIN64) || defined(_WIN32)
+#include <cstdio>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+namespace
+{
+uint64_t seekInSection(int64_t offset,
+                       SeekPosition seekPosition,
+                       uint64_t position,
+                       uint64_t sectionSize)
+{
+    int64_t base;
+    switch(seekPosition)
+    {
+    case SeekPosition::Start:
+        base = 0;
+        break;
+    case SeekPosition::Current:
+        base = static_cast<int64_t>(position);
+        break;
+    case SeekPosition::End:
+        base = static_cast<int64_t>(sectionSize);
+        break;
+    default:
+        UNREACHABLE();
+    }
+    if(offset < -base || offset > static_cast<int64_t>(sectionSize) - base)
+        throw SeekOutOfRangeException();
+    return static_cast<uint64_t>(base + offset);
+}
+}
+
+class SerializedParallel::SectionReader final : public Reader
+{
+private:
+    const shared_ptr<SerializedParallel> parallel;
+    const shared_ptr<void> regionLock;
+    const uint64_t sectionStart, sectionSize;
+    uint64_t position = 0;
+
+public:
+    SectionReader(shared_ptr<SerializedParallel> parallel,
+                  shared_ptr<void> regionLock,
+                  uint64_t sectionStart,
+                  uint64_t sectionSize)
+        : parallel(std::move(parallel)),
+          regionLock(std::move(regionLock)),
+          sectionStart(sectionStart),
+          sectionSize(sectionSize)
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        if(position >= sectionSize)
+            throw EOFException();
+        uint8_t retval;
+        parallel->internalRead(&retval, sectionStart + position, 1);
+        position++;
+        return retval;
+    }
+    virtual size_t readBytes(uint8_t *array, size_t maxCount) override
+    {
+        size_t count = static_cast<size_t>(min<uint64_t>(maxCount, sectionSize - position));
+        if(count > 0)
+            parallel->internalRead(array, sectionStart + position, count);
+        position += count;
+        return count;
+    }
+    virtual size_t readAvailableBytes(uint8_t *array, size_t maxCount) override
+    {
+        return readBytes(array, maxCount);
+    }
+    virtual bool dataAvailable() override
+    {
+        return position < sectionSize;
+    }
+    virtual const uint8_t *peek(size_t &size) override
+    {
+        size = 0;
+        if(position >= sectionSize)
+            return nullptr;
+        uint64_t directSize;
+        const uint8_t *retval = parallel->getDirectPointer(sectionStart + position, directSize);
+        if(retval != nullptr)
+            size = static_cast<size_t>(min<uint64_t>(min(sectionSize - position, directSize),
+                                                     numeric_limits<size_t>::max()));
+        return retval;
+    }
+    virtual void commit(size_t count) override
+    {
+        assert(count <= sectionSize - position);
+        position += count;
+    }
+    virtual int64_t tell() override
+    {
+        return static_cast<int64_t>(position);
+    }
+    virtual void seek(int64_t offset, SeekPosition seekPosition) override
+    {
+        position = seekInSection(offset, seekPosition, position, sectionSize);
+    }
+};
+
+class SerializedParallel::SectionWriter final : public Writer
+{
+private:
+    const shared_ptr<SerializedParallel> parallel;
+    const shared_ptr<void> regionLock;
+    const uint64_t sectionStart, sectionSize;
+    uint64_t position = 0;
+
+public:
+    SectionWriter(shared_ptr<SerializedParallel> parallel,
+                  shared_ptr<void> regionLock,
+                  uint64_t sectionStart,
+                  uint64_t sectionSize)
+        : parallel(std::move(parallel)),
+          regionLock(std::move(regionLock)),
+          sectionStart(sectionStart),
+          sectionSize(sectionSize)
+    {
+    }
+    virtual void writeByte(uint8_t v) override
+    {
+        writeBytes(&v, 1);
+    }
+    virtual void writeBytes(const uint8_t *array, size_t count) override
+    {
+        if(count > sectionSize - position)
+            throw IOException("IO Error : write attempted past end of section");
+        if(count > 0)
+            parallel->internalWrite(array, sectionStart + position, count);
+        position += count;
+    }
+    virtual int64_t tell() override
+    {
+        return static_cast<int64_t>(position);
+    }
+    virtual void seek(int64_t offset, SeekPosition seekPosition) override
+    {
+        position = seekInSection(offset, seekPosition, position, sectionSize);
+    }
+};
+
+bool SerializedParallel::intersectsLockedRegion(const Region &region) const
+{
+    return lockedRegions.anyOverlapping(region.start,
+                                        region.end,
+                                        [&](const Region &lockedRegion)
+                                        {
+                                            return lockedRegion.intersects(region);
+                                        });
+}
+
+shared_ptr<void> SerializedParallel::lockRegion(uint64_t start, uint64_t end, bool isReadOnly)
+{
+    unique_lock<mutex> lockIt(globalLock);
+    auto waitingIterator =
+        waitingRegions.insert(waitingRegions.end(), Region(start, end, isReadOnly));
+    auto canLock = [&]() -> bool
+    {
+        if(intersectsLockedRegion(*waitingIterator))
+            return false;
+        for(auto i = waitingRegions.begin(); i != waitingIterator; ++i)
+        {
+            if(i->intersects(*waitingIterator))
+                return false;
+        }
+        return true;
+    };
+    while(!canLock())
+        globalCond.wait(lockIt);
+    interval_tree<Region>::handle lockedHandle = lockedRegions.insert(start, end, *waitingIterator);
+    waitingRegions.erase(waitingIterator);
+    // regions that were waiting behind this one may only intersect locked regions now
+    globalCond.notify_all();
+    return shared_ptr<void>(nullptr,
+                            [this, lockedHandle](void *)
+                            {
+                                unique_lock<mutex> lockIt(globalLock);
+                                lockedRegions.erase(lockedHandle);
+                                globalCond.notify_all();
+                            });
+}
+
+void SerializedParallel::changeSize(uint64_t newSize, bool growOnly)
+{
+    for(;;)
+    {
+        uint64_t oldSize;
+        {
+            unique_lock<mutex> lockIt(globalLock);
+            oldSize = publicSize;
+        }
+        if(growOnly && newSize <= oldSize)
+            return;
+        checkResizeImplemented();
+        shared_ptr<void> regionLock =
+            lockRegion(min(oldSize, newSize), numeric_limits<uint64_t>::max(), false);
+        {
+            unique_lock<mutex> lockIt(globalLock);
+            if(publicSize != oldSize) // resized while we were waiting
+                continue;
+        }
+        if(newSize != oldSize)
+            internalResize(oldSize, newSize);
+        unique_lock<mutex> lockIt(globalLock);
+        publicSize = newSize;
+        return;
+    }
+}
+
+shared_ptr<void> SerializedParallel::lockSection(uint64_t sectionStart,
+                                                 uint64_t sectionSize,
+                                                 bool isReadOnly)
+{
+    uint64_t sectionEnd = sectionStart + sectionSize;
+    if(sectionEnd < sectionStart)
+        throw IOException("IO Error : section wraps around");
+    for(;;)
+    {
+        if(!isReadOnly)
+            changeSize(sectionEnd, true);
+        shared_ptr<void> regionLock = lockRegion(sectionStart, sectionEnd, isReadOnly);
+        unique_lock<mutex> lockIt(globalLock);
+        if(sectionEnd <= publicSize)
+            return regionLock;
+        if(isReadOnly)
+            throw ReadPastEndException();
+        // shrunk before we locked the section, so grow it again
+    }
+}
+
+shared_ptr<Reader> SerializedParallel::readSection(uint64_t sectionStart, uint64_t sectionSize)
+{
+    checkReadSectionImplemented();
+    shared_ptr<void> regionLock = lockSection(sectionStart, sectionSize, true);
+    return make_shared<SectionReader>(static_pointer_cast<SerializedParallel>(shared_from_this()),
+                                      std::move(regionLock),
+                                      sectionStart,
+                                      sectionSize);
+}
+
+shared_ptr<Writer> SerializedParallel::writeSection(uint64_t sectionStart, uint64_t sectionSize)
+{
+    checkWriteSectionImplemented();
+    shared_ptr<void> regionLock = lockSection(sectionStart, sectionSize, false);
+    return make_shared<SectionWriter>(static_pointer_cast<SerializedParallel>(shared_from_this()),
+                                      std::move(regionLock),
+                                      sectionStart,
+                                      sectionSize);
+}
+
+shared_ptr<StreamRW> SerializedParallel::readWriteSection(uint64_t sectionStart,
+                                                          uint64_t sectionSize)
+{
+    checkReadSectionImplemented();
+    checkWriteSectionImplemented();
+    shared_ptr<void> regionLock = lockSection(sectionStart, sectionSize, false);
+    shared_ptr<SerializedParallel> parallel =
+        static_pointer_cast<SerializedParallel>(shared_from_this());
+    return make_shared<StreamRWWrapper>(
+        make_shared<SectionReader>(parallel, regionLock, sectionStart, sectionSize),
+        make_shared<SectionWriter>(parallel, regionLock, sectionStart, sectionSize));
+}
+
+namespace
+{
+class MemoryParallel final : public SerializedParallel
+{
+private:
+    /** the memory is in chunks that double in size, so growing never moves bytes that other
+     * sections are using
+     *
+     * chunk n holds the bytes from firstChunkSize * (2 ** n - 1) up to the start of chunk n + 1
+     */
+    static constexpr size_t firstChunkSize = 1 << 12;
+    static constexpr size_t maxChunkCount = 48;
+    unique_ptr<uint8_t[]> chunks[maxChunkCount];
+    size_t chunkCount = 0;
+    static uint64_t getChunkStart(size_t chunkIndex)
+    {
+        return static_cast<uint64_t>(firstChunkSize)
+               * ((static_cast<uint64_t>(1) << chunkIndex) - 1);
+    }
+    static size_t getChunkSize(size_t chunkIndex)
+    {
+        return firstChunkSize << chunkIndex;
+    }
+    static size_t getChunkIndex(uint64_t position)
+    {
+        uint64_t v = position / firstChunkSize + 1;
+        size_t retval = 0;
+        while(v > 1)
+        {
+            v >>= 1;
+            retval++;
+        }
+        return retval;
+    }
+    /// call fn(pointer, count) for each run of bytes from start to start + count in a chunk
+    template <typename Fn>
+    void forEachRun(uint64_t start, uint64_t count, Fn fn)
+    {
+        size_t chunkIndex = getChunkIndex(start);
+        uint64_t offset = start - getChunkStart(chunkIndex);
+        while(count > 0)
+        {
+            size_t runSize =
+                static_cast<size_t>(min<uint64_t>(count, getChunkSize(chunkIndex) - offset));
+            fn(chunks[chunkIndex].get() + offset, runSize);
+            count -= runSize;
+            offset = 0;
+            chunkIndex++;
+        }
+    }
+    void reserve(uint64_t size)
+    {
+        while(getChunkStart(chunkCount) < size)
+        {
+            if(chunkCount >= maxChunkCount)
+                throw IOException("IO Error : ParallelMemory too big");
+            chunks[chunkCount].reset(new uint8_t[getChunkSize(chunkCount)]());
+            chunkCount++;
+        }
+    }
+
+protected:
+    virtual void internalRead(uint8_t *data, uint64_t start, size_t count) override
+    {
+        forEachRun(start,
+                   count,
+                   [&](const uint8_t *run, size_t runSize)
+                   {
+                       memcpy(data, run, runSize);
+                       data += runSize;
+                   });
+    }
+    virtual void internalWrite(const uint8_t *data, uint64_t start, size_t count) override
+    {
+        forEachRun(start,
+                   count,
+                   [&](uint8_t *run, size_t runSize)
+                   {
+                       memcpy(run, data, runSize);
+                       data += runSize;
+                   });
+    }
+    virtual void internalResize(uint64_t oldSize, uint64_t newSize) override
+    {
+        if(newSize <= oldSize)
+            return;
+        // the chunks that are already allocated can have old bytes left from shrinking
+        forEachRun(oldSize,
+                   min(newSize, getChunkStart(chunkCount)) - oldSize,
+                   [](uint8_t *run, size_t runSize)
+                   {
+                       memset(run, 0, runSize);
+                   });
+        reserve(newSize);
+    }
+    virtual uint8_t *getDirectPointer(uint64_t start, uint64_t &size) override
+    {
+        size_t chunkIndex = getChunkIndex(start);
+        uint64_t offset = start - getChunkStart(chunkIndex);
+        size = getChunkSize(chunkIndex) - offset;
+        return chunks[chunkIndex].get() + offset;
+    }
+
+public:
+    explicit MemoryParallel(size_t size) : SerializedParallel(size)
+    {
+        reserve(size);
+    }
+};
+
+constexpr size_t MemoryParallel::firstChunkSize;
+constexpr size_t MemoryParallel::maxChunkCount;
+
+class FileParallel final : public SerializedParallel
+{
+private:
+#if defined(_WIN64) || defined(_WIN32)
+    // there's no positional I/O, so the file position is guarded by a lock
+    mutex fileLock;
+    FILE *const f;
+    static uint64_t getFileSize(FILE *f)
+    {
+        if(0 != _fseeki64(f, 0, SEEK_END))
+            IOException::throwErrorFromErrno("fseek");
+        int64_t retval = _ftelli64(f);
+        if(retval < 0)
+            IOException::throwErrorFromErrno("ftell");
+        return static_cast<uint64_t>(retval);
+    }
+    void seekTo(uint64_t start)
+    {
+        if(0 != _fseeki64(f, static_cast<int64_t>(start), SEEK_SET))
+            IOException::throwErrorFromErrno("fseek");
+    }
+#else
+    const int fd;
+    static uint64_t getFileSize(int fd)
+    {
+        struct stat st;
+        if(0 != fstat(fd, &st))
+            IOException::throwErrorFromErrno("fstat");
+        return static_cast<uint64_t>(st.st_size);
+    }
+    static off_t getOffset(uint64_t start)
+    {
+        if(start > static_cast<uint64_t>(numeric_limits<off_t>::max()))
+            throw IOException("IO Error : file offset too big");
+        return static_cast<off_t>(start);
+    }
+#endif
+    const bool readOnly;
+
+protected:
+    virtual void internalRead(uint8_t *data, uint64_t start, size_t count) override
+    {
+#if defined(_WIN64) || defined(_WIN32)
+        unique_lock<mutex> lockIt(fileLock);
+        seekTo(start);
+        if(count != fread(static_cast<void *>(data), sizeof(uint8_t), count, f))
+        {
+            if(ferror(f))
+                IOException::throwErrorFromErrno("fread");
+            throw ReadPastEndException();
+        }
+#else
+        while(count > 0)
+        {
+            ssize_t readCount = pread(fd, static_cast<void *>(data), count, getOffset(start));
+            if(readCount < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                IOException::throwErrorFromErrno("pread");
+            }
+            if(readCount == 0) // the file was truncated by someone else
+                throw ReadPastEndException();
+            data += readCount;
+            start += readCount;
+            count -= readCount;
+        }
+#endif
+    }
+    virtual void internalWrite(const uint8_t *data, uint64_t start, size_t count) override
+    {
+#if defined(_WIN64) || defined(_WIN32)
+        unique_lock<mutex> lockIt(fileLock);
+        seekTo(start);
+        if(count != fwrite(static_cast<const void *>(data), sizeof(uint8_t), count, f))
+            IOException::throwErrorFromErrno("fwrite");
+#else
+        while(count > 0)
+        {
+            ssize_t writeCount =
+                pwrite(fd, static_cast<const void *>(data), count, getOffset(start));
+            if(writeCount < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                IOException::throwErrorFromErrno("pwrite");
+            }
+            data += writeCount;
+            start += writeCount;
+            count -= writeCount;
+        }
+#endif
+    }
+    virtual void internalResize(uint64_t oldSize, uint64_t newSize) override
+    {
+        ignore_unused_variable_warning(oldSize);
+#if defined(_WIN64) || defined(_WIN32)
+        unique_lock<mutex> lockIt(fileLock);
+        if(0 != fflush(f))
+            IOException::throwErrorFromErrno("fflush");
+        if(0 != _chsize_s(_fileno(f), static_cast<int64_t>(newSize)))
+            IOException::throwErrorFromErrno("_chsize_s");
+#else
+        if(0 != ftruncate(fd, getOffset(newSize)))
+            IOException::throwErrorFromErrno("ftruncate");
+#endif
+    }
+    virtual void checkWriteSectionImplemented() const override
+    {
+        if(readOnly)
+            throw ReadOnlyException();
+    }
+    virtual void checkResizeImplemented() const override
+    {
+        if(readOnly)
+            throw ReadOnlyException();
+    }
+
+public:
+#if defined(_WIN64) || defined(_WIN32)
+    FileParallel(FILE *f, bool readOnly)
+        : SerializedParallel(getFileSize(f)), fileLock(), f(f), readOnly(readOnly)
+    {
+    }
+    ~FileParallel()
+    {
+        fclose(f);
+    }
+    static shared_ptr<FileParallel> open(wstring fileName)
+    {
+        FILE *f = nullptr;
+        bool readOnly = false;
+        try
+        {
+            f = FileReader::openFile(fileName, true);
+        }
+        catch(IOException &)
+        {
+            if(errno != ENOENT)
+            {
+                f = FileReader::openFile(fileName);
+                readOnly = true;
+            }
+            else
+                f = FileWriter::openFile(fileName, true);
+        }
+        try
+        {
+            return make_shared<FileParallel>(f, readOnly);
+        }
+        catch(...)
+        {
+            fclose(f);
+            throw;
+        }
+    }
+#else
+    FileParallel(int fd, bool readOnly)
+        : SerializedParallel(getFileSize(fd)), fd(fd), readOnly(readOnly)
+    {
+    }
+    ~FileParallel()
+    {
+        close(fd);
+    }
+    static shared_ptr<FileParallel> open(wstring fileName)
+    {
+        string str = string_cast<string>(std::move(fileName));
+        bool readOnly = false;
+        int fd = ::open(str.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if(fd < 0 && (errno == EACCES || errno == EROFS || errno == EPERM))
+        {
+            fd = ::open(str.c_str(), O_RDONLY | O_CLOEXEC);
+            readOnly = true;
+        }
+        if(fd < 0)
+            IOException::throwErrorFromErrno("open");
+        try
+        {
+            return make_shared<FileParallel>(fd, readOnly);
+        }
+        catch(...)
+        {
+            close(fd);
+            throw;
+        }
+    }
+#endif
+};
+}
+
+ParallelMemory::ParallelMemory(size_t size) : implementation(make_shared<MemoryParallel>(size))
+{
+}
+
+ParallelFile::ParallelFile(wstring fileName)
+    : implementation(FileParallel::open(std::move(fileName)))
+{
+}
+}
+}
+}
+
+#if 0
+#include "util/string_cast.h"
+#include <random>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+namespace
+{
+// stress test and throughput benchmark for concurrent sections
+void stressTest(Parallel &parallel, size_t threadCount)
+{
+    constexpr uint64_t regionSize = 1 << 20;
+    constexpr size_t iterationCount = 2000;
+    atomic_bool failed(false);
+    vector<thread> threads;
+    for(size_t threadIndex = 0; threadIndex < threadCount; threadIndex++)
+    {
+        threads.emplace_back([&, threadIndex]()
+                             {
+                                 minstd_rand rg(threadIndex);
+                                 vector<uint8_t> buffer, buffer2;
+                                 for(size_t i = 0; i < iterationCount; i++)
+                                 {
+                                     uint64_t start = uniform_int_distribution<uint64_t>(
+                                         0, regionSize - 1)(rg);
+                                     size_t size = uniform_int_distribution<size_t>(1, 1 << 14)(rg);
+                                     buffer.resize(size);
+                                     buffer2.resize(size);
+                                     if(rg() % 4 == 0)
+                                     {
+                                         // writes past the end grow the Parallel
+                                         shared_ptr<StreamRW> section =
+                                             parallel.readWriteSection(start, size);
+                                         uint8_t value = static_cast<uint8_t>(rg());
+                                         fill(buffer.begin(), buffer.end(), value);
+                                         section->writer().writeBytes(buffer.data(), size);
+                                         this_thread::yield();
+                                         section->reader().readAllBytes(buffer2.data(), size);
+                                         if(buffer != buffer2)
+                                             failed = true;
+                                     }
+                                     else
+                                     {
+                                         if(start + size > parallel.size())
+                                             continue;
+                                         shared_ptr<Reader> section;
+                                         try
+                                         {
+                                             section = parallel.readSection(start, size);
+                                         }
+                                         catch(ReadPastEndException &)
+                                         {
+                                             continue;
+                                         }
+                                         section->readAllBytes(buffer.data(), size);
+                                         this_thread::yield();
+                                         section->seek(0, SeekPosition::Start);
+                                         section->readAllBytes(buffer2.data(), size);
+                                         if(buffer != buffer2)
+                                             failed = true;
+                                     }
+                                 }
+                             });
+    }
+    for(thread &t : threads)
+        t.join();
+    cout << "  stress test with " << threadCount << " threads: " << (failed ? "FAILED" : "passed")
+         << endl;
+}
+
+void appendWhileHoldingTest(Parallel &parallel)
+{
+    // growing must not wait for sections that end before the old size
+    shared_ptr<Reader> heldSection = parallel.readSection(0, parallel.size());
+    for(size_t i = 0; i < 64; i++)
+    {
+        vector<uint8_t> buffer(1 << 14, static_cast<uint8_t>(i));
+        parallel.writeSection(parallel.size(), buffer.size())->writeBytes(buffer.data(),
+                                                                          buffer.size());
+    }
+    cout << "  append while holding a section: passed" << endl;
+}
+
+void benchmark(Parallel &parallel, size_t threadCount)
+{
+    constexpr uint64_t bytesPerThread = 16 << 20;
+    constexpr size_t chunkSize = 1 << 16;
+    constexpr size_t passCount = 16;
+    parallel.writeSection(0, bytesPerThread * threadCount);
+    auto startTime = chrono::steady_clock::now();
+    vector<thread> threads;
+    for(size_t threadIndex = 0; threadIndex < threadCount; threadIndex++)
+    {
+        threads.emplace_back([&, threadIndex]()
+                             {
+                                 vector<uint8_t> chunk(chunkSize);
+                                 for(size_t pass = 0; pass < passCount; pass++)
+                                 {
+                                     shared_ptr<Reader> section = parallel.readSection(
+                                         threadIndex * bytesPerThread, bytesPerThread);
+                                     for(uint64_t i = 0; i < bytesPerThread; i += chunkSize)
+                                         section->readAllBytes(chunk.data(), chunkSize);
+                                 }
+                             });
+    }
+    for(thread &t : threads)
+        t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << "  read with " << threadCount << " threads: "
+         << bytesPerThread * threadCount * passCount / seconds / (1 << 20) << " MiB/s" << endl;
+}
+
+initializer init1([]()
+{
+    const wstring fileName = L"parallel_benchmark.bin";
+    for(bool useFile : {false, true})
+    {
+        cout << (useFile ? "ParallelFile:" : "ParallelMemory:") << endl;
+        for(size_t threadCount : {1, 2, 4, 8})
+        {
+            shared_ptr<Parallel> parallel;
+            if(useFile)
+            {
+                remove(string_cast<string>(fileName).c_str());
+                parallel = make_shared<ParallelFile>(fileName);
+            }
+            else
+                parallel = make_shared<ParallelMemory>();
+            stressTest(*parallel, threadCount);
+            appendWhileHoldingTest(*parallel);
+            benchmark(*parallel, threadCount);
+        }
+    }
+    remove(string_cast<string>(fileName).c_str());
+    exit(0);
+});
+}
+}
+}
+}
+#endif
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "stream/prefetch_reader.h"
+#include "stream/worker_pool.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+constexpr size_t PrefetchReader::defaultDepth;
+constexpr size_t PrefetchReader::defaultBlockSize;
+
+struct PrefetchReader::State final
+{
+    struct Block final
+    {
+        vector<uint8_t> data;
+        int64_t offset;
+    };
+    mutex lock;
+    condition_variable cond;
+    const shared_ptr<Reader> source;
+    const size_t depth, blockSize;
+    deque<Block> blocks;
+    /// buffers of blocks that have been read, to reuse for new blocks
+    vector<vector<uint8_t>> freeBuffers;
+    /// how many blocks to read ahead; doubles up to depth as blocks are read
+    size_t targetDepth = 1;
+    /// the position of the next block in source or -1 if it isn't known
+    int64_t nextOffset;
+    exception_ptr error;
+    bool gotEOF = false;
+    bool jobRunning = false;
+    /// set to stop the job after the block that it's reading
+    bool paused = false;
+    State(shared_ptr<Reader> source, size_t depth, size_t blockSize, int64_t nextOffset)
+        : lock(),
+          cond(),
+          source(std::move(source)),
+          depth(depth),
+          blockSize(blockSize),
+          blocks(),
+          freeBuffers(),
+          nextOffset(nextOffset),
+          error()
+    {
+    }
+    bool needsBlock() const
+    {
+        return !paused && !gotEOF && !error && blocks.size() < targetDepth;
+    }
+    /// read blocks until there are targetDepth of them
+    void run(unique_lock<mutex> &lockIt)
+    {
+        while(needsBlock())
+        {
+            Block newBlock;
+            if(!freeBuffers.empty())
+            {
+                newBlock.data = std::move(freeBuffers.back());
+                freeBuffers.pop_back();
+            }
+            newBlock.offset = nextOffset;
+            lockIt.unlock();
+            exception_ptr readError;
+            size_t readCount = 0;
+            bool readEOF = false;
+            try
+            {
+                newBlock.data.resize(blockSize);
+                // readers like RWOpsReader can return less than asked for before the end, so only
+                // a read that returns nothing is the end
+                while(readCount < blockSize)
+                {
+                    size_t count =
+                        source->readBytes(newBlock.data.data() + readCount, blockSize - readCount);
+                    if(count == 0)
+                    {
+                        readEOF = true;
+                        break;
+                    }
+                    readCount += count;
+                }
+            }
+            catch(...)
+            {
+                readError = current_exception();
+            }
+            newBlock.data.resize(readCount);
+            lockIt.lock();
+            // keep what was read before an error; the error is thrown after it's read
+            if(readCount > 0)
+            {
+                if(nextOffset >= 0)
+                    nextOffset += readCount;
+                blocks.push_back(std::move(newBlock));
+            }
+            if(readError)
+                error = readError;
+            else if(readEOF)
+                gotEOF = true;
+            cond.notify_all();
+        }
+        jobRunning = false;
+        cond.notify_all();
+    }
+    static void startJob(const shared_ptr<State> &state)
+    {
+        if(state->jobRunning || !state->needsBlock())
+            return;
+        state->jobRunning = true;
+        // the job keeps state and the underlying reader alive if this PrefetchReader is destroyed
+        WorkerPool::io().submit([state]()
+                                {
+                                    unique_lock<mutex> lockIt(state->lock);
+                                    state->run(lockIt);
+                                });
+    }
+    /// stop the job so that source can be used on this thread
+    void pause(unique_lock<mutex> &lockIt)
+    {
+        paused = true;
+        while(jobRunning)
+            cond.wait(lockIt);
+    }
+};
+
+PrefetchReader::PrefetchReader(shared_ptr<Reader> preader, size_t depth, size_t blockSize)
+    : state(), block(), blockOffset(-1)
+{
+    assert(preader != nullptr && depth > 0 && blockSize > 0);
+    try
+    {
+        blockOffset = preader->tell();
+    }
+    catch(IOException &)
+    {
+    }
+    state = make_shared<State>(std::move(preader), depth, blockSize, blockOffset);
+    unique_lock<mutex> lockIt(state->lock);
+    State::startJob(state);
+}
+
+PrefetchReader::~PrefetchReader()
+{
+    unique_lock<mutex> lockIt(state->lock);
+    state->paused = true;
+}
+
+shared_ptr<Reader> PrefetchReader::wrap(shared_ptr<Reader> preader, size_t depth)
+{
+    if(dynamic_cast<MemoryReader *>(preader.get()) != nullptr
+       || dynamic_cast<PrefetchReader *>(preader.get()) != nullptr)
+        return preader;
+    return make_shared<PrefetchReader>(std::move(preader), depth);
+}
+
+bool PrefetchReader::dataAvailable()
+{
+    if(blockPosition < block.size())
+        return true;
+    unique_lock<mutex> lockIt(state->lock);
+    return !state->blocks.empty();
+}
+
+bool PrefetchReader::readBlock(bool wait)
+{
+    unique_lock<mutex> lockIt(state->lock);
+    if(state->blocks.empty())
+    {
+        if(!wait || state->gotEOF || state->error)
+        {
+            if(wait && state->error)
+                rethrow_exception(state->error);
+            return false;
+        }
+        missCount++;
+        State::startJob(state);
+        while(state->blocks.empty() && !state->gotEOF && !state->error)
+            state->cond.wait(lockIt);
+        if(state->blocks.empty())
+        {
+            if(state->error)
+                rethrow_exception(state->error);
+            return false;
+        }
+    }
+    else
+        hitCount++;
+    if(block.capacity() > 0)
+        state->freeBuffers.push_back(std::move(block));
+    block = std::move(state->blocks.front().data);
+    blockOffset = state->blocks.front().offset;
+    blockPosition = 0;
+    state->blocks.pop_front();
+    state->targetDepth = min(state->depth, state->targetDepth * 2);
+    State::startJob(state);
+    return true;
+}
+
+void PrefetchReader::seek(int64_t offset, SeekPosition seekPosition)
+{
+    if(seekPosition == SeekPosition::Current)
+    {
+        // the underlying reader is ahead of this by the prefetched data
+        offset += tell();
+        seekPosition = SeekPosition::Start;
+    }
+    unique_lock<mutex> lockIt(state->lock);
+    state->pause(lockIt);
+    for(State::Block &droppedBlock : state->blocks)
+        state->freeBuffers.push_back(std::move(droppedBlock.data));
+    state->blocks.clear();
+    state->error = nullptr;
+    state->gotEOF = false;
+    state->targetDepth = 1;
+    block.clear();
+    blockPosition = 0;
+    blockOffset = -1;
+    lockIt.unlock();
+    // the job is stopped, so the underlying reader can be used here
+    int64_t newOffset = -1;
+    exception_ptr seekError;
+    try
+    {
+        state->source->seek(offset, seekPosition);
+        try
+        {
+            newOffset = state->source->tell();
+        }
+        catch(IOException &)
+        {
+        }
+    }
+    catch(...)
+    {
+        seekError = current_exception();
+    }
+    lockIt.lock();
+    state->nextOffset = newOffset;
+    blockOffset = newOffset;
+    state->paused = false;
+    State::startJob(state);
+    if(seekError)
+        rethrow_exception(seekError);
+}
+}
+}
+}
+
+#if 0
+#include "util/util.h"
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+/// a file on slow storage : every read waits before returning the data
+class SlowReader final : public stream::Reader
+{
+private:
+    shared_ptr<const vector<uint8_t>> data;
+    size_t position = 0;
+
+public:
+    explicit SlowReader(shared_ptr<const vector<uint8_t>> data) : data(std::move(data))
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        uint8_t retval;
+        if(readBytes(&retval, 1) == 0)
+            throw stream::EOFException();
+        return retval;
+    }
+    virtual size_t readBytes(uint8_t *array, size_t maxCount) override
+    {
+        this_thread::sleep_for(chrono::milliseconds(2));
+        size_t count = min(maxCount, data->size() - position);
+        memcpy(array, data->data() + position, count);
+        position += count;
+        return count;
+    }
+};
+
+initializer init1([]()
+{
+    auto data = make_shared<vector<uint8_t>>(1 << 24);
+    for(size_t i = 0; i < data->size(); i++)
+        (*data)[i] = static_cast<uint8_t>(i * 2654435761U >> 24);
+    for(bool prefetch : {false, true})
+    {
+        auto startTime = chrono::steady_clock::now();
+        shared_ptr<stream::Reader> reader = make_shared<SlowReader>(data);
+        if(prefetch)
+            reader = make_shared<stream::PrefetchReader>(reader);
+        // work on each chunk like a decoder does, taking a little longer than reading it
+        uint8_t buffer[1 << 16];
+        uint64_t hash = 0;
+        for(;;)
+        {
+            size_t count = reader->readBytes(buffer, sizeof(buffer));
+            if(count == 0)
+                break;
+            for(int pass = 0; pass < 24; pass++)
+                for(size_t i = 0; i < count; i++)
+                    hash = (hash ^ buffer[i]) * 0x100000001B3ULL;
+        }
+        double time = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        cout << (prefetch ? "prefetch: " : "direct: ") << time * 1000 << " ms";
+        if(prefetch)
+        {
+            auto &prefetchReader = dynamic_cast<stream::PrefetchReader &>(*reader);
+            cout << " (" << prefetchReader.getHitCount() << " hits, "
+                 << prefetchReader.getMissCount() << " misses)";
+        }
+        cout << " hash " << hash << endl;
+    }
+    exit(0);
+});
+}
+}
+}
+#endif
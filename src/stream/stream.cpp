@@ -50,10 +50,21 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <chrono>
 #include <cstdlib>
 #include "util/util.h"
 #include <stdio.h>
 #include <sys/types.h>
+#if !defined(_WIN64) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 using namespace std;
 
@@ -137,6 +148,17 @@ public:
     {
         return pipe->readerPosition < pipe->bufferSizes[pipe->readerBufferIndex];
     }
+    virtual const uint8_t *peek(size_t &size) override
+    {
+        // the writer doesn't touch the reader's buffer, so this doesn't need the lock
+        size = pipe->bufferSizes[pipe->readerBufferIndex] - pipe->readerPosition;
+        return &pipe->buffers[pipe->readerBufferIndex][pipe->readerPosition];
+    }
+    virtual void commit(size_t count) override
+    {
+        assert(count <= pipe->bufferSizes[pipe->readerBufferIndex] - pipe->readerPosition);
+        pipe->readerPosition += count;
+    }
 };
 
 class PipeWriter final : public Writer
@@ -157,7 +179,8 @@ public:
         pipe->lock.unlock();
     }
 
-    virtual void writeByte(uint8_t v) override
+    /// wait until the writer's buffer has space
+    void waitForSpace()
     {
         while(!pipe->canWrite || pipe->bufferSizes[pipe->writerBufferIndex()] >= bufferSize)
         {
@@ -179,10 +202,29 @@ public:
             else
                 flush();
         }
+    }
+
+    virtual void writeByte(uint8_t v) override
+    {
+        waitForSpace();
         pipe->buffers[pipe->writerBufferIndex()][pipe->bufferSizes[pipe->writerBufferIndex()]++] =
             v;
     }
 
+    virtual void writeBytes(const uint8_t *array, size_t count) override
+    {
+        while(count > 0)
+        {
+            waitForSpace();
+            size_t &size = pipe->bufferSizes[pipe->writerBufferIndex()];
+            size_t currentCount = std::min(count, bufferSize - size);
+            memcpy(&pipe->buffers[pipe->writerBufferIndex()][size], array, currentCount);
+            size += currentCount;
+            array += currentCount;
+            count -= currentCount;
+        }
+    }
+
     virtual void flush() override
     {
         if(!pipe->canWrite)
@@ -206,13 +248,311 @@ public:
         return pipe->bufferSizes[pipe->writerBufferIndex()] < bufferSize && pipe->canWrite;
     }
 };
+
+/** lets one thread sleep until another thread notifies it, without any syscalls when
+ * nobody is waiting
+ *
+ * A waiter calls prepareWait, checks its condition again, then calls either cancelWait or
+ * wait. Uses a futex on linux.
+ */
+class WaitEvent final
+{
+    WaitEvent(const WaitEvent &) = delete;
+    WaitEvent &operator=(const WaitEvent &) = delete;
+
+private:
+    atomic<uint32_t> sequence;
+    atomic_bool waiting;
+#ifndef __linux
+    mutex lock;
+    condition_variable cond;
+#endif
+
+public:
+    WaitEvent() : sequence(0), waiting(false)
+    {
+    }
+    uint32_t prepareWait()
+    {
+        uint32_t retval = sequence.load();
+        waiting.store(true);
+        return retval;
+    }
+    void cancelWait()
+    {
+        waiting.store(false);
+    }
+    void wait(uint32_t sequenceFromPrepareWait)
+    {
+#ifdef __linux
+        static_assert(sizeof(atomic<uint32_t>) == sizeof(int), "can't use futex");
+        // the sequence changing before we sleep just makes the syscall return immediately
+        syscall(SYS_futex,
+                reinterpret_cast<int *>(&sequence),
+                FUTEX_WAIT_PRIVATE,
+                static_cast<int>(sequenceFromPrepareWait),
+                nullptr,
+                nullptr,
+                0);
+#else
+        unique_lock<mutex> lockIt(lock);
+        while(sequence.load() == sequenceFromPrepareWait)
+            cond.wait(lockIt);
+#endif
+        waiting.store(false);
+    }
+    void notify()
+    {
+        if(!waiting.load())
+            return;
+#ifdef __linux
+        sequence.fetch_add(1);
+        syscall(SYS_futex,
+                reinterpret_cast<int *>(&sequence),
+                FUTEX_WAKE_PRIVATE,
+                1,
+                nullptr,
+                nullptr,
+                0);
+#else
+        unique_lock<mutex> lockIt(lock);
+        sequence.fetch_add(1);
+        cond.notify_all();
+#endif
+    }
+};
+
+struct RingPipe final
+{
+    static constexpr size_t ringSize = 1 << 18; // must be a power of 2
+    static constexpr size_t ringMask = ringSize - 1;
+    /// publish the read or write position after this many bytes, so the other side can proceed
+    static constexpr size_t publishInterval = ringSize / 8;
+    /// how many times to check the other side before sleeping
+    static constexpr size_t spinCount = 256;
+    static constexpr size_t cacheLineSize = 64;
+    unique_ptr<uint8_t[]> ring;
+    // the head and tail are on separate cache lines so the reader and writer don't fight over
+    // them
+    char padding0[cacheLineSize];
+    atomic_size_t head; // written by the writer: the total number of bytes written
+    char padding1[cacheLineSize - sizeof(atomic_size_t)];
+    atomic_size_t tail; // written by the reader: the total number of bytes read
+    char padding2[cacheLineSize - sizeof(atomic_size_t)];
+    atomic_bool closed;
+    WaitEvent dataWritten, dataRead;
+    RingPipe() : ring(new uint8_t[ringSize]), head(0), tail(0), closed(false)
+    {
+    }
+    void close()
+    {
+        closed.store(true);
+        dataWritten.notify();
+        dataRead.notify();
+    }
+};
+
+constexpr size_t RingPipe::ringSize;
+constexpr size_t RingPipe::ringMask;
+constexpr size_t RingPipe::publishInterval;
+constexpr size_t RingPipe::spinCount;
+
+class RingPipeReader final : public Reader
+{
+private:
+    shared_ptr<RingPipe> pipe;
+    size_t readPosition = 0, publishedReadPosition = 0, writePosition = 0;
+    void publishReadPosition()
+    {
+        if(readPosition == publishedReadPosition)
+            return;
+        publishedReadPosition = readPosition;
+        pipe->tail.store(readPosition);
+        pipe->dataRead.notify();
+    }
+    void waitForData()
+    {
+        publishReadPosition();
+        for(;;)
+        {
+            for(size_t i = 0; i < RingPipe::spinCount; i++)
+            {
+                writePosition = pipe->head.load(memory_order_acquire);
+                if(writePosition != readPosition)
+                    return;
+            }
+            uint32_t sequence = pipe->dataWritten.prepareWait();
+            // check closed first so we see everything written before the writer closed
+            bool closed = pipe->closed.load();
+            writePosition = pipe->head.load();
+            if(writePosition != readPosition)
+            {
+                pipe->dataWritten.cancelWait();
+                return;
+            }
+            if(closed)
+            {
+                pipe->dataWritten.cancelWait();
+                throw EOFException();
+            }
+            pipe->dataWritten.wait(sequence);
+        }
+    }
+
+public:
+    explicit RingPipeReader(shared_ptr<RingPipe> pipe) : pipe(std::move(pipe))
+    {
+    }
+    virtual ~RingPipeReader()
+    {
+        pipe->close();
+    }
+    virtual uint8_t readByte() override
+    {
+        if(readPosition == writePosition)
+            waitForData();
+        uint8_t retval = pipe->ring[readPosition & RingPipe::ringMask];
+        commit(1);
+        return retval;
+    }
+    virtual bool dataAvailable() override
+    {
+        if(readPosition == writePosition)
+            writePosition = pipe->head.load(memory_order_acquire);
+        return readPosition != writePosition;
+    }
+    virtual const uint8_t *peek(size_t &size) override
+    {
+        dataAvailable();
+        size_t offset = readPosition & RingPipe::ringMask;
+        size = std::min(writePosition - readPosition, RingPipe::ringSize - offset);
+        return &pipe->ring[offset];
+    }
+    virtual void commit(size_t count) override
+    {
+        assert(count <= writePosition - readPosition);
+        readPosition += count;
+        if(readPosition - publishedReadPosition >= RingPipe::publishInterval)
+            publishReadPosition();
+    }
+};
+
+class RingPipeWriter final : public Writer
+{
+private:
+    shared_ptr<RingPipe> pipe;
+    size_t writePosition = 0, publishedWritePosition = 0, readPosition = 0;
+    void publishWritePosition()
+    {
+        if(writePosition == publishedWritePosition)
+            return;
+        publishedWritePosition = writePosition;
+        pipe->head.store(writePosition);
+        pipe->dataWritten.notify();
+    }
+    size_t freeSpace() const
+    {
+        return RingPipe::ringSize - (writePosition - readPosition);
+    }
+    void waitForSpace()
+    {
+        publishWritePosition();
+        for(;;)
+        {
+            for(size_t i = 0; i < RingPipe::spinCount; i++)
+            {
+                readPosition = pipe->tail.load(memory_order_acquire);
+                if(freeSpace() > 0)
+                    return;
+            }
+            uint32_t sequence = pipe->dataRead.prepareWait();
+            if(pipe->closed.load())
+            {
+                pipe->dataRead.cancelWait();
+                throw IOException("can't write to closed pipe");
+            }
+            readPosition = pipe->tail.load();
+            if(freeSpace() > 0)
+            {
+                pipe->dataRead.cancelWait();
+                return;
+            }
+            pipe->dataRead.wait(sequence);
+        }
+    }
+    void wrote(size_t count)
+    {
+        writePosition += count;
+        if(writePosition - publishedWritePosition >= RingPipe::publishInterval)
+            publishWritePosition();
+    }
+
+public:
+    explicit RingPipeWriter(shared_ptr<RingPipe> pipe) : pipe(std::move(pipe))
+    {
+    }
+    virtual ~RingPipeWriter()
+    {
+        publishWritePosition();
+        pipe->close();
+    }
+    virtual void writeByte(uint8_t v) override
+    {
+        if(freeSpace() == 0)
+            waitForSpace();
+        pipe->ring[writePosition & RingPipe::ringMask] = v;
+        wrote(1);
+    }
+    virtual void writeBytes(const uint8_t *array, size_t count) override
+    {
+        while(count > 0)
+        {
+            if(freeSpace() == 0)
+                waitForSpace();
+            size_t offset = writePosition & RingPipe::ringMask;
+            size_t currentCount =
+                std::min(std::min(count, freeSpace()), RingPipe::ringSize - offset);
+            memcpy(&pipe->ring[offset], array, currentCount);
+            wrote(currentCount);
+            array += currentCount;
+            count -= currentCount;
+        }
+    }
+    virtual void flush() override
+    {
+        if(pipe->closed.load())
+            throw IOException("can't write to closed pipe");
+        publishWritePosition();
+    }
+    virtual bool writeWaits() override
+    {
+        if(freeSpace() == 0)
+            readPosition = pipe->tail.load(memory_order_acquire);
+        return freeSpace() == 0;
+    }
+};
 }
 
-StreamPipe::StreamPipe() : readerInternal(), writerInternal()
+StreamPipe::StreamPipe(StreamPipeMode mode) : readerInternal(), writerInternal()
 {
-    shared_ptr<Pipe> pipe = make_shared<Pipe>();
-    readerInternal = shared_ptr<Reader>(new PipeReader(pipe));
-    writerInternal = shared_ptr<Writer>(new PipeWriter(pipe));
+    switch(mode)
+    {
+    case StreamPipeMode::Locked:
+    {
+        shared_ptr<Pipe> pipe = make_shared<Pipe>();
+        readerInternal = shared_ptr<Reader>(new PipeReader(pipe));
+        writerInternal = shared_ptr<Writer>(new PipeWriter(pipe));
+        return;
+    }
+    case StreamPipeMode::SingleProducerSingleConsumer:
+    {
+        shared_ptr<RingPipe> pipe = make_shared<RingPipe>();
+        readerInternal = shared_ptr<Reader>(new RingPipeReader(pipe));
+        writerInternal = shared_ptr<Writer>(new RingPipeWriter(pipe));
+        return;
+    }
+    }
+    UNREACHABLE();
 }
 
 uint8_t DumpingReader::readByte()
@@ -281,6 +621,54 @@ std::size_t FileReader::readBytes(std::uint8_t *array, std::size_t maxCount)
     return retval;
 }
 
+std::shared_ptr<MmapReader> MmapReader::open(std::wstring fileName, AccessPattern accessPattern)
+{
+#if defined(_WIN64) || defined(_WIN32)
+    static_cast<void>(fileName);
+    static_cast<void>(accessPattern);
+    return nullptr;
+#else
+    std::string str = string_cast<std::string>(std::move(fileName));
+    int fd = ::open(str.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return nullptr;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+       || static_cast<std::uint64_t>(st.st_size) > static_cast<std::size_t>(-1))
+    {
+        close(fd);
+        return nullptr;
+    }
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    if(size == 0) // can't map an empty file
+    {
+        close(fd);
+        return std::shared_ptr<MmapReader>(new MmapReader(nullptr, 0));
+    }
+    void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
+        return nullptr;
+    switch(accessPattern)
+    {
+    case AccessPattern::Sequential:
+        madvise(memory, size, MADV_SEQUENTIAL);
+        break;
+    case AccessPattern::Random:
+        madvise(memory, size, MADV_RANDOM);
+        break;
+    case AccessPattern::Normal:
+        break;
+    }
+    std::shared_ptr<const std::uint8_t> mem(static_cast<const std::uint8_t *>(memory),
+                                            [size](const std::uint8_t *memory)
+                                            {
+                                                munmap(const_cast<std::uint8_t *>(memory), size);
+                                            });
+    return std::shared_ptr<MmapReader>(new MmapReader(std::move(mem), size));
+#endif
+}
+
 FILE *FileWriter::openFile(std::wstring fileName, bool forReadToo)
 {
     std::string str = string_cast<std::string>(std::move(fileName));
@@ -333,6 +721,123 @@ void FileWriter::seek(std::int64_t offset, SeekPosition seekPosition)
         IOException::throwErrorFromErrno("fseek");
 }
 
+#if 0
+namespace
+{
+// throughput benchmark for each stream type, for bulk and typed reads and writes
+constexpr size_t benchmarkByteCount = 64 << 20;
+constexpr size_t benchmarkChunkSize = 1 << 16;
+
+template <typename Fn>
+void reportThroughput(const char *name, Fn fn)
+{
+    auto startTime = chrono::steady_clock::now();
+    fn();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << name << ": " << benchmarkByteCount / seconds / (1 << 20) << " MiB/s" << endl;
+}
+
+void writeBenchmark(Writer &writer, bool typed)
+{
+    if(typed)
+    {
+        for(size_t i = 0; i < benchmarkByteCount / sizeof(uint32_t); i++)
+            writer.writeU32(static_cast<uint32_t>(i));
+    }
+    else
+    {
+        vector<uint8_t> chunk(benchmarkChunkSize, 0x5A);
+        for(size_t i = 0; i < benchmarkByteCount; i += benchmarkChunkSize)
+            writer.writeBytes(chunk.data(), chunk.size());
+    }
+    writer.flush();
+}
+
+void readBenchmark(Reader &reader, bool typed)
+{
+    if(typed)
+    {
+        for(size_t i = 0; i < benchmarkByteCount / sizeof(uint32_t); i++)
+        {
+            if(reader.readU32() != static_cast<uint32_t>(i))
+                throw IOException("benchmark read the wrong value");
+        }
+    }
+    else
+    {
+        vector<uint8_t> chunk(benchmarkChunkSize);
+        for(size_t i = 0; i < benchmarkByteCount; i += benchmarkChunkSize)
+            reader.readAllBytes(chunk.data(), chunk.size());
+    }
+}
+
+initializer init1([]()
+{
+    const wstring fileName = L"stream_benchmark.bin";
+    for(bool typed : {false, true})
+    {
+        cout << (typed ? "typed (U32):" : "bulk:") << endl;
+        auto memoryWriter = make_shared<MemoryWriter>(benchmarkByteCount);
+        reportThroughput("  MemoryWriter",
+                         [&]()
+                         {
+                             writeBenchmark(*memoryWriter, typed);
+                         });
+        MemoryReader memoryReader(std::move(*memoryWriter).getBuffer());
+        memoryWriter = nullptr;
+        reportThroughput("  MemoryReader",
+                         [&]()
+                         {
+                             readBenchmark(memoryReader, typed);
+                         });
+        reportThroughput("  FileWriter",
+                         [&]()
+                         {
+                             FileWriter writer(fileName);
+                             writeBenchmark(writer, typed);
+                         });
+        reportThroughput("  FileReader",
+                         [&]()
+                         {
+                             FileReader reader(fileName);
+                             readBenchmark(reader, typed);
+                         });
+        reportThroughput("  BufferedWriter",
+                         [&]()
+                         {
+                             BufferedWriter<> writer(make_shared<FileWriter>(fileName));
+                             writeBenchmark(writer, typed);
+                         });
+        reportThroughput("  BufferedReader",
+                         [&]()
+                         {
+                             BufferedReader<> reader(make_shared<FileReader>(fileName));
+                             readBenchmark(reader, typed);
+                         });
+        for(StreamPipeMode mode :
+            {StreamPipeMode::Locked, StreamPipeMode::SingleProducerSingleConsumer})
+        {
+            reportThroughput(mode == StreamPipeMode::Locked ? "  StreamPipe (Locked)" :
+                                                              "  StreamPipe (SPSC)",
+                             [&]()
+                             {
+                                 StreamPipe pipe(mode);
+                                 shared_ptr<Writer> pwriter = pipe.pwriter();
+                                 thread writerThread([pwriter, typed]()
+                                                     {
+                                                         writeBenchmark(*pwriter, typed);
+                                                     });
+                                 readBenchmark(pipe.reader(), typed);
+                                 writerThread.join();
+                             });
+        }
+    }
+    remove(string_cast<string>(fileName).c_str());
+    exit(0);
+});
+}
+#endif
+
 #if 0
 namespace
 {
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "stream/worker_pool.h"
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace stream
+{
+WorkerPool::WorkerPool(size_t threadCount)
+    : lock(), cond(), jobs(), threadCount(threadCount)
+{
+    for(size_t i = 0; i < threadCount; i++)
+    {
+        thread([this]()
+               {
+                   threadFn();
+               }).detach();
+    }
+}
+
+void WorkerPool::threadFn()
+{
+    unique_lock<mutex> lockIt(lock);
+    for(;;)
+    {
+        while(jobs.empty())
+            cond.wait(lockIt);
+        function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        lockIt.unlock();
+        job();
+        job = nullptr;
+        lockIt.lock();
+    }
+}
+
+WorkerPool &WorkerPool::compute()
+{
+    static WorkerPool *pool = new WorkerPool(max<size_t>(1, thread::hardware_concurrency()));
+    return *pool;
+}
+
+WorkerPool &WorkerPool::io()
+{
+    static WorkerPool *pool = new WorkerPool(4);
+    return *pool;
+}
+
+void WorkerPool::submit(function<void()> job)
+{
+    {
+        unique_lock<mutex> lockIt(lock);
+        jobs.push_back(std::move(job));
+    }
+    cond.notify_one();
+}
+}
+}
+}
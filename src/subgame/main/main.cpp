@@ -34,7 +34,7 @@ namespace main
 {
 MainGame::MainGame(std::shared_ptr<GameState> gameState, ui::GameUi *gameUi)
     : Subgame(std::move(gameState), gameUi, false, RGBF(0.75, 0.75, 0.75)),
-      backgroundMusic(std::make_shared<Audio>(L"main.ogg", true)),
+      backgroundMusic(std::make_shared<Audio>(getBackgroundMusicName(), true)),
       doorOpenSound(std::make_shared<Audio>(L"door_open.ogg")),
       door(std::make_shared<Door>()),
       instructionsLabel(std::make_shared<ui::Label>(
@@ -45,6 +45,8 @@ MainGame::MainGame(std::shared_ptr<GameState> gameState, ui::GameUi *gameUi)
           0.05f,
           RGBF(1, 0, 0)))
 {
+    // the music restarts when the player returns from another subgame
+    backgroundMusic->prefetch();
     addMachine(door);
     auto toggleSwitch1 = std::make_shared<ToggleSwitch>(0.6f, -0.3f);
     addMachine(toggleSwitch1);
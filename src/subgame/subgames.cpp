@@ -20,6 +20,7 @@
  */
 #include "subgame/subgames.h"
 #include "subgame/main/main.h"
+#include "platform/track_prefetcher.h"
 
 namespace programmerjake
 {
@@ -31,6 +32,11 @@ std::shared_ptr<Subgame> makeMainSubgame(std::shared_ptr<GameState> gameState, u
 {
     return std::make_shared<main::MainGame>(std::move(gameState), gameUi);
 }
+
+void prefetchMainSubgame()
+{
+    TrackPrefetcher::get().prefetch(main::MainGame::getBackgroundMusicName());
+}
 }
 }
 }
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "texture/decoded_texture_cache.h"
+#include "texture/mipmap.h"
+#include "decoder/png_decoder.h"
+#include "platform/platform.h"
+#include "stream/prefetch_reader.h"
+#include "util/logging.h"
+#include "util/string_cast.h"
+#include <atomic>
+#include <cstdio>
+#include <cwctype>
+#include <vector>
+#if _WIN64 || _WIN32
+#include <process.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+constexpr uint32_t cacheFileMagic = 0x47505443; // "GPTC"
+
+struct CacheLevel final
+{
+    uint64_t offset;
+    uint32_t w, h;
+};
+
+struct CacheHeader final
+{
+    uint64_t sourceKey;
+    uint64_t sourceSize;
+    vector<CacheLevel> levels;
+};
+
+vector<uint8_t> readAll(stream::Reader &reader)
+{
+    constexpr size_t chunkSize = 1 << 16;
+    vector<uint8_t> retval;
+    for(;;)
+    {
+        size_t oldSize = retval.size();
+        retval.resize(oldSize + chunkSize);
+        size_t readCount = reader.readBytes(&retval[oldSize], chunkSize);
+        retval.resize(oldSize + readCount);
+        if(readCount == 0)
+            return retval;
+    }
+}
+
+uint64_t hashBytes(const uint8_t *bytes, size_t size) // FNV-1a
+{
+    uint64_t retval = 0xCBF29CE484222325ULL;
+    for(size_t i = 0; i < size; i++)
+    {
+        retval ^= bytes[i];
+        retval *= 0x100000001B3ULL;
+    }
+    return retval;
+}
+
+/** map a cache file into memory
+ * @return the mapped memory or nullptr if the file can't be mapped
+ * @note the mapping is private so modifying it doesn't modify the file
+ */
+shared_ptr<uint8_t> mapFile(const wstring &fileName, size_t &size)
+{
+#if _WIN64 || _WIN32
+    try
+    {
+        stream::FileReader reader(fileName);
+        reader.seek(0, stream::SeekPosition::End);
+        int64_t fileSize = reader.tell();
+        reader.seek(0, stream::SeekPosition::Start);
+        if(fileSize <= 0)
+            return nullptr;
+        size = static_cast<size_t>(fileSize);
+        shared_ptr<uint8_t> retval(new uint8_t[size],
+                                   [](uint8_t *memory)
+                                   {
+                                       delete[] memory;
+                                   });
+        reader.readAllBytes(retval.get(), size);
+        return retval;
+    }
+    catch(stream::IOException &)
+    {
+        return nullptr;
+    }
+#else
+    string str = string_cast<string>(fileName);
+    int fd = open(str.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return nullptr;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    size = static_cast<size_t>(st.st_size);
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
+        return nullptr;
+    size_t mappedSize = size;
+    return shared_ptr<uint8_t>(static_cast<uint8_t *>(memory),
+                               [mappedSize](uint8_t *memory)
+                               {
+                                   munmap(static_cast<void *>(memory), mappedSize);
+                               });
+#endif
+}
+
+bool readHeader(const shared_ptr<uint8_t> &file, size_t fileSize, CacheHeader &header)
+{
+    if(fileSize < DecodedTextureCache::headerSize)
+        return false;
+    try
+    {
+        stream::MemoryReader reader(shared_ptr<const uint8_t>(file, file.get()),
+                                    DecodedTextureCache::headerSize);
+        if(stream::read<uint32_t>(reader) != cacheFileMagic)
+            return false;
+        if(stream::read<uint32_t>(reader) != DecodedTextureCache::formatVersion)
+            return false;
+        header.sourceKey = stream::read<uint64_t>(reader);
+        header.sourceSize = stream::read<uint64_t>(reader);
+        uint32_t levelCount = stream::read<uint32_t>(reader);
+        if(levelCount == 0)
+            return false;
+        header.levels.clear();
+        for(uint32_t i = 0; i < levelCount; i++)
+        {
+            CacheLevel level;
+            level.offset = stream::read<uint64_t>(reader);
+            level.w = stream::read<uint32_t>(reader);
+            level.h = stream::read<uint32_t>(reader);
+            uint64_t levelSize =
+                static_cast<uint64_t>(level.w) * level.h * Image::BytesPerPixel;
+            if(level.w == 0 || level.h == 0 || level.offset < DecodedTextureCache::headerSize
+               || level.offset > fileSize || levelSize > fileSize - level.offset)
+                return false;
+            header.levels.push_back(level);
+        }
+    }
+    catch(stream::IOException &)
+    {
+        return false;
+    }
+    return true;
+}
+
+/// a name for a new cache file that no other thread or process is writing
+wstring makeTempFileName(const wstring &fileName)
+{
+    static atomic<unsigned long> nextTempFileIndex(0);
+#if _WIN64 || _WIN32
+    unsigned long processId = _getpid();
+#else
+    unsigned long processId = getpid();
+#endif
+    return fileName + L"." + to_wstring(processId) + L"." + to_wstring(nextTempFileIndex++)
+           + L".tmp";
+}
+
+void writeCacheFile(const wstring &fileName,
+                    uint64_t sourceKey,
+                    uint64_t sourceSize,
+                    const uint8_t *pixels,
+                    unsigned w,
+                    unsigned h,
+                    const vector<Image::MipLevel> &mipLevels)
+{
+    stream::MemoryWriter headerWriter(DecodedTextureCache::headerSize);
+    stream::write<uint32_t>(headerWriter, cacheFileMagic);
+    stream::write<uint32_t>(headerWriter, DecodedTextureCache::formatVersion);
+    stream::write<uint64_t>(headerWriter, sourceKey);
+    stream::write<uint64_t>(headerWriter, sourceSize);
+    stream::write<uint32_t>(headerWriter, 1 + mipLevels.size());
+    uint64_t offset = DecodedTextureCache::headerSize;
+    stream::write<uint64_t>(headerWriter, offset);
+    stream::write<uint32_t>(headerWriter, w);
+    stream::write<uint32_t>(headerWriter, h);
+    offset += static_cast<uint64_t>(w) * h * Image::BytesPerPixel;
+    for(const Image::MipLevel &mipLevel : mipLevels)
+    {
+        stream::write<uint64_t>(headerWriter, offset);
+        stream::write<uint32_t>(headerWriter, mipLevel.w);
+        stream::write<uint32_t>(headerWriter, mipLevel.h);
+        offset += static_cast<uint64_t>(mipLevel.w) * mipLevel.h * Image::BytesPerPixel;
+    }
+    vector<uint8_t> header = std::move(headerWriter).getBuffer();
+    if(header.size() > DecodedTextureCache::headerSize)
+        throw stream::IOException("too many mipmap levels for the decoded texture cache header");
+    header.resize(DecodedTextureCache::headerSize, 0);
+    // Images from earlier loads can still be mapping the old file, and truncating it would make
+    // their pages fault, so write a new file and rename it over the old one
+    string tempFileName = string_cast<string>(makeUserSpecificFilePath(makeTempFileName(fileName)));
+    string finalFileName = string_cast<string>(makeUserSpecificFilePath(fileName));
+    try
+    {
+        {
+            stream::FileWriter writer(string_cast<wstring>(tempFileName));
+            writer.writeBytes(header.data(), header.size());
+            writer.writeBytes(pixels, static_cast<size_t>(w) * h * Image::BytesPerPixel);
+            for(const Image::MipLevel &mipLevel : mipLevels)
+            {
+                writer.writeBytes(mipLevel.pixels.get(),
+                                  static_cast<size_t>(mipLevel.w) * mipLevel.h
+                                      * Image::BytesPerPixel);
+            }
+            writer.flush();
+        }
+#if _WIN64 || _WIN32
+        // rename doesn't replace files on windows, and mapFile doesn't map them there
+        std::remove(finalFileName.c_str());
+#endif
+        if(std::rename(tempFileName.c_str(), finalFileName.c_str()) != 0)
+            stream::IOException::throwErrorFromErrno("rename");
+    }
+    catch(...)
+    {
+        std::remove(tempFileName.c_str());
+        throw;
+    }
+}
+
+struct BottomToTopDestination final : public PngDecoder::Destination
+{
+    unsigned w = 0, h = 0;
+    shared_ptr<uint8_t> pixels;
+    virtual void setSize(unsigned w, unsigned h) override
+    {
+        this->w = w;
+        this->h = h;
+        pixels = shared_ptr<uint8_t>(new uint8_t[static_cast<size_t>(w) * h * Image::BytesPerPixel],
+                                     [](uint8_t *pixels)
+                                     {
+                                         delete[] pixels;
+                                     });
+    }
+    virtual uint8_t *getRow(unsigned y) override
+    {
+        return &pixels.get()[static_cast<size_t>(h - y - 1) * w * Image::BytesPerPixel];
+    }
+};
+}
+
+wstring DecodedTextureCache::getCacheFileName(wstring resourceName)
+{
+    // different names can sanitize to the same string, so add a hash of the original name
+    string utf8Name = string_cast<string>(resourceName);
+    uint64_t nameHash =
+        hashBytes(reinterpret_cast<const uint8_t *>(utf8Name.data()), utf8Name.size());
+    wstring hashString;
+    for(int shift = 60; shift >= 0; shift -= 4)
+        hashString += L"0123456789abcdef"[(nameHash >> shift) & 0xF];
+    for(wchar_t &ch : resourceName)
+    {
+        if(!iswalnum(ch) && ch != L'.' && ch != L'-')
+            ch = L'_';
+    }
+    return L"texture_cache_" + resourceName + L"_" + hashString + L".bin";
+}
+
+Image DecodedTextureCache::load(wstring resourceName, bool mipmapped)
+{
+    shared_ptr<stream::Reader> resourceReader = getResourceReader(resourceName);
+    // memory-mapped resources are hashed and decoded in place
+    shared_ptr<stream::MemoryReader> sourceReader =
+        dynamic_pointer_cast<stream::MemoryReader>(resourceReader);
+    if(sourceReader == nullptr)
+    {
+        shared_ptr<stream::Reader> prefetchReader = stream::PrefetchReader::wrap(resourceReader);
+        sourceReader = make_shared<stream::MemoryReader>(readAll(*prefetchReader));
+    }
+    resourceReader = nullptr;
+    size_t sourceSize;
+    const uint8_t *source = sourceReader->peek(sourceSize);
+    uint64_t sourceKey = hashBytes(source, sourceSize);
+    wstring cacheFileName = getCacheFileName(resourceName);
+    size_t cacheFileSize = 0;
+    shared_ptr<uint8_t> cacheFile = mapFile(makeUserSpecificFilePath(cacheFileName), cacheFileSize);
+    CacheHeader header;
+    if(cacheFile != nullptr && readHeader(cacheFile, cacheFileSize, header)
+       && header.sourceKey == sourceKey && header.sourceSize == sourceSize)
+    {
+        const CacheLevel &level = header.levels.front();
+        bool haveMipLevels = header.levels.size() == getMipmapLevelCount(level.w, level.h);
+        if(haveMipLevels || !mipmapped)
+        {
+            Image retval(shared_ptr<uint8_t>(cacheFile, cacheFile.get() + level.offset),
+                         level.w,
+                         level.h,
+                         Image::RowOrder::BottomToTop);
+            if(haveMipLevels)
+            {
+                for(size_t i = 1; i < header.levels.size(); i++)
+                {
+                    const CacheLevel &mipLevel = header.levels[i];
+                    retval.data->mipLevels.push_back(Image::MipLevel{
+                        shared_ptr<const uint8_t>(cacheFile, cacheFile.get() + mipLevel.offset),
+                        mipLevel.w,
+                        mipLevel.h});
+                }
+            }
+            return retval;
+        }
+    }
+    cacheFile = nullptr;
+    getDebugLog() << L"rebuilding decoded texture cache for '" << resourceName << L"'" << postnl;
+    // store the rows bottom to top so that the Image doesn't need to be flipped when it's bound
+    BottomToTopDestination destination;
+    PngDecoder::decode(*sourceReader, destination);
+    unsigned w = destination.w, h = destination.h;
+    shared_ptr<uint8_t> pixels = std::move(destination.pixels);
+    vector<Image::MipLevel> mipLevels;
+    if(mipmapped)
+        mipLevels = generateMipmaps(pixels.get(), w, h);
+    try
+    {
+        writeCacheFile(cacheFileName, sourceKey, sourceSize, pixels.get(), w, h, mipLevels);
+    }
+    catch(stream::IOException &e)
+    {
+        getDebugLog() << L"can't write decoded texture cache: "
+                      << string_cast<wstring>(e.what()) << postnl;
+    }
+    Image retval(std::move(pixels), w, h, Image::RowOrder::BottomToTop);
+    retval.data->mipLevels = std::move(mipLevels);
+    return retval;
+}
+}
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "texture/dynamic_texture_atlas.h"
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+/// pages are stored bottom to top so that binding a shared page doesn't have to flip it
+Image makePage(unsigned w, unsigned h)
+{
+    shared_ptr<uint8_t> pixels(new uint8_t[static_cast<size_t>(w) * h * Image::BytesPerPixel](),
+                               [](uint8_t *pixels)
+                               {
+                                   delete[] pixels;
+                               });
+    return Image(std::move(pixels), w, h, Image::RowOrder::BottomToTop);
+}
+}
+
+DynamicTextureAtlas::DynamicTextureAtlas(unsigned pageSize,
+                                         unsigned padding,
+                                         Image::TextureOptions textureOptions)
+    : pageSize(pageSize), padding(padding), textureOptions(textureOptions), pages(), lock()
+{
+    assert(pageSize > 2 * padding);
+}
+
+bool DynamicTextureAtlas::findPosition(const Page &page,
+                                       unsigned w,
+                                       unsigned h,
+                                       size_t &nodeIndex,
+                                       unsigned &left,
+                                       unsigned &top) const
+{
+    unsigned bestBottom = numeric_limits<unsigned>::max();
+    unsigned bestWidth = numeric_limits<unsigned>::max();
+    bool found = false;
+    const vector<SkylineNode> &skyline = page.skyline;
+    for(size_t i = 0; i < skyline.size(); i++)
+    {
+        unsigned x = skyline[i].left;
+        if(w > pageSize - x)
+            break;
+        // the rectangle rests on the highest node that it spans
+        unsigned y = 0;
+        unsigned spannedWidth = 0;
+        for(size_t j = i; spannedWidth < w; j++)
+        {
+            assert(j < skyline.size());
+            y = std::max(y, skyline[j].top);
+            spannedWidth += skyline[j].width;
+        }
+        if(h > pageSize - y)
+            continue;
+        if(y + h < bestBottom || (y + h == bestBottom && skyline[i].width < bestWidth))
+        {
+            bestBottom = y + h;
+            bestWidth = skyline[i].width;
+            nodeIndex = i;
+            left = x;
+            top = y;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void DynamicTextureAtlas::addSkylineNode(Page &page, size_t nodeIndex, SkylineNode newNode)
+{
+    vector<SkylineNode> &skyline = page.skyline;
+    skyline.insert(skyline.begin() + nodeIndex, newNode);
+    // shrink or remove the nodes that are now covered by the new node
+    unsigned right = newNode.left + newNode.width;
+    size_t i = nodeIndex + 1;
+    while(i < skyline.size() && skyline[i].left < right)
+    {
+        unsigned shrink = right - skyline[i].left;
+        if(shrink < skyline[i].width)
+        {
+            skyline[i].left += shrink;
+            skyline[i].width -= shrink;
+            break;
+        }
+        skyline.erase(skyline.begin() + i);
+    }
+    // merge neighboring nodes at the same height
+    for(i = 0; i + 1 < skyline.size();)
+    {
+        if(skyline[i].top == skyline[i + 1].top)
+        {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else
+            i++;
+    }
+}
+
+void DynamicTextureAtlas::copyImage(Image &page,
+                                    unsigned left,
+                                    unsigned top,
+                                    const Image &image) const
+{
+    Image::PixelView dest = page.mapSharedForWrite();
+    Image::ConstPixelView src = image.mapForRead();
+    unsigned w = src.width(), h = src.height();
+    for(unsigned y = 0; y < h + 2 * padding; y++)
+    {
+        unsigned srcY = y < padding ? 0 : std::min(y - padding, h - 1);
+        const uint8_t *srcRow = src.row(srcY);
+        uint8_t *destRow = dest.row(top + y) + Image::BytesPerPixel * left;
+        // extend the edges of the image into the padding
+        for(unsigned x = 0; x < padding; x++)
+        {
+            std::memcpy(destRow + Image::BytesPerPixel * x, srcRow, Image::BytesPerPixel);
+            std::memcpy(destRow + Image::BytesPerPixel * (padding + w + x),
+                        srcRow + Image::BytesPerPixel * (w - 1),
+                        Image::BytesPerPixel);
+        }
+        std::memcpy(destRow + Image::BytesPerPixel * padding, srcRow, Image::BytesPerPixel * w);
+    }
+}
+
+TextureDescriptor DynamicTextureAtlas::insert(Image image)
+{
+    assert(image);
+    unsigned w = image.width(), h = image.height();
+    unsigned paddedW = w + 2 * padding, paddedH = h + 2 * padding;
+    std::unique_lock<std::mutex> lockIt(lock);
+    for(const Page &p : pages)
+    {
+        if(p.image == image)
+        {
+            // inserting a page into this atlas: copy it first so that it isn't read from while
+            // it's written to
+            Image copy(w, h);
+            copy.copyRect(0, 0, w, h, image, 0, 0);
+            image = std::move(copy);
+            break;
+        }
+    }
+    Page *page = nullptr;
+    size_t nodeIndex = 0;
+    unsigned left = 0, top = 0;
+    if(paddedW > pageSize || paddedH > pageSize)
+    {
+        // doesn't fit on a page: give it its own page that isn't used for anything else
+        pages.push_back(Page{makePage(paddedW, paddedH), vector<SkylineNode>()});
+        page = &pages.back();
+    }
+    else
+    {
+        for(Page &p : pages)
+        {
+            if(!p.skyline.empty() && findPosition(p, paddedW, paddedH, nodeIndex, left, top))
+            {
+                page = &p;
+                break;
+            }
+        }
+        if(page == nullptr)
+        {
+            pages.push_back(Page{makePage(pageSize, pageSize),
+                                 vector<SkylineNode>{SkylineNode{0, 0, pageSize}}});
+            page = &pages.back();
+            page->image.setTextureOptions(textureOptions);
+            bool found = findPosition(*page, paddedW, paddedH, nodeIndex, left, top);
+            assert(found);
+            ignore_unused_variable_warning(found);
+        }
+        addSkylineNode(*page, nodeIndex, SkylineNode{left, top + paddedH, paddedW});
+    }
+    copyImage(page->image, left, top, image);
+    float pageW = page->image.width(), pageH = page->image.height();
+    return TextureDescriptor(page->image,
+                             (left + padding) / pageW,
+                             (left + padding + w) / pageW,
+                             1 - (top + padding + h) / pageH,
+                             1 - (top + padding) / pageH);
+}
+
+size_t DynamicTextureAtlas::pageCount()
+{
+    std::unique_lock<std::mutex> lockIt(lock);
+    return pages.size();
+}
+
+Image DynamicTextureAtlas::getPage(size_t index)
+{
+    std::unique_lock<std::mutex> lockIt(lock);
+    return pages.at(index).image;
+}
+
+DynamicTextureAtlas &DynamicTextureAtlas::get()
+{
+    static DynamicTextureAtlas retval;
+    return retval;
+}
+}
+}
+
+#if 0
+#include "util/util.h"
+#include <iostream>
+#include <cstdlib>
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+initializer init1([]()
+{
+    DynamicTextureAtlas atlas(256);
+    unsigned sizes[] = {16, 40, 7, 100, 64, 3, 250, 300, 31};
+    for(int i = 0; i < 40; i++)
+    {
+        unsigned size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        Image image(size, size / 2 + 1);
+        image.setPixel(0, 0, RGBAI(i, 0xFF, 0, 0xFF));
+        TextureDescriptor td = atlas.insert(image);
+        cout << size << ": page " << td.image.width() << " (" << td.minU << ", " << td.minV
+             << ") - (" << td.maxU << ", " << td.maxV << ")" << endl;
+    }
+    cout << atlas.pageCount() << " pages" << endl;
+    exit(0);
+});
+}
+}
+}
+#endif
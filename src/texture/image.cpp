@@ -19,11 +19,13 @@
  *
  */
 #include "texture/image.h"
-#include "decoder/png_decoder.h"
+#include "texture/decoded_texture_cache.h"
+#include "texture/mipmap.h"
 #include "platform/platformgl.h"
 #include <cstring>
 #include <iostream>
 #include "util/logging.h"
+#include "util/util.h"
 #include <unordered_map>
 
 using namespace std;
@@ -32,14 +34,12 @@ namespace programmerjake
 {
 namespace game_puzzle
 {
-Image::Image(wstring resourceName) : data()
+Image::Image(wstring resourceName, TextureOptions textureOptions) : data()
 {
     try
     {
-        shared_ptr<stream::Reader> preader = getResourceReader(resourceName);
-        PngDecoder decoder(*preader);
-        data = shared_ptr<data_t>(new data_t(
-            decoder.removeData(), decoder.width(), decoder.height(), RowOrder::TopToBottom));
+        *this = DecodedTextureCache::load(resourceName, textureOptions.mipmapped);
+        data->textureOptions = textureOptions;
     }
     catch(stream::IOException &e)
     {
@@ -47,6 +47,12 @@ Image::Image(wstring resourceName) : data()
     }
 }
 
+Image::Image(shared_ptr<uint8_t> pixels, unsigned w, unsigned h, RowOrder rowOrder) : data()
+{
+    assert(pixels != nullptr);
+    data = shared_ptr<data_t>(new data_t(std::move(pixels), w, h, rowOrder));
+}
+
 Image::Image(unsigned w, unsigned h) : data()
 {
     data = shared_ptr<data_t>(
@@ -67,7 +73,30 @@ Image::data_t::~data_t()
     {
         freeTexture(texture);
     }
-    delete[] data;
+}
+
+Image::ConstPixelView Image::mapForRead() const
+{
+    assert(data);
+    return ConstPixelView(data.get());
+}
+
+Image::PixelView Image::mapForWrite()
+{
+    assert(data);
+    copyOnWrite();
+    data->textureValid = false;
+    data->mipLevels.clear();
+    return PixelView(data.get(), false);
+}
+
+Image::PixelView Image::mapSharedForWrite()
+{
+    assert(data);
+    PixelView retval(data.get(), true);
+    data->textureValid = false;
+    data->mipLevels.clear();
+    return retval;
 }
 
 void Image::setPixel(int x, int y, ColorI c)
@@ -77,27 +106,12 @@ void Image::setPixel(int x, int y, ColorI c)
         return;
     }
 
-    data->lock.lock();
-
-    if(data->rowOrder == RowOrder::BottomToTop)
-    {
-        y = data->h - y - 1;
-    }
-
     if(y < 0 || (unsigned)y >= data->h || x < 0 || (unsigned)x >= data->w)
     {
-        data->lock.unlock();
         return;
     }
 
-    copyOnWrite();
-    data->textureValid = false;
-    uint8_t *pixel = &data->data[BytesPerPixel * (x + y * data->w)];
-    pixel[0] = c.r;
-    pixel[1] = c.g;
-    pixel[2] = c.b;
-    pixel[3] = c.a;
-    data->lock.unlock();
+    mapForWrite().setPixel(x, y, c);
 }
 
 ColorI Image::getPixel(int x, int y) const
@@ -107,23 +121,106 @@ ColorI Image::getPixel(int x, int y) const
         return RGBAI(0, 0, 0, 0);
     }
 
-    data->lock.lock();
-
-    if(data->rowOrder == RowOrder::BottomToTop)
+    if(y < 0 || (unsigned)y >= data->h || x < 0 || (unsigned)x >= data->w)
     {
-        y = data->h - y - 1;
+        return RGBAI(0, 0, 0, 0);
     }
 
-    if(y < 0 || (unsigned)y >= data->h || x < 0 || (unsigned)x >= data->w)
+    return mapForRead().getPixel(x, y);
+}
+
+void Image::setTextureOptions(TextureOptions textureOptions)
+{
+    std::unique_lock<std::mutex> lockIt(data->lock);
+    if(data->textureOptions == textureOptions)
+        return;
+    data->textureOptions = textureOptions;
+    data->textureValid = false;
+}
+
+Image::TextureOptions Image::getTextureOptions() const
+{
+    std::unique_lock<std::mutex> lockIt(data->lock);
+    return data->textureOptions;
+}
+
+namespace
+{
+#ifdef GL_COMPRESSED_RGBA_ARB
+bool haveTextureCompression()
+{
+    const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+    if(extensions == nullptr)
+        return false;
+    const char *name = "GL_ARB_texture_compression";
+    std::size_t nameLength = std::strlen(name);
+    for(const char *p = std::strstr(extensions, name); p != nullptr;
+        p = std::strstr(p + nameLength, name))
     {
-        data->lock.unlock();
-        return RGBAI(0, 0, 0, 0);
+        if((p == extensions || p[-1] == ' ') && (p[nameLength] == ' ' || p[nameLength] == '\0'))
+            return true;
     }
+    return false;
+}
+#endif
+}
 
-    uint8_t *pixel = &data->data[BytesPerPixel * (x + y * data->w)];
-    ColorI retval = RGBAI(pixel[0], pixel[1], pixel[2], pixel[3]);
-    data->lock.unlock();
-    return retval;
+void Image::uploadTexture(bool isNewTexture, const uint8_t *pixels) const
+{
+    TextureOptions textureOptions = data->textureOptions;
+    if(!isNewTexture && textureOptions == data->uploadedTextureOptions
+       && !textureOptions.mipmapped && !textureOptions.compressed)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        0,
+                        0,
+                        data->w,
+                        data->h,
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        (const GLvoid *)pixels);
+        return;
+    }
+    GLint internalFormat = GL_RGBA;
+#ifdef GL_COMPRESSED_RGBA_ARB
+    if(textureOptions.compressed && haveTextureCompression())
+        internalFormat = GL_COMPRESSED_RGBA_ARB;
+#endif
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 internalFormat,
+                 data->w,
+                 data->h,
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 (const GLvoid *)pixels);
+    if(textureOptions.mipmapped)
+    {
+        if(data->mipLevels.empty())
+            data->mipLevels = generateMipmaps(pixels, data->w, data->h);
+        GLint level = 1;
+        for(const MipLevel &mipLevel : data->mipLevels)
+        {
+            glTexImage2D(GL_TEXTURE_2D,
+                         level++,
+                         internalFormat,
+                         mipLevel.w,
+                         mipLevel.h,
+                         0,
+                         GL_RGBA,
+                         GL_UNSIGNED_BYTE,
+                         (const GLvoid *)mipLevel.pixels.get());
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    data->uploadedTextureOptions = textureOptions;
 }
 
 void Image::bind() const
@@ -137,7 +234,9 @@ void Image::bind() const
     }
 
     data->lock.lock();
-    setRowOrder(RowOrder::BottomToTop);
+    // flip the rows in place if nothing else can be reading them
+    if(isUnique())
+        setRowOrder(RowOrder::BottomToTop);
 
     auto currentGraphicsContextId = getGraphicsContextId();
 
@@ -155,38 +254,28 @@ void Image::bind() const
         return;
     }
 
-    if(data->texture == 0)
+    vector<uint8_t> flippedPixels;
+    const uint8_t *pixels = data->data;
+    if(data->rowOrder != RowOrder::BottomToTop)
+    {
+        // the pixels are shared, so upload a flipped copy
+        getData(flippedPixels, RowOrder::BottomToTop);
+        pixels = flippedPixels.data();
+    }
+    bool isNewTexture = data->texture == 0;
+    if(isNewTexture)
     {
         data->texture = allocateTexture();
         glBindTexture(GL_TEXTURE_2D, data->texture);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexImage2D(GL_TEXTURE_2D,
-                     0,
-                     GL_RGBA,
-                     data->w,
-                     data->h,
-                     0,
-                     GL_RGBA,
-                     GL_UNSIGNED_BYTE,
-                     (GLvoid *)data->data);
     }
     else
     {
         glBindTexture(GL_TEXTURE_2D, data->texture);
-        glTexSubImage2D(GL_TEXTURE_2D,
-                        0,
-                        0,
-                        0,
-                        data->w,
-                        data->h,
-                        GL_RGBA,
-                        GL_UNSIGNED_BYTE,
-                        (GLvoid *)data->data);
     }
+    uploadTexture(isNewTexture, pixels);
 
     data->textureValid = true;
     data->lock.unlock();
@@ -196,31 +285,26 @@ void Image::getData(std::uint8_t *dest, RowOrder rowOrder) const
 {
     assert(dest != nullptr);
     assert(rowOrder == RowOrder::TopToBottom || rowOrder == RowOrder::BottomToTop);
-    data->lock.lock();
-    setRowOrder(rowOrder);
-    const std::uint8_t *src = data->data;
-    for(std::size_t i = getDataSize(); i > 0; i--)
+    ConstPixelView view = mapForRead();
+    std::size_t rowSize = BytesPerPixel * view.width();
+    for(unsigned y = 0; y < view.height(); y++)
     {
-        *dest++ = *src++;
+        unsigned srcY = y;
+        if(rowOrder == RowOrder::BottomToTop)
+            srcY = view.height() - y - 1;
+        std::memcpy(dest, view.row(srcY), rowSize);
+        dest += rowSize;
     }
-    data->lock.unlock();
 }
 
 void Image::setData(const std::uint8_t *src, RowOrder rowOrder)
 {
     assert(src != nullptr);
     assert(rowOrder == RowOrder::TopToBottom || rowOrder == RowOrder::BottomToTop);
-    data->lock.lock();
-    copyOnWrite();
-    data->textureValid = false;
+    mapForWrite();
     data->rowOrder =
         rowOrder; // everything is going to be overwritten so we don't need to use setRowOrder
-    std::uint8_t *dest = data->data;
-    for(std::size_t i = getDataSize(); i > 0; i--)
-    {
-        *dest++ = *src++;
-    }
-    data->lock.unlock();
+    std::memcpy(data->data, src, getDataSize());
 }
 
 void Image::copyRect(
@@ -244,85 +328,32 @@ void Image::copyRect(
         destH = (int)data->h - destTop;
     if(destW <= 0 || destH <= 0)
         return;
-    std::unique_lock<std::mutex> destLock(data->lock, std::defer_lock);
-    std::unique_lock<std::mutex> srcLock;
     if(src.data == data)
     {
-        destLock.lock();
+        // copy first so that the rows we read aren't overwritten before we read them
+        src = Image(data->w, data->h);
+        src.setData(data->data, data->rowOrder);
     }
-    else
-    {
-        srcLock = std::unique_lock<std::mutex>(src.data->lock, std::defer_lock);
-        std::lock(srcLock, destLock);
-    }
-    setRowOrder(RowOrder::TopToBottom);
-    copyOnWrite();
-    src.setRowOrder(RowOrder::TopToBottom);
-    data->textureValid = false;
+    PixelView destView = mapForWrite();
+    ConstPixelView srcView = src.mapForRead();
+    int srcW = srcView.width(), srcH = srcView.height();
+    std::size_t destRowSize = BytesPerPixel * destW;
+    int copyStart = limit(-srcLeft, 0, destW);
+    int copyEnd = limit(srcW - srcLeft, copyStart, destW);
     for(int y = 0; y < destH; y++)
     {
-        int destY = y + destTop;
-        if(data->rowOrder == RowOrder::BottomToTop)
-        {
-            destY = data->h - destY - 1;
-        }
+        std::uint8_t *pDest = destView.row(y + destTop) + BytesPerPixel * destLeft;
         int srcY = y + srcTop;
-        if(src.data->rowOrder == RowOrder::BottomToTop)
-        {
-            srcY = src.data->h - srcY - 1;
-        }
-        if(srcY < 0 || srcY >= (int)src.data->h)
+        if(srcY < 0 || srcY >= srcH || copyStart == copyEnd)
         {
-            std::uint8_t *pDest = &data->data[BytesPerPixel * (destLeft + destY * data->w)];
-            for(int x = 0; x < destW; x++, pDest += BytesPerPixel)
-            {
-                pDest[0] = 0;
-                pDest[1] = 0;
-                pDest[2] = 0;
-                pDest[3] = 0;
-            }
-        }
-        else
-        {
-            int x = 0;
-            std::uint8_t *pDest = &data->data[BytesPerPixel * (destLeft + destY * data->w)];
-            if(srcLeft < 0)
-            {
-                int limit = destW;
-                if(limit > -srcLeft)
-                    limit = -srcLeft;
-                for(; x < limit; x++, pDest += BytesPerPixel)
-                {
-                    pDest[0] = 0;
-                    pDest[1] = 0;
-                    pDest[2] = 0;
-                    pDest[3] = 0;
-                }
-            }
-            const std::uint8_t *pSrc =
-                &src.data->data[BytesPerPixel * (srcLeft + x + srcY * src.data->w)];
-            int limit = (int)src.data->w - srcLeft;
-            if(limit > destW)
-                limit = destW;
-            for(; x < limit; x++, pDest += BytesPerPixel, pSrc += BytesPerPixel)
-            {
-                std::uint8_t r = pSrc[0];
-                std::uint8_t g = pSrc[1];
-                std::uint8_t b = pSrc[2];
-                std::uint8_t a = pSrc[3];
-                pDest[0] = r;
-                pDest[1] = g;
-                pDest[2] = b;
-                pDest[3] = a;
-            }
-            for(; x < destW; x++, pDest += BytesPerPixel)
-            {
-                pDest[0] = 0;
-                pDest[1] = 0;
-                pDest[2] = 0;
-                pDest[3] = 0;
-            }
+            std::memset(pDest, 0, destRowSize);
+            continue;
         }
+        std::memset(pDest, 0, BytesPerPixel * copyStart);
+        std::memcpy(pDest + BytesPerPixel * copyStart,
+                    srcView.row(srcY) + BytesPerPixel * (srcLeft + copyStart),
+                    BytesPerPixel * (copyEnd - copyStart));
+        std::memset(pDest + BytesPerPixel * copyEnd, 0, BytesPerPixel * (destW - copyEnd));
     }
 }
 
@@ -360,22 +391,17 @@ void Image::swapRows(unsigned y1, unsigned y2) const
 
 void Image::copyOnWrite()
 {
-    if(data.unique())
+    if(isUnique())
     {
         return;
     }
 
-    shared_ptr<data_t> newData =
-        shared_ptr<data_t>(new data_t(new uint8_t[BytesPerPixel * data->w * data->h], data));
-
-    for(size_t i = 0; i < BytesPerPixel * data->w * data->h; i++)
-    {
-        newData->data[i] = data->data[i];
-    }
-
-    data->lock.unlock();
-    data = newData;
-    data->lock.lock();
+    // shared pixels are only changed in place by mapSharedForWrite, which the caller keeps
+    // from running at the same time, so they can be copied without locking
+    Image newImage;
+    newImage.data = shared_ptr<data_t>(new data_t(new uint8_t[getDataSize()], data));
+    std::memcpy(newImage.data->data, data->data, getDataSize());
+    *this = std::move(newImage);
 }
 
 struct SerializedImages final
@@ -441,21 +467,14 @@ public:
             return false;
         }
         SerializedImages &me = get(writer);
-        Descriptor descriptor;
-        auto iter = me.imageToDescriptorMap.find(image);
-        if(iter == me.imageToDescriptorMap.end())
-        {
-            descriptor = ++me.validDescriptorCount;
-            me.imageToDescriptorMap[image] = descriptor;
-            stream::write<Descriptor>(writer, descriptor);
-            return true;
-        }
-        else
-        {
-            descriptor = std::get<1>(*iter);
-            stream::write<Descriptor>(writer, descriptor);
+        // a single lookup both finds an already written image and adds a new one
+        auto result = me.imageToDescriptorMap.emplace(image, me.validDescriptorCount + 1);
+        Descriptor descriptor = std::get<1>(*std::get<0>(result));
+        stream::write<Descriptor>(writer, descriptor);
+        if(!std::get<1>(result))
             return false;
-        }
+        ++me.validDescriptorCount;
+        return true;
     }
 };
 
@@ -466,28 +485,10 @@ void Image::write(stream::Writer &writer) const
     getDebugLog() << L"Server : writing image" << postnl;
     stream::write<std::uint32_t>(writer, width());
     stream::write<std::uint32_t>(writer, height());
-    vector<uint8_t> row;
-    row.resize(width() * BytesPerPixel);
-    for(size_t y = 0; y < height(); y++)
-    {
-        data->lock.lock();
-        size_t adjustedY = y;
-        if(data->rowOrder == RowOrder::BottomToTop)
-        {
-            adjustedY = data->h - adjustedY - 1;
-        }
-
-        uint8_t *prow = &data->data[BytesPerPixel * (adjustedY * data->w)];
-        for(size_t x = 0, i = 0; x < width(); x++)
-        {
-            row[i++] = *prow++;
-            row[i++] = *prow++;
-            row[i++] = *prow++;
-            row[i++] = *prow++;
-        }
-        data->lock.unlock();
-        writer.writeBytes(row.data(), row.size());
-    }
+    // written in one block in whichever row order the pixels are stored in, without locking
+    // for the writer's I/O
+    stream::write<bool>(writer, data->rowOrder == RowOrder::BottomToTop);
+    writer.writeBytes(data->data, getDataSize());
 }
 
 Image Image::read(stream::Reader &reader)
@@ -500,9 +501,11 @@ Image Image::read(stream::Reader &reader)
     std::uint32_t w, h;
     w = stream::read<std::uint32_t>(reader);
     h = stream::read<std::uint32_t>(reader);
+    bool isBottomToTop = stream::read<bool>(reader);
     retval = Image(w, h);
-    retval.setRowOrder(RowOrder::TopToBottom);
-    reader.readAllBytes(&retval.data->data[0], BytesPerPixel * w * h);
+    // everything is going to be overwritten so we don't need to use setRowOrder
+    retval.data->rowOrder = isBottomToTop ? RowOrder::BottomToTop : RowOrder::TopToBottom;
+    reader.readAllBytes(&retval.data->data[0], retval.getDataSize());
     SerializedImages::setAfterRead(reader, descriptor, retval);
     return retval;
 }
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2012-2016 Jacob R. Lifshay
+ * This file is part of GamePuzzle.
+ *
+ * GamePuzzle is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GamePuzzle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with GamePuzzle; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "texture/mipmap.h"
+#include "util/util.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace programmerjake
+{
+namespace game_puzzle
+{
+namespace
+{
+constexpr size_t linearToSRGBTableSize = 1 << 12;
+
+struct GammaTables final
+{
+    float sRGBToLinear[0x100];
+    uint8_t linearToSRGB[linearToSRGBTableSize];
+    GammaTables()
+    {
+        for(size_t i = 0; i < 0x100; i++)
+        {
+            float v = i / 255.0f;
+            if(v <= 0.04045f)
+                sRGBToLinear[i] = v / 12.92f;
+            else
+                sRGBToLinear[i] = pow((v + 0.055f) / 1.055f, 2.4f);
+        }
+        for(size_t i = 0; i < linearToSRGBTableSize; i++)
+        {
+            float v = i / static_cast<float>(linearToSRGBTableSize - 1);
+            if(v <= 0.0031308f)
+                v *= 12.92f;
+            else
+                v = 1.055f * pow(v, 1 / 2.4f) - 0.055f;
+            linearToSRGB[i] =
+                static_cast<uint8_t>(limit<int>(static_cast<int>(v * 255 + 0.5f), 0, 0xFF));
+        }
+    }
+    static const GammaTables &get()
+    {
+        static const GammaTables retval;
+        return retval;
+    }
+};
+
+void generateLevel(const GammaTables &tables,
+                   const uint8_t *src,
+                   unsigned srcW,
+                   unsigned srcH,
+                   uint8_t *dest,
+                   unsigned destW,
+                   unsigned destH)
+{
+    const size_t srcRowSize = Image::BytesPerPixel * srcW;
+    for(unsigned y = 0; y < destH; y++)
+    {
+        const uint8_t *srcRow0 = src + srcRowSize * (2 * y);
+        const uint8_t *srcRow1 = srcRow0;
+        if(2 * y + 1 < srcH)
+            srcRow1 += srcRowSize;
+        for(unsigned x = 0; x < destW; x++, dest += Image::BytesPerPixel)
+        {
+            size_t x0 = Image::BytesPerPixel * (2 * x);
+            size_t x1 = x0;
+            if(2 * x + 1 < srcW)
+                x1 += Image::BytesPerPixel;
+            const uint8_t *srcPixels[4] = {srcRow0 + x0, srcRow0 + x1, srcRow1 + x0, srcRow1 + x1};
+            float r = 0, g = 0, b = 0;
+            unsigned a = 0;
+            for(const uint8_t *srcPixel : srcPixels)
+            {
+                float alpha = srcPixel[3];
+                r += tables.sRGBToLinear[srcPixel[0]] * alpha;
+                g += tables.sRGBToLinear[srcPixel[1]] * alpha;
+                b += tables.sRGBToLinear[srcPixel[2]] * alpha;
+                a += srcPixel[3];
+            }
+            if(a == 0)
+            {
+                dest[0] = 0;
+                dest[1] = 0;
+                dest[2] = 0;
+                dest[3] = 0;
+                continue;
+            }
+            float scale = (linearToSRGBTableSize - 1) / static_cast<float>(a);
+            dest[0] = tables.linearToSRGB[static_cast<size_t>(r * scale + 0.5f)];
+            dest[1] = tables.linearToSRGB[static_cast<size_t>(g * scale + 0.5f)];
+            dest[2] = tables.linearToSRGB[static_cast<size_t>(b * scale + 0.5f)];
+            dest[3] = static_cast<uint8_t>((a + 2) / 4);
+        }
+    }
+}
+}
+
+unsigned getMipmapLevelCount(unsigned w, unsigned h)
+{
+    unsigned retval = 1;
+    while(w > 1 || h > 1)
+    {
+        w = std::max<unsigned>(w / 2, 1);
+        h = std::max<unsigned>(h / 2, 1);
+        retval++;
+    }
+    return retval;
+}
+
+vector<Image::MipLevel> generateMipmaps(const uint8_t *pixels, unsigned w, unsigned h)
+{
+    const GammaTables &tables = GammaTables::get();
+    vector<Image::MipLevel> retval;
+    retval.reserve(getMipmapLevelCount(w, h) - 1);
+    while(w > 1 || h > 1)
+    {
+        unsigned newW = std::max<unsigned>(w / 2, 1);
+        unsigned newH = std::max<unsigned>(h / 2, 1);
+        shared_ptr<uint8_t> level(new uint8_t[Image::BytesPerPixel * newW * newH],
+                                  [](uint8_t *level)
+                                  {
+                                      delete[] level;
+                                  });
+        generateLevel(tables, pixels, w, h, level.get(), newW, newH);
+        pixels = level.get();
+        w = newW;
+        h = newH;
+        retval.push_back(Image::MipLevel{std::move(level), w, h});
+    }
+    return retval;
+}
+}
+}
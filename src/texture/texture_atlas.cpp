@@ -19,6 +19,7 @@
  *
  */
 #include "texture/texture_atlas.h"
+#include "texture/dynamic_texture_atlas.h"
 #include <iostream>
 #include <cstdlib>
 #include <cassert>
@@ -33,12 +34,12 @@ namespace game_puzzle
 {
 namespace
 {
-Image loadImage(std::wstring name)
+Image loadImage(std::wstring name, Image::TextureOptions textureOptions)
 {
     try
     {
         getDebugLog() << L"loading '" << name << "'..." << postnl;
-        Image retval = Image(name);
+        Image retval = Image(name, textureOptions);
         return retval;
     }
     catch(exception &e)
@@ -52,26 +53,41 @@ Image loadImage(std::wstring name)
 checked_array<TextureAtlas::ImageDescriptor, TextureAtlas::textureCount> &TextureAtlas::textures()
 {
     static checked_array<TextureAtlas::ImageDescriptor, textureCount> retval = {
+        // textures.png is a grid of 16x16 tiles and font glyphs, so smaller mipmap levels would
+        // blend neighbouring tiles together and blur the text; don't mipmap or compress it
         TextureAtlas::ImageDescriptor(L"textures.png", 256, 256),
-        TextureAtlas::ImageDescriptor(L"steel.png", 256, 256),
+        TextureAtlas::ImageDescriptor(L"steel.png", 256, 256, Image::TextureOptions(true, true)),
         TextureAtlas::ImageDescriptor(L"platform_screenshot.png", 128, 128),
-        TextureAtlas::ImageDescriptor(L"maze_screenshot.png", 512, 512),
+        TextureAtlas::ImageDescriptor(
+            L"maze_screenshot.png", 512, 512, Image::TextureOptions(true, true)),
     };
     return retval;
 }
 
-Image TextureAtlas::texture(std::size_t textureIndex)
+TextureDescriptor TextureAtlas::placement(std::size_t textureIndex)
 {
     auto &textures_array = textures();
     ImageDescriptor &t = textures_array[textureIndex];
-    if(t.image == nullptr)
+    if(t.placement == nullptr)
     {
         for(std::size_t i = textures_array.size() - 1, j = i + 1; j > 0; i--, j--)
         {
-            textures_array[i].image = new Image(loadImage(textures_array[i].fileName));
+            Image image = loadImage(textures_array[i].fileName, textures_array[i].textureOptions);
+            // a page can't be mipmapped without blending neighbouring images together, so
+            // mipmapped images keep their own textures
+            if(textures_array[i].textureOptions == Image::TextureOptions())
+                textures_array[i].placement =
+                    new TextureDescriptor(DynamicTextureAtlas::get().insert(image));
+            else
+                textures_array[i].placement = new TextureDescriptor(image);
         }
     }
-    return *t.image;
+    return *t.placement;
+}
+
+Image TextureAtlas::texture(std::size_t textureIndex)
+{
+    return placement(textureIndex).image;
 }
 
 const TextureAtlas TextureAtlas::Font8x8 = {0, 0, 128, 128, 0},
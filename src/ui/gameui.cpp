@@ -88,6 +88,9 @@ GameUi::GameUi()
       mainMenuSong(std::make_shared<Audio>(L"menu.ogg", true)),
       gameState()
 {
+    // the menu plays first and usually leads to a new game
+    mainMenuSong->prefetch();
+    subgames::prefetchMainSubgame();
 }
 
 void GameUi::startMainMenu()